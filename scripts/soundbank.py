@@ -0,0 +1,120 @@
+"""
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+Sound bank build step: converts data/*.wav into mono IMA-ADPCM data/*.ima
+files that the firmware streams from LittleFS (see src/adpcm.h).
+
+Runs as a PlatformIO pre-script before every build and can be called
+directly: python scripts/soundbank.py [data_dir]
+"""
+
+import os
+import struct
+import sys
+import wave
+
+MAGIC = b"IMA1"
+
+STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41,
+    45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190,
+    209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499,
+    2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845,
+    8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350,
+    22385, 24623, 27086, 29794, 32767,
+]
+
+INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8] * 2
+
+
+def read_pcm(path):
+    """Returns (sample_rate, mono 16-bit samples) of a PCM WAV file."""
+    with wave.open(path, "rb") as wav:
+        if wav.getsampwidth() != 2:
+            raise ValueError("%s: only 16-bit PCM is supported" % path)
+        channels = wav.getnchannels()
+        rate = wav.getframerate()
+        frames = wav.readframes(wav.getnframes())
+
+    samples = struct.unpack("<%dh" % (len(frames) // 2), frames)
+    if channels > 1:
+        samples = [
+            sum(samples[i:i + channels]) // channels
+            for i in range(0, len(samples), channels)
+        ]
+    return rate, list(samples)
+
+
+def encode(samples, predictor=0, index=0):
+    """IMA-ADPCM encoder, two samples per byte, low nibble first."""
+    out = bytearray()
+    nibble = None
+    for sample in samples:
+        step = STEP_TABLE[index]
+        diff = sample - predictor
+        code = 0
+        if diff < 0:
+            code = 8
+            diff = -diff
+
+        vpdiff = step >> 3
+        if diff >= step:
+            code |= 4
+            diff -= step
+            vpdiff += step
+        step >>= 1
+        if diff >= step:
+            code |= 2
+            diff -= step
+            vpdiff += step
+        step >>= 1
+        if diff >= step:
+            code |= 1
+            vpdiff += step
+
+        predictor += -vpdiff if code & 8 else vpdiff
+        predictor = max(-32768, min(32767, predictor))
+        index = max(0, min(88, index + INDEX_TABLE[code]))
+
+        if nibble is None:
+            nibble = code
+        else:
+            out.append(nibble | (code << 4))
+            nibble = None
+    if nibble is not None:
+        out.append(nibble)
+    return bytes(out)
+
+
+def convert(src, dst):
+    rate, samples = read_pcm(src)
+    predictor = samples[0] if samples else 0
+    # header layout matches imaHeader in src/adpcm.h
+    header = MAGIC + struct.pack("<IIhBB", rate, len(samples), predictor, 0, 1)
+    with open(dst, "wb") as out:
+        out.write(header)
+        out.write(encode(samples, predictor))
+    print("soundbank: %s -> %s (%d -> %d bytes)" %
+          (os.path.basename(src), os.path.basename(dst), os.path.getsize(src),
+           os.path.getsize(dst)))
+
+
+def convert_all(data_dir):
+    for name in sorted(os.listdir(data_dir)):
+        if not name.lower().endswith(".wav"):
+            continue
+        src = os.path.join(data_dir, name)
+        dst = os.path.splitext(src)[0] + ".ima"
+        if (os.path.exists(dst) and
+                os.path.getmtime(dst) >= os.path.getmtime(src)):
+            continue
+        convert(src, dst)
+
+
+if __name__ == "__main__":
+    convert_all(sys.argv[1] if len(sys.argv) > 1 else "data")
+else:
+    Import("env")  # noqa: F821 - provided by PlatformIO
+    convert_all(env.subst("$PROJECT_DATA_DIR"))  # noqa: F821
@@ -6,34 +6,26 @@ Copyright 2023 Sergei Chistokhin
 **/
 #include "PomodoroTimer.h"
 
-#include <ESP32Time.h>
-#include <Ticker.h>
 #include <stdint.h>
 
-#include <iomanip>
-#include <sstream>
+#include <algorithm>
 #include <string>
 
 #include "./debug.h"
+#include "./hal.h"
 #include "./main.h"
-#include "./screen.h"
-// ESP32Time rtc;
 
 PomodoroTimer::PomodoroTimer(
     PomodoroLength pomodoroLength /* = PomodoroLength::SMALL */,
     RestLength restLength /* = RestLength::REST_SMALL */)
-    : pomodoroMinutes(toInt(pomodoroLength)),
+    : timerState(PomodoroState::STOPPED),
+      ticking(false),
+      deadline(0),
+      pomodoroMinutes(toInt(pomodoroLength)),
       restMinutes(toInt(restLength)),
-      timerState(PomodoroState::STOPPED),
       pomodoroTimeStart(0),
       pomodoroTimeEnd(0),
-      pauseTime(0),
-      pomodoroTicker([this] { this->tick(); }, 1000) {
-  if (loadWavFile(DING_SOUND, &sound_ding)) {
-    DEBUG_PRINTLN("WAV file loaded into memory");
-  } else {
-    DEBUG_PRINTLN("Failed to load WAV file");
-  }
+      pauseTime(0) {
   DEBUG_PRINTLN("PomodoroTimer initalized");
 }
 
@@ -42,9 +34,8 @@ void PomodoroTimer::startTimer(bool reset_timer, bool rest,
   DEBUG_PRINTLN("Pomodoro timer START. RESET=" + String(reset_timer) +
                 " REST=" + String(rest) +
                 " REPORT_DESIRED=" + String(report_desired));
-  sleepTicker.stop();
-  pomodoroTimeStart = rtc.getEpoch();
-  String state;
+  allow_sleep(false);
+  pomodoroTimeStart = hal::clock().epoch();
   if (reset_timer) {
     if (rest) {
       pomodoroTimeEnd = pomodoroTimeStart + restMinutes * 60;
@@ -56,18 +47,13 @@ void PomodoroTimer::startTimer(bool reset_timer, bool rest,
     pomodoroTimeEnd = pomodoroTimeStart + pauseTime;
   }
 
-  if (rest) {
-    timerState = PomodoroState::REST;
-    state = "REST";
-  } else {
-    timerState = PomodoroState::POMODORO;
-    state = "POMODORO";
-  }
-  pomodoroTicker.start();
+  timerState = rest ? PomodoroState::REST : PomodoroState::POMODORO;
+  ticking = true;
+  setDeadline(pomodoroTimeEnd);
   if (report_desired) {
-    report_state(state, pomodoroTimeStart, true, true);
+    report_state(timerState, pomodoroTimeStart, true, true);
   } else {
-    report_state(state, pomodoroTimeStart);
+    report_state(timerState, pomodoroTimeStart);
   }
   ding();
 }
@@ -76,14 +62,15 @@ void PomodoroTimer::adjustStart(uint32_t startTime) {
   DEBUG_PRINTLN("Pomodoro timer ADJUST");
   if (pomodoroTimeStart != startTime) {
     pomodoroTimeStart = startTime;
-    String state;
+    PomodoroState state;
     if (timerState == PomodoroState::REST) {
       pomodoroTimeEnd = pomodoroTimeStart + restMinutes * 60;
-      state = "REST";
+      state = PomodoroState::REST;
     } else {
       pomodoroTimeEnd = pomodoroTimeStart + pomodoroMinutes * 60;
-      state = "POMODORO";
+      state = PomodoroState::POMODORO;
     }
+    setDeadline(pomodoroTimeEnd);
     report_state(state, pomodoroTimeStart, true, true);
   }
 }
@@ -92,24 +79,48 @@ void PomodoroTimer::startRest() { startTimer(true, true); }
 
 void PomodoroTimer::stopTimer(bool pause) {
   DEBUG_PRINTLN("Pomodoro timer STOP");
-  sleepTicker.start();
+  allow_sleep(true);
   pomodoroTimeStart = 0;
   pomodoroTimeEnd = 0;
   if (pause) {
-    pauseTime = rtc.getEpoch() - pomodoroTimeEnd;
+    pauseTime = hal::clock().epoch() - pomodoroTimeEnd;
     pause = pauseTime > 0;
     pauseTime = pause ? pauseTime : 0;
   } else {
     pauseTime = 0;
   }
   timerState = pause ? PomodoroState::PAUSED : PomodoroState::STOPPED;
-  pomodoroTicker.stop();
-  report_state(pause ? "PAUSED" : "STOPPED", pomodoroTimeStart, true, true);
+  ticking = false;
+  report_state(timerState, pomodoroTimeStart, true, true);
   ding(2);  // honk honk!
 }
 
 void PomodoroTimer::pauseTimer() { stopTimer(true); }
 
+PomodoroTimer::Snapshot PomodoroTimer::snapshot() const {
+  return {timerState,
+          pomodoroTimeStart,
+          pomodoroTimeEnd,
+          pauseTime,
+          static_cast<uint16_t>(pomodoroMinutes),
+          static_cast<uint16_t>(restMinutes)};
+}
+
+void PomodoroTimer::restore(const Snapshot& snapshot) {
+  DEBUG_PRINTLN("Pomodoro timer RESTORE");
+  timerState = snapshot.state;
+  pomodoroTimeStart = snapshot.start;
+  pomodoroTimeEnd = snapshot.end;
+  pauseTime = snapshot.pause_time;
+  pomodoroMinutes = snapshot.pomodoro_minutes;
+  restMinutes = snapshot.rest_minutes;
+
+  ticking = timerState == PomodoroState::POMODORO ||
+            timerState == PomodoroState::REST;
+  setDeadline(pomodoroTimeEnd);
+  allow_sleep(!ticking);
+}
+
 int PomodoroTimer::getTimerPercentage() const {
   int timeleft = getRemainingTime();
   int timerLen = timerState == PomodoroState::REST ? restMinutes * 60
@@ -117,6 +128,12 @@ int PomodoroTimer::getTimerPercentage() const {
   return 100 - ((timeleft * 100) / timerLen);
 }
 
+int PomodoroTimer::getRemainingPermille() const {
+  uint64_t timerLen = timerState == PomodoroState::REST ? restMinutes * 60
+                                                        : pomodoroMinutes * 60;
+  return std::min<uint64_t>(getRemainingMicros() / (timerLen * 1000), 1000);
+}
+
 void PomodoroTimer::setLength(PomodoroLength pomodoroLength,
                               RestLength restLength) {
   pomodoroMinutes = toInt(pomodoroLength);
@@ -141,10 +158,21 @@ void PomodoroTimer::setRest(RestLength restLength) {
 }
 
 void PomodoroTimer::shift(int32_t shift) {
+  // the deadline stays, the session is as long as it was
   pomodoroTimeStart += shift;
   pomodoroTimeEnd += shift;
 }
 
+void PomodoroTimer::setDeadline(uint32_t end) {
+  // the end second on the wall clock, as seen from the monotonic one
+  hal::Clock& clock = hal::clock();
+  uint64_t now = clock.monotonicMicros();
+  int64_t wall = static_cast<int64_t>(clock.epoch()) * 1000000 +
+                 clock.subsecondMicros();
+  int64_t left = static_cast<int64_t>(end) * 1000000 - wall;
+  deadline = left > 0 ? now + left : now;
+}
+
 uint32_t PomodoroTimer::getRemainingTime() const {
   switch (timerState) {
     case PomodoroState::PAUSED:
@@ -156,20 +184,55 @@ uint32_t PomodoroTimer::getRemainingTime() const {
       break;
 
     default:
-      return pomodoroTimeEnd - rtc.getEpoch();
+      return (getRemainingMicros() + 999999) / 1000000;
       break;
   }
 }
 
-std::string PomodoroTimer::formattedTime() const {
+uint64_t PomodoroTimer::getRemainingMicros() const {
+  switch (timerState) {
+    case PomodoroState::PAUSED:
+      return pauseTime * 1000000ull;
+      break;
+
+    case PomodoroState::STOPPED:
+      return 0;
+      break;
+
+    default: {
+      // the end may already be behind after a deep sleep wakeup
+      uint64_t now = hal::clock().monotonicMicros();
+      return now < deadline ? deadline - now : 0;
+      break;
+    }
+  }
+}
+
+size_t PomodoroTimer::formatTime(char* buffer) const {
   uint32_t remainingTime = getRemainingTime();
   uint32_t minutes = remainingTime / 60;
   uint32_t seconds = remainingTime % 60;
+  if (minutes > 999) {
+    minutes = 999;  // longer than any session, keeps it in the buffer
+  }
 
-  std::stringstream ss;
-  ss << std::setw(2) << std::setfill('0') << minutes << ":" << std::setw(2)
-     << std::setfill('0') << seconds;
-  return ss.str();
+  size_t length = 0;
+  if (minutes >= 100) {
+    buffer[length++] = '0' + minutes / 100;
+  }
+  buffer[length++] = '0' + minutes / 10 % 10;
+  buffer[length++] = '0' + minutes % 10;
+  buffer[length++] = ':';
+  buffer[length++] = '0' + seconds / 10;
+  buffer[length++] = '0' + seconds % 10;
+  buffer[length] = '\0';
+  return length;
+}
+
+std::string PomodoroTimer::formattedTime() const {
+  char buffer[TIMER_TEXT_SIZE];
+  formatTime(buffer);
+  return buffer;
 }
 
 int PomodoroTimer::toInt(PomodoroLength length) {
@@ -189,35 +252,13 @@ void PomodoroTimer::tick() {
 }
 
 void PomodoroTimer::ding(int count) const {
-  M5.Power.setVibration(128);
-  for (int i = 0; i < count; i++) {
-    M5.Speaker.playWav(sound_ding.data, sound_ding.size);
-    delay(500);
-  }
-  M5.Power.setVibration(0);
+  // returns immediately, the sound is played asynchronously
+  play_sound(DING_SOUND, count);
 }
 
-bool PomodoroTimer::loadWavFile(const char* filename, WavFile* wavFile) {
-  if (wavFile == nullptr) {
-    return false;  // Pointer is null, cannot proceed
-  }
-
-  File file = LittleFS.open(filename, "r");
-  if (!file) {
-    Serial.printf("Failed to open % for reading", filename);
-    return false;
+void PomodoroTimer::update() {
+  // cheap enough for every loop(), the sleeps end at the deadline
+  if (ticking && hal::clock().monotonicMicros() >= deadline) {
+    tick();
   }
-
-  wavFile->size = file.size();
-  wavFile->data = new uint8_t[wavFile->size];
-  if (file.read(wavFile->data, wavFile->size) != wavFile->size) {
-    Serial.println("Failed to read file into memory");
-    delete[] wavFile->data;
-    return false;
-  }
-
-  file.close();
-  return true;
 }
-
-void PomodoroTimer::update() { pomodoroTicker.update(); }
@@ -6,17 +6,19 @@ Copyright 2023 Sergei Chistokhin
 **/
 
 #pragma once
-#include <ESP32Time.h>
-#include <Ticker.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include <string>
 
+// sound bank files, converted from data/*.wav by scripts/soundbank.py
 // cow bell
-// #define DING_SOUND "/bell.wav"
+// #define DING_SOUND "/bell.ima"
 
 // goose honk
-#define DING_SOUND "/honk.wav"
+#define DING_SOUND "/honk.ima"
+
+#define TIMER_TEXT_SIZE 8  // "MMM:SS" and the terminator
 
 class PomodoroTimer {
  public:
@@ -24,6 +26,16 @@ class PomodoroTimer {
   enum class RestLength { REST_SMALL = 5, REST = 10, REST_BIG = 20 };
   enum class PomodoroState { UNDEFINED, POMODORO, REST, PAUSED, STOPPED };
 
+  // everything needed to continue the timer after a deep sleep
+  struct Snapshot {
+    PomodoroState state;
+    uint32_t start;
+    uint32_t end;
+    uint32_t pause_time;
+    uint16_t pomodoro_minutes;
+    uint16_t rest_minutes;
+  };
+
   PomodoroTimer(PomodoroLength pomodoroLength = PomodoroLength::SMALL,
                 RestLength restLength = RestLength::REST_SMALL);
 
@@ -34,6 +46,9 @@ class PomodoroTimer {
   void stopTimer(bool pause = false);
   void pauseTimer();
 
+  Snapshot snapshot() const;
+  void restore(const Snapshot& snapshot);  // no report, no sound
+
   void update();
 
   bool isRest() const { return timerState == PomodoroState::REST; }
@@ -41,31 +56,35 @@ class PomodoroTimer {
 
   PomodoroState getState() const { return timerState; }
   int getTimerPercentage() const;
+  int getRemainingPermille() const;  // of the session, for the LED strip
   uint32_t getStartTime() const { return pomodoroTimeStart; }
+  uint32_t getEndTime() const { return pomodoroTimeEnd; }
+  // session end on hal::clock().monotonicMicros(), 0 if nothing is running
+  uint64_t getDeadline() const { return ticking ? deadline : 0; }
 
   void setLength(PomodoroLength pomodoroLength, RestLength restLength);
   void setLength(int pomodoroLength, RestLength restLength);
   void setLength(PomodoroLength pomodoroLength);
   void setLength(int pomodoroLength);
   void setRest(RestLength restLength);
-  void shift(int32_t shift);
+  void shift(int32_t shift);  // the wall clock was stepped
 
-  uint32_t getRemainingTime() const;  // returns time in seconds
+  uint32_t getRemainingTime() const;  // returns time in seconds, rounded up
+  uint64_t getRemainingMicros() const;
+  // MM:SS into a TIMER_TEXT_SIZE buffer, no allocations, returns the length
+  size_t formatTime(char* buffer) const;
   std::string formattedTime() const;
 
   static int toInt(PomodoroLength length);
   static int toInt(RestLength length);
 
  private:
-  struct WavFile {
-    uint8_t* data;
-    size_t size;
-  };
-
-  WavFile sound_ding;
-
   PomodoroState timerState;
-  Ticker pomodoroTicker;
+  bool ticking;
+  // Start and end are epoch seconds for the shadow, the session itself runs
+  // on the monotonic clock: the end is converted once when it is set, so
+  // NTP steps of the wall clock don't move it.
+  uint64_t deadline;  // us, monotonic
 
   int pomodoroMinutes;
   int restMinutes;
@@ -75,7 +94,7 @@ class PomodoroTimer {
   uint32_t pauseTime;
 
   void tick();
+  void setDeadline(uint32_t end);
 
   void ding(int count = 1) const;
-  bool loadWavFile(const char* filename, WavFile* wavFile);
 };
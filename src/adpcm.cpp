@@ -0,0 +1,58 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./adpcm.h"
+
+static const int16_t step_table[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+    19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+    337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+    876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+    5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+static const int8_t index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8,
+                                       -1, -1, -1, -1, 2, 4, 6, 8};
+
+static inline int16_t decodeNibble(uint8_t code, adpcmState* state) {
+  int32_t step = step_table[state->index];
+  int32_t vpdiff = step >> 3;
+  if (code & 4) vpdiff += step;
+  if (code & 2) vpdiff += step >> 1;
+  if (code & 1) vpdiff += step >> 2;
+
+  int32_t predictor = state->predictor;
+  predictor += (code & 8) ? -vpdiff : vpdiff;
+  if (predictor > 32767) {
+    predictor = 32767;
+  } else if (predictor < -32768) {
+    predictor = -32768;
+  }
+
+  int32_t index = state->index + index_table[code];
+  if (index < 0) {
+    index = 0;
+  } else if (index > 88) {
+    index = 88;
+  }
+
+  state->predictor = predictor;
+  state->index = index;
+  return predictor;
+}
+
+size_t adpcmDecode(const uint8_t* in, size_t bytes, int16_t* out,
+                   adpcmState* state) {
+  for (size_t i = 0; i < bytes; i++) {
+    *out++ = decodeNibble(in[i] & 0x0F, state);
+    *out++ = decodeNibble(in[i] >> 4, state);
+  }
+  return bytes * 2;
+}
@@ -0,0 +1,32 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// IMA-ADPCM sound bank files (*.ima) produced by scripts/soundbank.py:
+// 16 byte header followed by 4-bit samples, two per byte, low nibble first
+#define IMA_MAGIC "IMA1"
+
+struct __attribute__((packed)) imaHeader {
+  char magic[4];
+  uint32_t sample_rate;
+  uint32_t samples;
+  int16_t predictor;
+  uint8_t index;
+  uint8_t channels;
+};
+
+struct adpcmState {
+  int16_t predictor;
+  uint8_t index;
+};
+
+// decodes bytes * 2 samples into out, returns number of samples written
+size_t adpcmDecode(const uint8_t* in, size_t bytes, int16_t* out,
+                   adpcmState* state);
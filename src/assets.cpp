@@ -0,0 +1,199 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./assets.h"
+
+#include <LittleFS.h>
+#include <M5Unified.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "./debug.h"
+#include "./metrics.h"
+#include "./png.h"
+
+AssetCache assetCache;
+GlyphCache glyphCache;
+
+AssetCache::AssetCache() : count(0), hits(0), misses(0), decode_us(0) {}
+
+AssetCache::~AssetCache() {
+  for (int i = 0; i < count; i++) {
+    assets[i].sprite->deleteSprite();
+    delete assets[i].sprite;
+  }
+}
+
+AssetCache::Asset* AssetCache::find(const char* path) {
+  for (int i = 0; i < count; i++) {
+    if (strcmp(assets[i].path, path) == 0) {
+      return &assets[i];
+    }
+  }
+  return nullptr;
+}
+
+bool AssetCache::load(const char* path, bool transparent) {
+  if (find(path) != nullptr) {
+    return true;
+  }
+  if (count >= ASSET_CACHE_SIZE) {
+    DEBUG_PRINTLN("AssetCache full, can't load " + String(path));
+    return false;
+  }
+
+  int32_t width, height;
+  if (!pngSize(path, &width, &height)) {
+    DEBUG_PRINTLN("AssetCache failed to read " + String(path));
+    return false;
+  }
+
+  auto start = micros();
+  auto sprite = new M5Canvas(&M5.Lcd);
+  sprite->setColorDepth(M5.Lcd.getColorDepth());
+  sprite->setPsram(true);
+  if (sprite->createSprite(width, height) == nullptr) {
+    DEBUG_PRINTLN("AssetCache out of memory for " + String(path));
+    delete sprite;
+    return false;
+  }
+  sprite->fillSprite(transparent ? ASSET_TRANSPARENT : TFT_BLACK);
+  sprite->drawPngFile(LittleFS, path, 0, 0);
+  auto elapsed = micros() - start;
+  decode_us += elapsed;
+  METRIC_RECORD(PngDecode, elapsed);
+
+  assets[count++] = {path, sprite, transparent};
+  DEBUG_PRINTF("AssetCache loaded %s %dx%d in %u us\n", path, width, height,
+               elapsed);
+  return true;
+}
+
+bool AssetCache::draw(LovyanGFX* dst, const char* path, int32_t x, int32_t y,
+                      bool transparent) {
+  auto asset = find(path);
+  if (asset == nullptr) {
+    misses++;
+    if (!load(path, transparent)) {
+      // fall back to direct decoding so the frame is still complete
+      METRIC_SCOPE(PngDecode);
+      return dst->drawPngFile(LittleFS, path, x, y);
+    }
+    asset = find(path);
+  } else {
+    hits++;
+  }
+
+  if (asset->transparent) {
+    asset->sprite->pushSprite(dst, x, y, ASSET_TRANSPARENT);
+  } else {
+    asset->sprite->pushSprite(dst, x, y);
+  }
+  return true;
+}
+
+GlyphCache::GlyphCache() : count(0), hits(0), misses(0) {}
+
+GlyphCache::~GlyphCache() {
+  for (int i = 0; i < count; i++) {
+    sheets[i].sprite->deleteSprite();
+    delete sheets[i].sprite;
+  }
+}
+
+GlyphCache::Sheet* GlyphCache::find(const lgfx::IFont* font, float size,
+                                    uint32_t color) {
+  for (int i = 0; i < count; i++) {
+    if (sheets[i].font == font && sheets[i].size == size &&
+        sheets[i].color == color) {
+      return &sheets[i];
+    }
+  }
+  return nullptr;
+}
+
+bool GlyphCache::load(const lgfx::IFont* font, float size, uint32_t color) {
+  if (find(font, size, color) != nullptr) {
+    return true;
+  }
+  if (count >= GLYPH_CACHE_SIZE) {
+    DEBUG_PRINTLN("GlyphCache full");
+    return false;
+  }
+
+  auto start = micros();
+  auto sprite = new M5Canvas(&M5.Lcd);
+  sprite->setColorDepth(M5.Lcd.getColorDepth());
+  sprite->setPsram(true);
+  sprite->setFont(font);
+  sprite->setTextSize(size);
+
+  Sheet sheet = {font, size, color, sprite, {}};
+  char glyph[2] = {0, 0};
+  for (int i = 0; i < GLYPH_COUNT; i++) {
+    glyph[0] = GLYPH_CHARSET[i];
+    sheet.metrics.width[i] = sprite->textWidth(glyph);
+  }
+  sheet.metrics.height = sprite->fontHeight();
+  int32_t width = glyphArrange(&sheet.metrics);
+  if (sprite->createSprite(width, sheet.metrics.height) == nullptr) {
+    DEBUG_PRINTLN("GlyphCache out of memory");
+    delete sprite;
+    return false;
+  }
+  sprite->fillSprite(ASSET_TRANSPARENT);
+  sprite->setTextColor(color);
+  sprite->setTextDatum(textdatum_t::top_left);
+  for (int i = 0; i < GLYPH_COUNT; i++) {
+    glyph[0] = GLYPH_CHARSET[i];
+    sprite->drawString(glyph, sheet.metrics.x[i], 0);
+  }
+
+  sheets[count++] = sheet;
+  DEBUG_PRINTF("GlyphCache loaded %dx%d sheet in %u us\n", width,
+               sheet.metrics.height, micros() - start);
+  return true;
+}
+
+bool GlyphCache::draw(LovyanGFX* dst, const lgfx::IFont* font, float size,
+                      uint32_t color, const char* text, int32_t x,
+                      int32_t y) {
+  auto sheet = find(font, size, color);
+  glyphCell cells[GLYPH_TEXT_LENGTH];
+  int cell_count = 0;
+  if (sheet != nullptr) {
+    cell_count = glyphLayout(sheet->metrics, text, x, cells,
+                             GLYPH_TEXT_LENGTH);
+  }
+  if (cell_count == 0) {
+    misses++;
+    return false;
+  }
+  hits++;
+
+  // every cell is pushed through a clip rect of its own, inside the
+  // caller's, so only that glyph of the sheet lands on dst
+  int32_t clip_x, clip_y, clip_w, clip_h;
+  dst->getClipRect(&clip_x, &clip_y, &clip_w, &clip_h);
+  int32_t top = y - sheet->metrics.height / 2;
+  int32_t y0 = std::max(top, clip_y);
+  int32_t y1 = std::min(top + sheet->metrics.height, clip_y + clip_h);
+  for (int i = 0; i < cell_count && y1 > y0; i++) {
+    int32_t x0 = std::max<int32_t>(cells[i].x, clip_x);
+    int32_t x1 = std::min<int32_t>(cells[i].x + cells[i].width,
+                                   clip_x + clip_w);
+    if (x1 <= x0) {
+      continue;
+    }
+    dst->setClipRect(x0, y0, x1 - x0, y1 - y0);
+    sheet->sprite->pushSprite(dst, cells[i].x - cells[i].sheet_x, top,
+                              ASSET_TRANSPARENT);
+  }
+  dst->setClipRect(clip_x, clip_y, clip_w, clip_h);
+  return true;
+}
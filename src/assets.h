@@ -0,0 +1,91 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <LittleFS.h>
+#include <M5Unified.h>
+#include <stdint.h>
+
+#include "./glyphs.h"
+
+// max number of decoded images kept in PSRAM
+#define ASSET_CACHE_SIZE 8
+// max number of font, size and color combinations with a glyph sheet
+#define GLYPH_CACHE_SIZE 2
+
+// color key used for PNGs with alpha channel (icons)
+#define ASSET_TRANSPARENT TFT_TRANSPARENT
+
+// PNG files are decoded once into PSRAM sprites in the display color format
+// and then blitted from memory instead of inflating the file on every frame
+class AssetCache {
+ public:
+  AssetCache();
+  ~AssetCache();
+
+  bool load(const char* path, bool transparent = false);
+  bool draw(LovyanGFX* dst, const char* path, int32_t x = 0, int32_t y = 0,
+            bool transparent = false);
+
+  uint32_t getHits() const { return hits; }
+  uint32_t getMisses() const { return misses; }
+  uint32_t getDecodeTime() const { return decode_us; }  // total, microseconds
+
+ private:
+  struct Asset {
+    const char* path;
+    M5Canvas* sprite;
+    bool transparent;
+  };
+
+  Asset assets[ASSET_CACHE_SIZE];
+  int count;
+
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t decode_us;
+
+  Asset* find(const char* path);
+};
+
+extern AssetCache assetCache;
+
+// Countdown digits pre-rendered into PSRAM glyph sheets, one per font, size
+// and color, see glyphs.h. The time is composed by blitting the cells.
+class GlyphCache {
+ public:
+  GlyphCache();
+  ~GlyphCache();
+
+  bool load(const lgfx::IFont* font, float size, uint32_t color);
+  // like drawString() with middle_center, false if there is no sheet for
+  // the font or a character isn't on it, the caller draws the text then
+  bool draw(LovyanGFX* dst, const lgfx::IFont* font, float size,
+            uint32_t color, const char* text, int32_t x, int32_t y);
+
+  uint32_t getHits() const { return hits; }
+  uint32_t getMisses() const { return misses; }
+
+ private:
+  struct Sheet {
+    const lgfx::IFont* font;
+    float size;
+    uint32_t color;
+    M5Canvas* sprite;
+    glyphMetrics metrics;
+  };
+
+  Sheet sheets[GLYPH_CACHE_SIZE];
+  int count;
+
+  uint32_t hits;
+  uint32_t misses;
+
+  Sheet* find(const lgfx::IFont* font, float size, uint32_t color);
+};
+
+extern GlyphCache glyphCache;
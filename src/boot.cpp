@@ -0,0 +1,54 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./boot.h"
+
+#include <esp_timer.h>
+
+BootTimeline bootTimeline;
+
+void BootTimeline::mark(Phase phase) {
+  int i = static_cast<int>(phase);
+  if (at[i] == 0) {
+    at[i] = static_cast<uint32_t>(esp_timer_get_time());
+  }
+}
+
+const char* BootTimeline::name(Phase phase) {
+  switch (phase) {
+    case Phase::Setup:
+      return "setup";
+    case Phase::Display:
+      return "display";
+    case Phase::Restored:
+      return "restored";
+    case Phase::FirstPixel:
+      return "first_pixel";
+    case Phase::InputReady:
+      return "input_ready";
+    case Phase::FirstInput:
+      return "first_input";
+    case Phase::WifiConnected:
+      return "wifi";
+    case Phase::MqttConnected:
+      return "mqtt";
+    default:
+      return "?";
+  }
+}
+
+void BootTimeline::report(Print* out) const {
+  out->printf("boot timeline: wakeup cause %d, wifi %s\n", wakeup_cause,
+              wifi_cached ? "cached channel/BSSID" : "full scan");
+  for (int i = 0; i < static_cast<int>(Phase::Count); i++) {
+    if (at[i] == 0) {
+      out->printf("  %-12s        -\n", name(static_cast<Phase>(i)));
+    } else {
+      out->printf("  %-12s %8u us\n", name(static_cast<Phase>(i)), at[i]);
+    }
+  }
+}
@@ -0,0 +1,44 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <Arduino.h>
+#include <stdint.h>
+
+// Boot phase timestamps in microseconds since the chip started, printed once
+// MQTT is connected so every wakeup shows where the time went
+class BootTimeline {
+ public:
+  enum class Phase {
+    Setup,          // setup() entered
+    Display,        // M5.begin() done
+    Restored,       // timer state restored from RTC memory
+    FirstPixel,     // first frame on the LCD
+    InputReady,     // HMI unit initialized
+    FirstInput,     // first touch, button or encoder step
+    WifiConnected,  // got IP
+    MqttConnected,  // subscribed to the shadow topics
+    Count
+  };
+
+  void mark(Phase phase);  // only the first mark of a phase counts
+  bool reached(Phase phase) const { return at[static_cast<int>(phase)] != 0; }
+  void setWakeup(int cause, bool fast_wifi) {
+    wakeup_cause = cause;
+    wifi_cached = fast_wifi;
+  }
+  void report(Print* out) const;
+
+  static const char* name(Phase phase);
+
+ private:
+  uint32_t at[static_cast<int>(Phase::Count)] = {};
+  int wakeup_cause = 0;
+  bool wifi_cached = false;
+};
+
+extern BootTimeline bootTimeline;
@@ -0,0 +1,54 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// Bounded lock-free single producer / single consumer queue. One task may
+// push() and one other task may pop(), no locks or allocations involved.
+// Holds up to Size - 1 items.
+template <typename T, size_t Size>
+class CommandQueue {
+ public:
+  bool push(const T& item) {
+    size_t tail = write.load(std::memory_order_relaxed);
+    size_t next = (tail + 1) % Size;
+    if (next == read.load(std::memory_order_acquire)) {
+      dropped++;
+      return false;  // full
+    }
+    items[tail] = item;
+    write.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T* item) {
+    size_t head = read.load(std::memory_order_relaxed);
+    if (head == write.load(std::memory_order_acquire)) {
+      return false;  // empty
+    }
+    *item = items[head];
+    read.store((head + 1) % Size, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return read.load(std::memory_order_acquire) ==
+           write.load(std::memory_order_acquire);
+  }
+
+  uint32_t getDropped() const { return dropped; }  // producer side counter
+
+ private:
+  T items[Size];
+  std::atomic<size_t> read{0};
+  std::atomic<size_t> write{0};
+  uint32_t dropped = 0;
+};
@@ -0,0 +1,199 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./connection.h"
+
+#include <stdio.h>
+
+void Link::connecting(uint32_t now) {
+  state = State::Connecting;
+  attempt_at = now;
+  attempts++;
+}
+
+void Link::connected(uint32_t now) {
+  // the streak is kept until the session proves stable, see lost()
+  state = State::Up;
+  up_since = now;
+  score(100);
+}
+
+void Link::failed(uint32_t now, uint32_t random) {
+  state = State::Down;
+  failures++;
+  retryLater(now, random);
+  score(0);
+}
+
+void Link::lost(uint32_t now, bool drop, uint32_t random) {
+  bool flapping = false;
+  if (state == State::Up) {
+    uptime_ms += now - up_since;
+    if (drop) {
+      drops++;
+      score(0);
+      flapping = now - up_since < LINK_STABLE;
+    }
+  }
+  state = State::Down;
+  if (flapping) {
+    retryLater(now, random);
+  } else {
+    streak = 0;
+    backoff = 0;
+    next = now;  // reconnect right away, failures will back off from here
+  }
+}
+
+void Link::retryLater(uint32_t now, uint32_t random) {
+  // exponential backoff with equal jitter: half fixed, half random
+  if (streak < 31) {
+    streak++;
+  }
+  uint32_t base = LINK_BACKOFF_MAX;
+  if (streak <= 16 && (LINK_BACKOFF_MIN << (streak - 1)) < LINK_BACKOFF_MAX) {
+    base = LINK_BACKOFF_MIN << (streak - 1);
+  }
+  backoff = base / 2 + random % (base / 2 + 1);
+  next = now + backoff;
+}
+
+uint32_t Link::waitLeft(uint32_t now) const {
+  int32_t left;
+  if (state == State::Connecting) {
+    left = attempt_at + timeout - now;
+  } else if (state == State::Down) {
+    left = next - now;
+  } else {
+    return 0;
+  }
+  return left > 0 ? left : 0;
+}
+
+uint32_t Link::getUptime(uint32_t now) const {
+  return (uptime_ms + (state == State::Up ? now - up_since : 0)) / 1000;
+}
+
+uint32_t Link::getSession(uint32_t now) const {
+  return state == State::Up ? (now - up_since) / 1000 : 0;
+}
+
+ConnectionManager::ConnectionManager()
+    : links{Link("wifi", LINK_WIFI_TIMEOUT), Link("tls", 0),
+            Link("mqtt", 0)} {}
+
+uint32_t ConnectionManager::random() {
+  // xorshift32
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+void ConnectionManager::drop(Layer layer, uint32_t now) {
+  links[layer].lost(now, true, random());
+  for (int i = layer + 1; i < LayerCount; i++) {
+    links[i].lost(now, false, 0);  // not their fault
+  }
+}
+
+uint32_t ConnectionManager::update(uint32_t now, bool wifi_up, bool tls_up,
+                                   bool mqtt_up) {
+  bool up[LayerCount] = {wifi_up, tls_up, mqtt_up};
+  uint32_t timed_out = 0;
+  for (int i = 0; i < LayerCount; i++) {
+    Link& link = links[i];
+    if (link.getState() == Link::State::Up && !up[i]) {
+      drop(static_cast<Layer>(i), now);
+    } else if (link.getState() == Link::State::Connecting) {
+      if (up[i]) {
+        link.connected(now);  // asynchronous connects, Wi-Fi
+      } else if (link.timedOut(now)) {
+        failed(static_cast<Layer>(i), now);
+        timed_out |= 1u << i;
+      }
+    }
+  }
+  return timed_out;
+}
+
+bool ConnectionManager::shouldConnect(Layer layer, uint32_t now) const {
+  if (!links[layer].due(now)) {
+    return false;
+  }
+  for (int i = 0; i < layer; i++) {
+    if (links[i].getState() != Link::State::Up) {
+      return false;
+    }
+  }
+  for (int i = layer + 1; i < LayerCount; i++) {
+    if (!links[i].due(now)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ConnectionManager::connecting(Layer layer, uint32_t now) {
+  links[layer].connecting(now);
+}
+
+void ConnectionManager::connected(Layer layer, uint32_t now) {
+  links[layer].connected(now);
+}
+
+void ConnectionManager::failed(Layer layer, uint32_t now) {
+  links[layer].failed(now, random());
+}
+
+void ConnectionManager::closed(Layer layer, uint32_t now) {
+  for (int i = layer; i < LayerCount; i++) {
+    if (links[i].getState() != Link::State::Down) {
+      links[i].lost(now, false, 0);
+    }
+  }
+}
+
+uint32_t ConnectionManager::nextWake(uint32_t now) const {
+  // only the lowest layer that isn't up can make progress
+  for (int i = 0; i < LayerCount; i++) {
+    const Link& link = links[i];
+    if (link.getState() == Link::State::Up) {
+      continue;
+    }
+    if (link.getState() == Link::State::Connecting) {
+      return link.waitLeft(now);
+    }
+    // down: it's attempted once it and everything above it are due
+    uint32_t wake = 0;
+    for (int j = i; j < LayerCount; j++) {
+      uint32_t left = links[j].waitLeft(now);
+      if (left > wake) {
+        wake = left;
+      }
+    }
+    return wake;
+  }
+  return UINT32_MAX;
+}
+
+size_t ConnectionManager::describe(char* buffer, size_t size,
+                                   uint32_t now) const {
+  static const char* states[] = {"down", "connecting", "up"};
+  size_t length = 0;
+  for (int i = 0; i < LayerCount && length < size; i++) {
+    const Link& link = links[i];
+    length += snprintf(
+        buffer + length, size - length,
+        "%-5s %-10s health=%3u attempts=%u failures=%u drops=%u uptime=%us "
+        "backoff=%ums\n",
+        link.getName(), states[static_cast<int>(link.getState())],
+        link.getHealth(), link.getAttempts(), link.getFailures(),
+        link.getDrops(), link.getUptime(now), link.getBackoff());
+  }
+  return length < size ? length : size;
+}
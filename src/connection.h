@@ -0,0 +1,113 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Reconnect scheduling for the Wi-Fi, TLS and MQTT layers. Every layer has
+// its own state, exponential backoff with jitter and a health score. A layer
+// is only brought up when every layer above it wants a connection too, so
+// a broker in backoff doesn't keep Wi-Fi and TLS busy. Losing a layer drops
+// the ones above it without counting against their backoff. A layer that
+// keeps dropping soon after connecting is treated as failing (the breaker
+// stays open) until it holds a session for LINK_STABLE. All times are
+// millis(), nothing here talks to the drivers.
+
+#define LINK_BACKOFF_MIN 1000         // ms
+#define LINK_BACKOFF_MAX (5 * 60000)  // ms
+#define LINK_WIFI_TIMEOUT 15000       // ms, WiFi.begin() to GOT_IP
+#define LINK_STABLE 30000             // ms, shorter sessions are flapping
+
+class Link {
+ public:
+  enum class State { Down, Connecting, Up };
+
+  Link(const char* name, uint32_t timeout) : name(name), timeout(timeout) {}
+
+  bool due(uint32_t now) const {
+    return state == State::Down && static_cast<int32_t>(now - next) >= 0;
+  }
+  void connecting(uint32_t now);
+  void connected(uint32_t now);
+  void failed(uint32_t now, uint32_t random);
+  // drop - this layer itself failed rather than one below it
+  void lost(uint32_t now, bool drop, uint32_t random);
+  bool timedOut(uint32_t now) const {
+    return state == State::Connecting && timeout > 0 &&
+           now - attempt_at >= timeout;
+  }
+  // ms until the next attempt is allowed or the current one times out
+  uint32_t waitLeft(uint32_t now) const;
+
+  State getState() const { return state; }
+  const char* getName() const { return name; }
+  uint32_t getNext() const { return next; }
+  uint8_t getHealth() const { return health; }  // 0 - 100
+  uint32_t getAttempts() const { return attempts; }
+  uint32_t getFailures() const { return failures; }
+  uint32_t getDrops() const { return drops; }
+  uint32_t getUptime(uint32_t now) const;  // s, all sessions together
+  uint32_t getSession(uint32_t now) const;  // s, current session
+  uint32_t getBackoff() const { return backoff; }
+
+ private:
+  const char* name;
+  uint32_t timeout;  // ms in Connecting, 0 - synchronous connect
+
+  State state = State::Down;
+  uint32_t next = 0;  // earliest next attempt
+  uint32_t attempt_at = 0;
+  uint32_t up_since = 0;
+  uint32_t backoff = 0;  // last delay
+  uint8_t streak = 0;  // failures and short sessions in a row
+  uint8_t health = 100;
+
+  uint32_t attempts = 0;
+  uint32_t failures = 0;
+  uint32_t drops = 0;
+  uint64_t uptime_ms = 0;
+
+  void score(uint8_t sample) { health = (health * 3 + sample) / 4; }
+  void retryLater(uint32_t now, uint32_t random);
+};
+
+class ConnectionManager {
+ public:
+  enum Layer { Wifi, Tls, Mqtt, LayerCount };
+
+  ConnectionManager();
+  void seed(uint32_t value) { random_state = value ? value : 1; }
+
+  // reconciles the links with the drivers, call on every network pass.
+  // Returns a bit (1 << layer) per attempt that timed out, its driver has
+  // to be told to give up.
+  uint32_t update(uint32_t now, bool wifi_up, bool tls_up, bool mqtt_up);
+
+  // the layer is due and everything above it is waiting for it
+  bool shouldConnect(Layer layer, uint32_t now) const;
+  void connecting(Layer layer, uint32_t now);
+  void connected(Layer layer, uint32_t now);
+  void failed(Layer layer, uint32_t now);
+  // torn down on purpose, e.g. TLS after the MQTT layer above it failed
+  void closed(Layer layer, uint32_t now);
+
+  // ms until the next attempt or timeout that needs a wakeup, UINT32_MAX if
+  // nothing is scheduled
+  uint32_t nextWake(uint32_t now) const;
+
+  const Link& link(Layer layer) const { return links[layer]; }
+  bool isUp() const { return links[Mqtt].getState() == Link::State::Up; }
+  size_t describe(char* buffer, size_t size, uint32_t now) const;
+
+ private:
+  Link links[LayerCount];
+  uint32_t random_state = 2463534242u;
+
+  uint32_t random();
+  void drop(Layer layer, uint32_t now);  // the layer and everything above
+};
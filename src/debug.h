@@ -8,7 +8,7 @@ Copyright 2023 Sergei Chistokhin
 
 #define DEBUG 1
 
-#if (DEBUG == 1)
+#if (DEBUG == 1) && !defined(NATIVE)
 #define DEBUG_PRINT(x) Serial.print(x)
 #define DEBUG_PRINTLN(x) Serial.println(x)
 #define DEBUG_PRINTF(x, ...) Serial.printf(x, __VA_ARGS__)
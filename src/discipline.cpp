@@ -0,0 +1,235 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./discipline.h"
+
+#include <string.h>
+
+#define NTP_UNIX_OFFSET 2208988800ull  // 1900 to 1970, s
+
+static void writeTimestamp(uint8_t* out, int64_t us) {
+  uint32_t seconds = us / 1000000 + NTP_UNIX_OFFSET;
+  uint32_t fraction = ((us % 1000000) << 32) / 1000000;
+  for (int i = 0; i < 4; i++) {
+    out[i] = seconds >> (24 - i * 8);
+    out[4 + i] = fraction >> (24 - i * 8);
+  }
+}
+
+static int64_t readTimestamp(const uint8_t* in) {
+  uint32_t seconds = 0, fraction = 0;
+  for (int i = 0; i < 4; i++) {
+    seconds = seconds << 8 | in[i];
+    fraction = fraction << 8 | in[4 + i];
+  }
+  return (seconds - NTP_UNIX_OFFSET) * 1000000 +
+         ((static_cast<uint64_t>(fraction) * 1000000) >> 32);
+}
+
+void ntpEncodeRequest(uint8_t* packet, int64_t t1) {
+  memset(packet, 0, NTP_PACKET_SIZE);
+  packet[0] = 0x23;  // no leap warning, version 4, client
+  // the server echoes it as the originate timestamp
+  writeTimestamp(packet + 40, t1);
+}
+
+bool ntpDecodeResponse(const uint8_t* packet, size_t size, int64_t t1,
+                       int64_t t4, clockSample* sample) {
+  uint8_t originate[8];
+  writeTimestamp(originate, t1);
+  if (size < NTP_PACKET_SIZE || (packet[0] & 0x07) != 4 || packet[1] == 0 ||
+      packet[1] > 15 || memcmp(packet + 24, originate, 8) != 0) {
+    return false;  // not a server reply, kiss-o'-death or not ours
+  }
+  int64_t t2 = readTimestamp(packet + 32);  // server receive
+  int64_t t3 = readTimestamp(packet + 40);  // server transmit
+  sample->offset = ((t2 - t1) + (t3 - t4)) / 2;
+  sample->delay = (t4 - t1) - (t3 - t2);
+  return true;
+}
+
+ClockDiscipline::ClockDiscipline(clockState* state) : state(state) {
+  if (state->magic != CLOCK_MAGIC) {
+    memset(state, 0, sizeof(*state));
+    state->magic = CLOCK_MAGIC;
+  }
+}
+
+void ClockDiscipline::addSample(const clockSample& sample) {
+  stats.samples++;
+  if (burst_size < CLOCK_BURST) {
+    burst[burst_size++] = sample;
+  }
+}
+
+void ClockDiscipline::learn(float* estimate, uint8_t bit, float ppm) {
+  if (ppm > CLOCK_DRIFT_LIMIT || ppm < -CLOCK_DRIFT_LIMIT) {
+    return;
+  }
+  if (state->valid & bit) {
+    *estimate += (ppm - *estimate) / 4;
+  } else {
+    *estimate = ppm;
+    state->valid |= bit;
+  }
+}
+
+ClockDiscipline::Action ClockDiscipline::update(uint64_t mono,
+                                                int64_t* offset) {
+  if (burst_size == 0) {
+    return Action::None;
+  }
+  // queueing only ever adds delay, the fastest reply is the most accurate
+  const clockSample* best = &burst[0];
+  for (int i = 1; i < burst_size; i++) {
+    if (burst[i].delay < best->delay) {
+      best = &burst[i];
+    }
+  }
+  burst_size = 0;
+  int64_t measured = best->offset;
+  stats.syncs++;
+  stats.last_offset = measured;
+  stats.last_delay = best->delay;
+
+  // one large offset is more likely a bad reply than a clock jump
+  bool large = measured > CLOCK_STEP_LIMIT || measured < -CLOCK_STEP_LIMIT;
+  if (large && synced() && !spike) {
+    spike = true;
+    stats.spikes++;
+    return Action::None;
+  }
+  spike = false;
+
+  if (state->slept > 0) {
+    // the error left after the wakeup correction, over the whole sleep
+    learn(&state->sleep_ppm, CLOCK_SLEEP,
+          state->slept_ppm - measured * 1e6 / state->slept);
+    state->slept = 0;
+  } else if (synced() && !large) {
+    // every offset since the anchor was corrected, so their sum is what the
+    // clock gained, and the reply delays only blur both ends of it
+    drift_sum += measured;
+    uint64_t baseline = mono - drift_mono;
+    if (baseline >= CLOCK_MIN_BASELINE * 1000000ull) {
+      float ppm = -drift_sum * 1e6 / static_cast<double>(baseline);
+      if (ppm <= CLOCK_DRIFT_LIMIT && ppm >= -CLOCK_DRIFT_LIMIT) {
+        state->system_ppm = ppm;
+        state->valid |= CLOCK_SYSTEM;
+      }
+    }
+  }
+  if (!synced() || large) {
+    drift_mono = mono;  // the clock is set from here on
+    drift_sum = 0;
+  }
+  sync_mono = mono;
+
+  *offset = measured;
+  if (large) {
+    stats.steps++;
+    return Action::Step;
+  }
+  if (measured == 0) {
+    return Action::None;
+  }
+  stats.slews++;
+  int64_t size = measured < 0 ? -measured : measured;
+  if (size > stats.max_offset) {
+    stats.max_offset = size;
+  }
+  return Action::Slew;
+}
+
+uint32_t ClockDiscipline::pollInterval() const {
+  int64_t last = stats.last_offset;
+  if (!(state->valid & CLOCK_SYSTEM) || spike || last > CLOCK_DRIFT_BUDGET ||
+      last < -CLOCK_DRIFT_BUDGET) {
+    return CLOCK_POLL_MIN;
+  }
+  // ppm is us per s, the budget lasts this many seconds
+  float ppm = state->system_ppm < 0 ? -state->system_ppm : state->system_ppm;
+  if (ppm * CLOCK_POLL_MAX <= CLOCK_DRIFT_BUDGET) {
+    return CLOCK_POLL_MAX;
+  }
+  uint32_t interval = CLOCK_DRIFT_BUDGET / ppm;
+  return interval > CLOCK_POLL_MIN ? interval : CLOCK_POLL_MIN;
+}
+
+void ClockDiscipline::sleeping(int64_t wall) {
+  state->sleep_start = wall;
+  state->sleep_synced = synced();
+}
+
+int64_t ClockDiscipline::wakeCorrection(int64_t wall) {
+  int64_t start = state->sleep_start;
+  state->sleep_start = 0;
+  if (start == 0 || wall <= start) {
+    return 0;
+  }
+  int64_t slept = wall - start;
+  float ppm = (state->valid & CLOCK_SLEEP) ? state->sleep_ppm : 0;
+  // only a clock that was on time before the sleep tells the drift
+  state->slept = state->sleep_synced ? slept : 0;
+  state->slept_ppm = ppm;
+  stats.wake_correction = static_cast<int64_t>(-ppm * (slept / 1e6));
+  return stats.wake_correction;
+}
+
+bool ClockDiscipline::rtcDue(int64_t wall) const {
+  return synced() &&
+         (state->rtc_wall == 0 ||
+          wall - state->rtc_wall >= CLOCK_RTC_BASELINE * 1000000ll);
+}
+
+void ClockDiscipline::rtcSample(int64_t wall, int64_t rtc_offset) {
+  if (!synced()) {
+    return;
+  }
+  if (state->rtc_wall != 0) {
+    int64_t baseline = wall - state->rtc_wall;
+    if (baseline < CLOCK_RTC_BASELINE * 1000000ll) {
+      return;
+    }
+    learn(&state->rtc_ppm, CLOCK_RTC,
+          (rtc_offset - state->rtc_offset) * 1e6 /
+              static_cast<double>(baseline));
+  }
+  state->rtc_wall = wall;
+  state->rtc_offset = rtc_offset;
+}
+
+int64_t ClockDiscipline::rtcCorrection(int64_t rtc) const {
+  if (!(state->valid & CLOCK_RTC) || state->rtc_wall == 0 ||
+      rtc <= state->rtc_wall) {
+    return 0;
+  }
+  // the offset at the last comparison plus what it has drifted since
+  double drift = state->rtc_ppm * ((rtc - state->rtc_wall) / 1e6);
+  return -(state->rtc_offset + static_cast<int64_t>(drift));
+}
+
+bool RtcEdge::read(int64_t wall, int64_t rtc, int64_t* wall_edge,
+                   int64_t* offset) {
+  if (!busy) {
+    return false;
+  }
+  if (first_wall == 0) {
+    first_wall = wall;
+  } else if (rtc != last_rtc) {
+    busy = false;
+    *wall_edge = last_wall + (wall - last_wall) / 2;
+    *offset = rtc * 1000000 - *wall_edge;
+    return true;
+  } else if (wall - first_wall > CLOCK_EDGE_TIMEOUT) {
+    busy = false;  // the BM8563 stopped or the reads failed
+    return false;
+  }
+  last_wall = wall;
+  last_rtc = rtc;
+  return false;
+}
@@ -0,0 +1,144 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Keeps the wall clock on NTP time. Each sync sends a burst of SNTP queries
+// and trusts the reply with the shortest round trip. Small offsets are
+// slewed, large ones stepped, but only when the next sync confirms them.
+// The drift of three clocks is learned along the way:
+// - the system clock while awake, from the offsets corrected since the
+//   first sync, and used to space the syncs so it drifts by no more than
+//   CLOCK_DRIFT_BUDGET
+// - the clock that keeps time through deep sleep, from the first offset
+//   after a wakeup, and used to correct the clock right after the wakeup
+// - the BM8563, from its second edges against the disciplined clock, and
+//   used to correct it at boot when the state survived a reset
+// The estimates live in RTC memory with the rest of the state. Portable,
+// all times are microseconds, the firmware does the UDP and clock calls.
+
+#define CLOCK_MAGIC 0x4B4C4343     // "CCLK"
+#define CLOCK_BURST 4              // queries per sync
+#define CLOCK_STEP_LIMIT 128000    // us, larger offsets are stepped
+#define CLOCK_DRIFT_LIMIT 10000    // ppm, larger estimates are outliers
+#define CLOCK_MIN_BASELINE 30      // s between syncs for a drift estimate
+#define CLOCK_RTC_BASELINE 3600    // s between BM8563 comparisons
+#define CLOCK_POLL_MIN 64          // s between syncs while learning
+#define CLOCK_POLL_MAX 1024        // s between syncs once settled
+#define CLOCK_DRIFT_BUDGET 20000   // us the clock may drift between syncs
+#define CLOCK_EDGE_TIMEOUT 1100000  // us, a BM8563 second edge comes by then
+
+#define NTP_PACKET_SIZE 48
+#define NTP_PORT 123
+
+// one SNTP exchange
+struct clockSample {
+  int64_t offset;  // server minus local
+  int64_t delay;   // round trip without the server's own time
+};
+
+struct clockState {
+  uint32_t magic;
+  uint8_t valid;     // CLOCK_* bits of the estimates below
+  float system_ppm;  // positive - the clock runs fast
+  float sleep_ppm;
+  float rtc_ppm;
+  int64_t sleep_start;  // wall clock when deep sleep began, 0 - awake
+  bool sleep_synced;    // the clock was on NTP time when it began
+  int64_t slept;        // length of the last deep sleep, until the next sync
+  float slept_ppm;      // drift the wakeup was corrected with
+  int64_t rtc_wall;     // start of the BM8563 baseline, 0 - none
+  int64_t rtc_offset;   // BM8563 minus the wall clock then
+};
+
+#define CLOCK_SYSTEM (1 << 0)
+#define CLOCK_SLEEP (1 << 1)
+#define CLOCK_RTC (1 << 2)
+
+struct clockStats {
+  uint32_t syncs = 0;
+  uint32_t samples = 0;
+  uint32_t spikes = 0;  // large offsets waiting for confirmation
+  uint32_t steps = 0;
+  uint32_t slews = 0;
+  int64_t last_offset = 0;
+  int64_t last_delay = 0;
+  int64_t max_offset = 0;  // largest slewed offset
+  int64_t wake_correction = 0;
+};
+
+// SNTP client side, t1 - local transmit time, t4 - local receive time
+void ntpEncodeRequest(uint8_t* packet, int64_t t1);
+bool ntpDecodeResponse(const uint8_t* packet, size_t size, int64_t t1,
+                       int64_t t4, clockSample* sample);
+
+class ClockDiscipline {
+ public:
+  enum class Action { None, Slew, Step };
+
+  // keeps the estimates found in a valid state, clears anything else
+  explicit ClockDiscipline(clockState* state);
+
+  void addSample(const clockSample& sample);
+  // ends the burst, learns the drift and returns how to correct the clock
+  // by *offset, mono - monotonic clock
+  Action update(uint64_t mono, int64_t* offset);
+  bool synced() const { return sync_mono != 0; }
+  uint32_t pollInterval() const;  // s until the next sync
+
+  // deep sleep begins, wall - the clock then
+  void sleeping(int64_t wall);
+  // right after the wakeup, returns the correction to add to the clock
+  int64_t wakeCorrection(int64_t wall);
+
+  // a BM8563 comparison would extend or start the baseline
+  bool rtcDue(int64_t wall) const;
+  // rtc_offset - BM8563 minus the disciplined clock at one of its edges
+  void rtcSample(int64_t wall, int64_t rtc_offset);
+  void rtcWritten() { state->rtc_wall = 0; }  // the BM8563 was set
+  // correction to add to the BM8563 time rtc, 0 if there is no estimate
+  int64_t rtcCorrection(int64_t rtc) const;
+
+  const clockState& getState() const { return *state; }
+  const clockStats& getStats() const { return stats; }
+
+ private:
+  clockState* state;
+  clockSample burst[CLOCK_BURST];
+  int burst_size = 0;
+  uint64_t sync_mono = 0;  // last sync, 0 - not synced since boot
+  uint64_t drift_mono = 0;  // first sync since boot or the last step
+  int64_t drift_sum = 0;    // offsets corrected since drift_mono
+  bool spike = false;
+  clockStats stats;
+
+  void learn(float* estimate, uint8_t bit, float ppm);
+};
+
+// Finds a second edge of the BM8563 without blocking. The loop that owns the
+// I2C bus reads the seconds once per iteration, the edge is put in the middle
+// of the two reads around the change.
+class RtcEdge {
+ public:
+  void start() {
+    busy = true;
+    first_wall = 0;
+  }
+  bool active() const { return busy; }
+  // rtc - the BM8563 time in whole seconds read at wall, returns true once
+  // the seconds changed with *wall_edge and *offset, BM8563 minus wall then.
+  // Gives up after CLOCK_EDGE_TIMEOUT
+  bool read(int64_t wall, int64_t rtc, int64_t* wall_edge, int64_t* offset);
+
+ private:
+  bool busy = false;
+  int64_t first_wall = 0;  // of the first read, 0 - none yet
+  int64_t last_wall = 0;
+  int64_t last_rtc = 0;
+};
@@ -0,0 +1,81 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./frametime.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+void FrameTiming::drawn(uint32_t us) {
+  stats.draw_us += us;
+  frame_us += us;
+}
+
+void FrameTiming::started(uint32_t now_us, uint32_t us, uint32_t bytes) {
+  stats.start_us += us;
+  frame_us += us;
+  if (bytes == 0) {
+    return;
+  }
+  stats.bytes += bytes;
+  transferring = true;
+  transfer_start = now_us - us;
+}
+
+void FrameTiming::waited(uint32_t us) {
+  stats.wait_us += us;
+  frame_us += us;
+}
+
+uint32_t FrameTiming::done(uint32_t now_us) {
+  if (!transferring) {
+    return 0;
+  }
+  transferring = false;
+  uint32_t length = now_us - transfer_start;
+  stats.transfers++;
+  stats.transfer_us += length;
+  return length;
+}
+
+void FrameTiming::frameEnd() {
+  stats.frames++;
+  stats.max_frame_us = std::max(stats.max_frame_us, frame_us);
+  frame_us = 0;
+}
+
+float FrameTiming::overlap() const {
+  if (stats.transfer_us == 0) {
+    return 0;
+  }
+  uint64_t busy = stats.start_us + stats.wait_us;
+  if (busy >= stats.transfer_us) {
+    return 0;
+  }
+  return (stats.transfer_us - busy) * 100.0f / stats.transfer_us;
+}
+
+size_t FrameTiming::describe(char* buffer, size_t size) const {
+  uint32_t frames = stats.frames ? stats.frames : 1;
+  uint32_t transfers = stats.transfers ? stats.transfers : 1;
+  int length = snprintf(
+      buffer, size,
+      "frames=%u draw=%u start=%u wait=%u max=%u us/frame, "
+      "transfer=%u us %u bytes avg, overlap %.1f%%\n",
+      stats.frames, static_cast<uint32_t>(stats.draw_us / frames),
+      static_cast<uint32_t>(stats.start_us / frames),
+      static_cast<uint32_t>(stats.wait_us / frames), stats.max_frame_us,
+      static_cast<uint32_t>(stats.transfer_us / transfers),
+      static_cast<uint32_t>(stats.bytes / transfers), overlap());
+  return std::min(static_cast<size_t>(length), size);
+}
+
+void FrameTiming::reset() {
+  stats = frameStats();
+  frame_us = 0;
+}
@@ -0,0 +1,53 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Where the time of a frame goes once the LCD transfer runs in the
+// background: drawing into the back buffer, starting the DMA transfer, and
+// waiting for an earlier transfer the frame needs out of the way. The
+// transfer itself is timed from its start until it is seen done. The
+// overlap is the share of the transfer time the CPU spent on anything but
+// the transfer. Portable, single task.
+
+struct frameStats {
+  uint32_t frames = 0;
+  uint32_t transfers = 0;
+  uint64_t draw_us = 0;   // sums
+  uint64_t start_us = 0;  // starting transfers, copies to DMA buffers included
+  uint64_t wait_us = 0;
+  uint64_t transfer_us = 0;
+  uint64_t bytes = 0;
+  uint32_t max_frame_us = 0;  // draw, start and wait of one frame
+};
+
+class FrameTiming {
+ public:
+  void drawn(uint32_t us);
+  // us - of the CPU to start it, 0 bytes if nothing needed a transfer
+  void started(uint32_t now_us, uint32_t us, uint32_t bytes);
+  void waited(uint32_t us);
+  // the transfer started last is on the LCD, returns its length
+  uint32_t done(uint32_t now_us);
+  // the frame is complete, before the next one is drawn
+  void frameEnd();
+
+  // percent of the transfer time the CPU was free
+  float overlap() const;
+  const frameStats& getStats() const { return stats; }
+  size_t describe(char* buffer, size_t size) const;
+  void reset();
+
+ private:
+  bool transferring = false;
+  uint32_t transfer_start = 0;
+  uint32_t frame_us = 0;  // CPU time of the frame so far
+
+  frameStats stats;
+};
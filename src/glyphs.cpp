@@ -0,0 +1,46 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./glyphs.h"
+
+int glyphIndex(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  return c == ':' ? 10 : -1;
+}
+
+int32_t glyphArrange(glyphMetrics* metrics) {
+  int32_t width = 0;
+  for (int i = 0; i < GLYPH_COUNT; i++) {
+    metrics->x[i] = width;
+    width += metrics->width[i];
+  }
+  return width;
+}
+
+int glyphLayout(const glyphMetrics& metrics, const char* text,
+                int32_t center_x, glyphCell* cells, int max_cells) {
+  int count = 0;
+  int32_t width = 0;
+  for (; text[count] != '\0'; count++) {
+    int index = glyphIndex(text[count]);
+    if (index < 0 || count >= max_cells) {
+      return 0;
+    }
+    cells[count].sheet_x = metrics.x[index];
+    cells[count].x = width;  // relative until the width is known
+    cells[count].width = metrics.width[index];
+    width += metrics.width[index];
+  }
+  // like drawString() with middle_center
+  int32_t left = center_x - width / 2;
+  for (int i = 0; i < count; i++) {
+    cells[i].x += left;
+  }
+  return count;
+}
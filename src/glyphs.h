@@ -0,0 +1,43 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Layout of the countdown glyph atlas. The digits and ':' of one font, size
+// and color are rendered once side by side into a sheet, and a time string
+// is composed by copying their cells instead of rasterizing the font on
+// every frame. Portable, the sheet itself is a sprite in assets.cpp.
+
+#define GLYPH_CHARSET "0123456789:"
+#define GLYPH_COUNT 11
+#define GLYPH_TEXT_LENGTH 8  // glyphs in one string at most
+
+struct glyphMetrics {
+  int16_t height;
+  int16_t x[GLYPH_COUNT];  // cell on the sheet
+  int16_t width[GLYPH_COUNT];
+};
+
+// one glyph of a laid out string
+struct glyphCell {
+  int16_t sheet_x;
+  int16_t x;  // destination
+  int16_t width;
+};
+
+// index into glyphMetrics, -1 if the character isn't on the sheet
+int glyphIndex(char c);
+
+// sets up the cells from the glyph widths, returns the sheet width
+int32_t glyphArrange(glyphMetrics* metrics);
+
+// lays out text centred on center_x, returns the number of cells, 0 if a
+// character isn't on the sheet or the text is longer than max_cells
+int glyphLayout(const glyphMetrics& metrics, const char* text,
+                int32_t center_x, glyphCell* cells, int max_cells);
@@ -0,0 +1,62 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Thin hardware interfaces used by the portable parts of the firmware
+// (timer, render scheduler, shadow sync). hal_esp32.cpp binds them to the
+// M5Stack, native/hal_native.cpp to Linux stand-ins for the native build.
+namespace hal {
+
+class Clock {
+ public:
+  virtual ~Clock() = default;
+  virtual uint32_t epoch() = 0;           // wall clock, seconds
+  virtual uint32_t subsecondMicros() = 0;  // microseconds into epoch()
+  virtual uint32_t millis() = 0;          // monotonic
+  virtual uint32_t micros() = 0;          // monotonic
+  virtual uint64_t monotonicMicros() = 0;  // monotonic, never wraps
+};
+
+class FileSystem {
+ public:
+  virtual ~FileSystem() = default;
+  virtual int32_t size(const char* path) = 0;  // -1 if there is no file
+  virtual size_t read(const char* path, size_t offset, uint8_t* buffer,
+                      size_t length) = 0;
+};
+
+class LedStrip {
+ public:
+  virtual ~LedStrip() = default;
+  // colors are 0xRRGGBB
+  virtual void show(const uint32_t* colors, int count) = 0;
+};
+
+class MqttTransport {
+ public:
+  typedef void (*Handler)(const char* topic, const char* payload,
+                          size_t length);
+
+  virtual ~MqttTransport() = default;
+  virtual bool connected() = 0;
+  // with qos 1 it only returns true once the broker acknowledged it
+  virtual bool publish(const char* topic, const char* payload,
+                       int qos = 0) = 0;
+  virtual bool subscribe(const char* topic) = 0;
+  virtual void onMessage(Handler handler) = 0;
+  virtual void loop() = 0;
+};
+
+Clock& clock();
+FileSystem& fs();
+LedStrip& leds();
+MqttTransport& mqtt();
+
+}  // namespace hal
@@ -0,0 +1,116 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <ESP32Time.h>
+#include <LittleFS.h>
+#include <MQTTClient.h>
+#include <esp_timer.h>
+
+#include "./hal.h"
+#include "./main.h"
+#include "./screen.h"
+
+namespace {
+
+class RtcClock : public hal::Clock {
+ public:
+  uint32_t epoch() override { return rtc.getEpoch(); }
+  uint32_t subsecondMicros() override { return rtc.getMicros(); }
+  uint32_t millis() override { return ::millis(); }
+  uint32_t micros() override { return ::micros(); }
+  uint64_t monotonicMicros() override { return esp_timer_get_time(); }
+};
+
+class LittleFsFileSystem : public hal::FileSystem {
+ public:
+  int32_t size(const char* path) override {
+    File file = LittleFS.open(path, "r");
+    if (!file) {
+      return -1;
+    }
+    int32_t size = file.size();
+    file.close();
+    return size;
+  }
+
+  size_t read(const char* path, size_t offset, uint8_t* buffer,
+              size_t length) override {
+    File file = LittleFS.open(path, "r");
+    if (!file) {
+      return 0;
+    }
+    size_t read = file.seek(offset) ? file.read(buffer, length) : 0;
+    file.close();
+    return read;
+  }
+};
+
+class FastLedStrip : public hal::LedStrip {
+ public:
+  void show(const uint32_t* colors, int count) override {
+    if (!initialized) {
+      FastLED.addLeds<SK6812, LED_DATA_PIN, GRB>(leds, NUM_LEDS);
+      // LedEngine scales and dithers, the colors are final
+      FastLED.setBrightness(255);
+      FastLED.setDither(DISABLE_DITHER);
+      initialized = true;
+    }
+    for (int i = 0; i < NUM_LEDS; i++) {
+      leds[i] = i < count ? CRGB(colors[i]) : CRGB(CRGB::Black);
+    }
+    FastLED.show();
+  }
+
+ private:
+  CRGB leds[NUM_LEDS];
+  bool initialized = false;
+};
+
+class AwsMqtt : public hal::MqttTransport {
+ public:
+  bool connected() override { return client.connected(); }
+  bool publish(const char* topic, const char* payload,
+               int qos = 0) override {
+    return client.publish(topic, payload, false, qos);
+  }
+  bool subscribe(const char* topic) override {
+    return client.subscribe(topic);
+  }
+  void onMessage(Handler handler) override {
+    message_handler = handler;
+    client.onMessageAdvanced(dispatch);
+  }
+  void loop() override { client.loop(); }
+
+ private:
+  static Handler message_handler;
+
+  static void dispatch(MQTTClient* client, char topic[], char bytes[],
+                       int length) {
+    if (message_handler != nullptr) {
+      message_handler(topic, bytes, length);
+    }
+  }
+};
+
+hal::MqttTransport::Handler AwsMqtt::message_handler = nullptr;
+
+RtcClock rtc_clock;
+LittleFsFileSystem littlefs;
+FastLedStrip led_strip;
+AwsMqtt aws_mqtt;
+
+}  // namespace
+
+namespace hal {
+
+Clock& clock() { return rtc_clock; }
+FileSystem& fs() { return littlefs; }
+LedStrip& leds() { return led_strip; }
+MqttTransport& mqtt() { return aws_mqtt; }
+
+}  // namespace hal
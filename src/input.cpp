@@ -0,0 +1,166 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./input.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool InputPipeline::active(uint32_t now) const {
+  for (uint8_t count : counts) {
+    if (count != 0) {
+      return true;  // a change waiting for confirmation
+    }
+  }
+  return touching || stable != 0 || now - last_activity < INPUT_ACTIVE_HOLD;
+}
+
+bool InputPipeline::due(uint32_t now, bool touch_line) const {
+  if (!polled || (touch_line && !touching)) {
+    return true;
+  }
+  uint32_t period = active(now) ? INPUT_POLL_FAST : INPUT_POLL_IDLE;
+  return now - last_poll >= period;
+}
+
+void InputPipeline::sample(uint32_t now, uint32_t now_us,
+                           const inputSample& sample) {
+  stats.polls++;
+  if (polled && active(now)) {
+    stats.fast_polls++;
+  }
+  polled = true;
+  last_poll = now;
+  if (sample.increment != 0 || sample.buttons != stable || sample.touch) {
+    last_activity = now;
+  }
+
+  debounce(now_us, sample.buttons);
+
+  // the remainder carries over, a slow turn still adds up to a detent
+  counts_left += sample.increment;
+  int32_t steps = counts_left / INPUT_DETENT;
+  if (steps != 0) {
+    counts_left -= steps * INPUT_DETENT;
+    push(inputEvent::Type::Detent, InputButton::Count, steps, 0, now_us);
+  }
+
+  gesture(now, now_us, sample);
+}
+
+void InputPipeline::debounce(uint32_t now_us, uint8_t buttons) {
+  for (int i = 0; i < static_cast<int>(InputButton::Count); i++) {
+    uint8_t bit = 1 << i;
+    if ((buttons & bit) == (stable & bit)) {
+      if (counts[i] != 0) {
+        stats.bounces++;
+        counts[i] = 0;
+      }
+      continue;
+    }
+    if (counts[i]++ == 0) {
+      first_us[i] = now_us;
+    }
+    if (counts[i] >= INPUT_DEBOUNCE) {
+      stable ^= bit;
+      counts[i] = 0;
+      push((buttons & bit) ? inputEvent::Type::Press
+                           : inputEvent::Type::Release,
+           static_cast<InputButton>(i), 0, 0, first_us[i]);
+    }
+  }
+}
+
+void InputPipeline::gesture(uint32_t now, uint32_t now_us,
+                            const inputSample& sample) {
+  if (sample.touch) {
+    if (!touching) {
+      touching = true;
+      held = false;
+      touch_start = now;
+      touch_x = sample.touch_x;
+      touch_y = sample.touch_y;
+    }
+    touch_last_x = sample.touch_x;
+    touch_last_y = sample.touch_y;
+    bool moved = abs(touch_last_x - touch_x) >= INPUT_FLICK ||
+                 abs(touch_last_y - touch_y) >= INPUT_FLICK;
+    if (!held && !moved && now - touch_start >= INPUT_HOLD) {
+      held = true;
+      push(inputEvent::Type::Hold, InputButton::Count, touch_x, touch_y,
+           now_us);
+    }
+    return;
+  }
+  if (!touching) {
+    return;
+  }
+  touching = false;
+  if (held) {
+    return;  // the hold was the gesture
+  }
+  int16_t dx = touch_last_x - touch_x;
+  int16_t dy = touch_last_y - touch_y;
+  if (abs(dx) >= INPUT_FLICK || abs(dy) >= INPUT_FLICK) {
+    push(inputEvent::Type::Flick, InputButton::Count, dx, dy, now_us);
+  } else {
+    push(inputEvent::Type::Tap, InputButton::Count, touch_x, touch_y,
+         now_us);
+  }
+}
+
+void InputPipeline::push(inputEvent::Type type, InputButton button,
+                         int16_t x, int16_t y, uint32_t at_us) {
+  inputEvent event = {type, button, x, y, at_us};
+  if (events.push(event)) {
+    stats.events++;
+  }
+}
+
+void InputPipeline::busy(uint32_t us, uint32_t bytes,
+                         uint32_t transactions) {
+  stats.bus_us += us;
+  stats.bus_bytes += bytes;
+  stats.transactions += transactions;
+}
+
+bool InputPipeline::pop(inputEvent* event) { return events.pop(event); }
+
+float InputPipeline::busUtilization(uint32_t now) const {
+  uint32_t elapsed = now - start;
+  // bus_us / (elapsed * 1000) in percent
+  return elapsed ? stats.bus_us / (elapsed * 10.0f) : 0;
+}
+
+void InputPipeline::reset(uint32_t now) {
+  stats = inputStats();
+  start = now;
+}
+
+size_t inputTraceFormat(char* buffer, size_t size, uint32_t now,
+                        const inputSample& sample) {
+  int length = snprintf(buffer, size, "%u %02x %d %d %d %d\n", now,
+                        sample.buttons, sample.increment, sample.touch,
+                        sample.touch_x, sample.touch_y);
+  return length < 0 ? 0 : (static_cast<size_t>(length) < size ? length : size);
+}
+
+bool inputTraceParse(const char* line, uint32_t* now, inputSample* sample) {
+  unsigned buttons;
+  int increment, touch, x, y;
+  if (sscanf(line, "%u %x %d %d %d %d", now, &buttons, &increment, &touch, &x,
+             &y) != 6) {
+    return false;  // a '#' comment doesn't parse either
+  }
+  sample->buttons = buttons;
+  sample->increment = increment;
+  sample->touch = touch != 0;
+  sample->touch_x = x;
+  sample->touch_y = y;
+  return true;
+}
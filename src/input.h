@@ -0,0 +1,112 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./command_queue.h"
+
+// Input from the HMI unit (encoder and its three buttons), the Core2 touch
+// buttons and the touch screen. The firmware reads the raw state and feeds
+// it in. The pipeline debounces it, turns it into events for the UI loop and
+// decides when to poll next: fast while anything is happening, slowly when
+// idle, right away when the touch controller pulls its interrupt line.
+// Portable, single task.
+
+#define INPUT_POLL_FAST 10      // ms, while anything is happening
+#define INPUT_POLL_IDLE 50      // ms
+#define INPUT_ACTIVE_HOLD 2000  // ms of fast polling after the last activity
+#define INPUT_DEBOUNCE 2        // polls a button has to agree on
+#define INPUT_DETENT 4          // encoder counts per detent
+#define INPUT_FLICK 40          // px, shorter touches are taps
+#define INPUT_HOLD 600          // ms, longer touches are holds
+#define INPUT_QUEUE_SIZE 16
+// 1 - print every change of the raw input as a line of a replay trace
+#define INPUT_TRACE 0
+#define INPUT_TRACE_LINE 48
+
+enum class InputButton : uint8_t { HmiS, Hmi1, Hmi2, A, B, C, Count };
+
+// raw state of one poll
+struct inputSample {
+  uint8_t buttons = 0;    // bit per InputButton, set while pressed
+  int32_t increment = 0;  // encoder counts since the last poll
+  bool touch = false;     // on the screen, the button areas are buttons
+  int16_t touch_x = 0;
+  int16_t touch_y = 0;
+};
+
+struct inputEvent {
+  enum class Type : uint8_t { Press, Release, Detent, Tap, Flick, Hold };
+  Type type;
+  InputButton button;  // Press, Release
+  int16_t x;           // Detent: steps, Flick: distance, Tap, Hold: position
+  int16_t y;
+  uint32_t at_us;      // poll that first saw it
+};
+
+struct inputStats {
+  uint32_t polls = 0;
+  uint32_t fast_polls = 0;
+  uint32_t events = 0;
+  uint32_t bounces = 0;  // raw changes that didn't last INPUT_DEBOUNCE polls
+  uint32_t transactions = 0;  // bus transactions
+  uint32_t bus_bytes = 0;
+  uint64_t bus_us = 0;  // time the polls spent on the bus
+};
+
+// Traces are the raw samples, one line per change:
+//   <ms> <buttons, hex> <increment> <touch 0/1> <x> <y>
+// with '#' comments. The native build replays them, see native/replay.cpp.
+size_t inputTraceFormat(char* buffer, size_t size, uint32_t now,
+                        const inputSample& sample);
+// false for comments, blank and malformed lines
+bool inputTraceParse(const char* line, uint32_t* now, inputSample* sample);
+
+class InputPipeline {
+ public:
+  // touch_line - the touch controller interrupt is asserted
+  bool due(uint32_t now, bool touch_line) const;
+  void sample(uint32_t now, uint32_t now_us, const inputSample& sample);
+  // bus time and bytes of the last poll, for the utilization
+  void busy(uint32_t us, uint32_t bytes, uint32_t transactions = 1);
+
+  bool pop(inputEvent* event);
+
+  const inputStats& getStats() const { return stats; }
+  uint32_t getDropped() const { return events.getDropped(); }
+  // percent of the time since reset() the bus was busy with input polls
+  float busUtilization(uint32_t now) const;
+  void reset(uint32_t now);
+
+ private:
+  CommandQueue<inputEvent, INPUT_QUEUE_SIZE> events;
+  uint32_t last_poll = 0;
+  uint32_t last_activity = 0;
+  uint32_t start = 0;
+  bool polled = false;
+
+  uint8_t stable = 0;  // debounced buttons
+  uint8_t counts[static_cast<int>(InputButton::Count)] = {};
+  uint32_t first_us[static_cast<int>(InputButton::Count)] = {};
+  int32_t counts_left = 0;  // encoder counts short of a detent
+
+  bool touching = false;
+  bool held = false;  // the current touch already turned into a hold
+  uint32_t touch_start = 0;
+  int16_t touch_x = 0, touch_y = 0;  // where it began
+  int16_t touch_last_x = 0, touch_last_y = 0;
+
+  inputStats stats;
+
+  bool active(uint32_t now) const;
+  void push(inputEvent::Type type, InputButton button, int16_t x, int16_t y,
+            uint32_t at_us);
+  void debounce(uint32_t now_us, uint8_t buttons);
+  void gesture(uint32_t now, uint32_t now_us, const inputSample& sample);
+};
@@ -0,0 +1,98 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./latency.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+void LatencyTracker::handled(uint32_t at_us, uint32_t now_us) {
+  if (pending.count >= LATENCY_EVENTS) {
+    stats.overflow++;
+    return;
+  }
+  pending.events[pending.count++] = {at_us, now_us};
+}
+
+void LatencyTracker::frameStart(uint32_t now_us) {
+  if (frame_count == LATENCY_FRAMES) {
+    // frameDone() wasn't called for the oldest, forget it
+    frame_head = (frame_head + 1) % LATENCY_FRAMES;
+    frame_count--;
+  }
+  frame& started = frames[(frame_head + frame_count) % LATENCY_FRAMES];
+  started = pending;
+  started.start_us = now_us;
+  frame_count++;
+  pending.count = 0;
+}
+
+int LatencyTracker::frameDone(uint32_t now_us) {
+  if (frame_count == 0) {
+    return 0;
+  }
+  const frame& done = frames[frame_head];
+  frame_head = (frame_head + 1) % LATENCY_FRAMES;
+  frame_count--;
+  if (done.count == 0) {
+    return 0;
+  }
+
+  stats.frames++;
+  for (int i = 0; i < done.count; i++) {
+    const event& input = done.events[i];
+    uint32_t total = now_us - input.at_us;
+    stats.events++;
+    stats.handle_us += input.handled_us - input.at_us;
+    stats.wait_us += done.start_us - input.handled_us;
+    stats.draw_us += now_us - done.start_us;
+    stats.max_us = std::max(stats.max_us, total);
+    window[window_next] = total;
+    window_next = (window_next + 1) % LATENCY_WINDOW;
+    window_count = std::min(window_count + 1, LATENCY_WINDOW);
+  }
+  return done.count;
+}
+
+uint32_t LatencyTracker::latest(int index) const {
+  if (index >= window_count) {
+    return 0;
+  }
+  return window[(window_next - 1 - index + LATENCY_WINDOW) % LATENCY_WINDOW];
+}
+
+uint32_t LatencyTracker::percentile(int p) const {
+  if (window_count == 0) {
+    return 0;
+  }
+  uint32_t sorted[LATENCY_WINDOW];
+  std::copy(window, window + window_count, sorted);
+  int rank = std::min(window_count - 1, (window_count * p) / 100);
+  std::nth_element(sorted, sorted + rank, sorted + window_count);
+  return sorted[rank];
+}
+
+size_t LatencyTracker::describe(char* buffer, size_t size) const {
+  uint32_t events = stats.events ? stats.events : 1;
+  int length = snprintf(
+      buffer, size,
+      "latency events=%u frames=%u overflow=%u p50=%u p95=%u p99=%u max=%u "
+      "us, handle=%u wait=%u draw=%u us avg\n",
+      stats.events, stats.frames, stats.overflow, percentile(50),
+      percentile(95), percentile(99), stats.max_us,
+      static_cast<uint32_t>(stats.handle_us / events),
+      static_cast<uint32_t>(stats.wait_us / events),
+      static_cast<uint32_t>(stats.draw_us / events));
+  return std::min(static_cast<size_t>(length), size);
+}
+
+void LatencyTracker::reset() {
+  stats = latencyStats();
+  window_count = 0;
+  window_next = 0;
+}
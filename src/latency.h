@@ -0,0 +1,70 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Input to photon latency. Every input event the UI acts on is handed over
+// with the time the poll first saw it. The next frame that begins carries
+// all events handled so far. Once that frame's pixels are on the LCD, each
+// event gets its latency split into three parts: waiting to be handled,
+// waiting for the frame, and drawing and transferring the frame. The
+// panel's own refresh isn't visible from here. Portable, single task.
+
+#define LATENCY_EVENTS 8    // per frame, more are counted as overflow
+#define LATENCY_FRAMES 2    // begun and not on the LCD yet
+#define LATENCY_WINDOW 128  // latest totals kept for the percentiles
+
+struct latencyStats {
+  uint32_t events = 0;
+  uint32_t overflow = 0;  // handled while LATENCY_EVENTS were waiting
+  uint32_t frames = 0;    // frames that carried events
+  uint64_t handle_us = 0;  // sums over the events, seen to handled
+  uint64_t wait_us = 0;    // handled to the frame start
+  uint64_t draw_us = 0;    // frame start to the pixels on the LCD
+  uint32_t max_us = 0;
+};
+
+class LatencyTracker {
+ public:
+  // at_us - the poll that first saw the event
+  void handled(uint32_t at_us, uint32_t now_us);
+  void frameStart(uint32_t now_us);
+  // the oldest frame begun is on the LCD, returns the events it carried
+  int frameDone(uint32_t now_us);
+  // total latency of the index-th latest event, 0 - the latest
+  uint32_t latest(int index) const;
+
+  // of the totals in the window, p - 0 to 100
+  uint32_t percentile(int p) const;
+  const latencyStats& getStats() const { return stats; }
+  size_t describe(char* buffer, size_t size) const;
+  void reset();
+
+ private:
+  struct event {
+    uint32_t at_us;
+    uint32_t handled_us;
+  };
+  struct frame {
+    uint32_t start_us;
+    int count;
+    event events[LATENCY_EVENTS];
+  };
+
+  frame pending = {};  // events handled since the last frame start
+  frame frames[LATENCY_FRAMES] = {};
+  int frame_head = 0;  // oldest frame in flight
+  int frame_count = 0;
+
+  uint32_t window[LATENCY_WINDOW] = {};
+  int window_next = 0;
+  int window_count = 0;
+
+  latencyStats stats;
+};
@@ -0,0 +1,206 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./lights.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "./hal.h"
+
+namespace {
+
+// starts bright, so turning it on doesn't dip first
+const keyframe breath_frames[] = {
+    {0, 0xFFFF}, {LIGHTS_BREATH / 2, 0x3000}, {LIGHTS_BREATH, 0xFFFF}};
+const keyframe flash_frames[] = {
+    {0, 0}, {60, 0xFFFF}, {160, 0xFFFF}, {LIGHTS_FLASH, 0}};
+
+// 16 bit level to the 8.8 fixed point value of one channel of a color
+uint32_t channel(uint32_t level, uint32_t color, int shift) {
+  uint32_t gamma = (level * level) >> 16;
+  uint32_t value = (color >> shift) & 0xFF;
+  return (static_cast<uint64_t>(gamma) * value * LIGHTS_BRIGHTNESS * 256) /
+         (65535u * 255u);
+}
+
+}  // namespace
+
+uint16_t keyframeLevel(const keyframe* frames, int count, uint32_t t) {
+  if (t <= frames[0].at) {
+    return frames[0].level;
+  }
+  for (int i = 1; i < count; i++) {
+    const keyframe& from = frames[i - 1];
+    const keyframe& to = frames[i];
+    if (t >= to.at) {
+      continue;
+    }
+    uint32_t u = ((t - from.at) << 16) / (to.at - from.at);
+    uint32_t eased = static_cast<uint32_t>(
+        (static_cast<uint64_t>((u * u) >> 16) * (3 * 65536 - 2 * u)) >> 16);
+    int32_t delta = to.level - from.level;
+    return from.level +
+           static_cast<int32_t>((static_cast<int64_t>(delta) * eased) >> 16);
+  }
+  return frames[count - 1].level;
+}
+
+void LedEngine::apply(uint32_t now, const lightsCommand& command) {
+  if (command.type == lightsCommand::Type::Reset) {
+    reset(now);  // nothing to draw
+    return;
+  }
+  stats.commands++;
+  dirty = true;
+  switch (command.type) {
+    case lightsCommand::Type::Off:
+    case lightsCommand::Type::Progress: {
+      uint16_t target = 0;
+      if (command.type == lightsCommand::Type::Progress) {
+        uint32_t permille = std::min<uint32_t>(command.remaining, 1000);
+        target = permille * 65535 / 1000;
+        color = command.color;
+        if (command.breathe && !breathe) {
+          breath_start = now;
+        }
+        breathe = command.breathe;
+      } else {
+        breathe = false;
+      }
+      uint16_t current = remaining(now);
+      if (abs(target - current) <= 65535 * LIGHTS_STEP / 1000) {
+        // the countdown ticking, an ease would only dither for nothing
+        ease_from = target;
+      } else if (target != ease_to) {
+        ease_from = current;
+        ease_start = now;
+      }
+      ease_to = target;
+      break;
+    }
+    case lightsCommand::Type::Flash:
+      flashing = true;
+      flash_color = command.color;
+      flash_start = now;
+      break;
+    default:
+      break;
+  }
+}
+
+uint16_t LedEngine::remaining(uint32_t now) const {
+  const keyframe ease[] = {{0, ease_from}, {LIGHTS_EASE, ease_to}};
+  return keyframeLevel(ease, 2, now - ease_start);
+}
+
+bool LedEngine::animating(uint32_t now) const {
+  return breathe || (flashing && now - flash_start < LIGHTS_FLASH) ||
+         (ease_from != ease_to && now - ease_start < LIGHTS_EASE);
+}
+
+void LedEngine::render(uint32_t now, uint16_t (*levels)[3]) const {
+  // the remaining time is lit from the middle out, the LED on the edge
+  // of it partly
+  uint32_t span = remaining(now) * (LIGHTS_COUNT / 2);
+  uint32_t breath = 0xFFFF;
+  if (breathe) {
+    breath = keyframeLevel(breath_frames, 3,
+                           (now - breath_start) % LIGHTS_BREATH);
+  }
+  uint32_t flash = 0;
+  if (flashing && now - flash_start < LIGHTS_FLASH) {
+    flash = keyframeLevel(flash_frames, 4, now - flash_start);
+  }
+
+  for (int i = 0; i < LIGHTS_COUNT; i++) {
+    int from_middle = i < LIGHTS_COUNT / 2 ? LIGHTS_COUNT / 2 - 1 - i
+                                           : i - LIGHTS_COUNT / 2;
+    int32_t lit = static_cast<int32_t>(span) - from_middle * 65536;
+    uint32_t level = std::min<int32_t>(std::max<int32_t>(lit, 0), 0xFFFF);
+    level = (level * breath) >> 16;
+    for (int c = 0; c < 3; c++) {
+      int shift = 16 - 8 * c;
+      levels[i][c] = std::max(channel(level, color, shift),
+                              channel(flash, flash_color, shift));
+    }
+  }
+}
+
+bool LedEngine::update(uint32_t now) {
+  bool moving = animating(now);
+  uint16_t levels[LIGHTS_COUNT][3];
+  render(now, levels);
+  stats.frames++;
+  last_frame = now;
+  dirty = moving;
+  if (!moving) {
+    flashing = false;
+    ease_from = ease_to;
+  }
+
+  uint32_t colors[LIGHTS_COUNT];
+  for (int i = 0; i < LIGHTS_COUNT; i++) {
+    colors[i] = 0;
+    for (int c = 0; c < 3; c++) {
+      uint32_t value;
+      if (moving) {
+        value = levels[i][c] + residue[i][c];
+        residue[i][c] = value & 0xFF;
+        value >>= 8;
+      } else {
+        // settled, rounded so it doesn't keep flickering
+        value = (levels[i][c] + 128) >> 8;
+        residue[i][c] = 0;
+      }
+      colors[i] |= std::min<uint32_t>(value, 0xFF) << (16 - 8 * c);
+    }
+  }
+
+  if (rendered && memcmp(colors, pushed, sizeof(colors)) == 0) {
+    stats.skipped++;
+    return false;
+  }
+  memcpy(pushed, colors, sizeof(colors));
+  rendered = true;
+  stats.pushes++;
+  hal::leds().show(colors, LIGHTS_COUNT);
+  return true;
+}
+
+uint32_t LedEngine::nextFrame(uint32_t now) const {
+  if (!dirty) {
+    return UINT32_MAX;
+  }
+  int32_t left = last_frame + LIGHTS_FRAME - now;
+  return left > 0 ? left : 0;
+}
+
+uint32_t LedEngine::pushesPerMinute(uint32_t now) const {
+  uint32_t elapsed = now - start;
+  if (elapsed == 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(stats.pushes) * 60000 / elapsed;
+}
+
+size_t LedEngine::describe(char* buffer, size_t size, uint32_t now) const {
+  int length = snprintf(buffer, size,
+                        "lights commands=%u frames=%u pushes=%u skipped=%u, "
+                        "%u updates/min\n",
+                        stats.commands, stats.frames, stats.pushes,
+                        stats.skipped, pushesPerMinute(now));
+  return std::min(static_cast<size_t>(length), size);
+}
+
+void LedEngine::reset(uint32_t now) {
+  stats = lightsStats();
+  start = now;
+}
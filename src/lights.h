@@ -0,0 +1,95 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// LED strip animation, decoupled from the screen. The UI only sets what the
+// strip should show (remaining time, breathing, a flash on a transition) and
+// the engine renders frames from keyframed effects on its own timer. Levels
+// are 16 bit and gamma corrected; while anything moves, temporal dithering
+// spreads the rounding to 8 bit over the frames, so slow fades at the low
+// strip brightness don't step. A frame goes to hal::leds() only when it
+// differs from the last one pushed. Portable, single task.
+
+#define LIGHTS_COUNT 10
+#define LIGHTS_BRIGHTNESS 20  // 0 - 255, applied here, the strip runs at 255
+#define LIGHTS_FRAME 20       // ms between frames while animating
+#define LIGHTS_EASE 400       // ms for the progress to reach a new value
+#define LIGHTS_STEP 10        // permille, smaller changes are taken at once
+#define LIGHTS_FLASH 460      // ms, length of the flash effect
+#define LIGHTS_BREATH 3200    // ms, period of the breathing effect
+
+struct lightsCommand {
+  // Reset - restart the statistics, like reset()
+  enum class Type : uint8_t { Off, Progress, Flash, Reset };
+  Type type;
+  bool breathe;        // Progress
+  uint16_t remaining;  // Progress, 0 - 1000 permille of the session left
+  uint32_t color;      // 0xRRGGBB
+};
+
+// level 0 - 65535 at a time, in between linear with smoothstep easing
+struct keyframe {
+  uint16_t at;  // ms
+  uint16_t level;
+};
+
+// level of the effect t ms after it started, the last keyframe holds
+uint16_t keyframeLevel(const keyframe* frames, int count, uint32_t t);
+
+struct lightsStats {
+  uint32_t commands = 0;
+  uint32_t frames = 0;    // rendered
+  uint32_t pushes = 0;    // frames that differed and went to the strip
+  uint32_t skipped = 0;   // frames equal to the last one pushed
+};
+
+class LedEngine {
+ public:
+  void apply(uint32_t now, const lightsCommand& command);
+  // renders the frame due at now, pushes it if it changed, true if pushed
+  bool update(uint32_t now);
+  // ms until the next frame is needed, UINT32_MAX while nothing moves
+  uint32_t nextFrame(uint32_t now) const;
+  bool animating(uint32_t now) const;
+
+  // the 8 bit colors last pushed
+  const uint32_t* frame() const { return pushed; }
+  const lightsStats& getStats() const { return stats; }
+  // strip updates per minute since reset()
+  uint32_t pushesPerMinute(uint32_t now) const;
+  size_t describe(char* buffer, size_t size, uint32_t now) const;
+  void reset(uint32_t now);
+
+ private:
+  bool breathe = false;
+  uint32_t color = 0;
+  // remaining fraction eases from ease_from to ease_to, 0 - 65535
+  uint16_t ease_from = 0;
+  uint16_t ease_to = 0;
+  uint32_t ease_start = 0;
+  uint32_t breath_start = 0;
+
+  bool flashing = false;
+  uint32_t flash_color = 0;
+  uint32_t flash_start = 0;
+
+  bool rendered = false;  // something was pushed since boot
+  bool dirty = false;     // a frame is due, the strip may not be final yet
+  uint32_t last_frame = 0;
+  uint32_t pushed[LIGHTS_COUNT] = {};
+  // per channel remainder carried to the next frame by the dithering
+  uint8_t residue[LIGHTS_COUNT][3] = {};
+
+  uint32_t start = 0;
+  lightsStats stats;
+
+  uint16_t remaining(uint32_t now) const;
+  void render(uint32_t now, uint16_t (*levels)[3]) const;
+};
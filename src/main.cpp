@@ -4,24 +4,36 @@ M5Stack pomodoro timer
 Copyright 2023 Sergei Chistokhin
 
 **/
-#include <ArduinoJson.h>
 #include <LittleFS.h>
 #include <M5Unified.h>
 #include <MQTTClient.h>
 
 #include "secrets.h"  // NOLINT
 
-#define DEBUG_NTPClient
-#include <NTPClient.h>
-
 // #include "PomodoroTimer.h"
 #include <ESP32Time.h>
 #include <Ticker.h>
 #include <WiFi.h>
 #include <WiFiClientSecure.h>
 
+#include "./boot.h"
+#include "./command_queue.h"
+#include "./connection.h"
 #include "./debug.h"
+#include "./discipline.h"
+#include "./hal.h"
+#include "./input.h"
+#include "./latency.h"
+#include "./lights.h"
 #include "./main.h"
+#include "./metrics.h"
+#include "./outbox.h"
+#include "./power.h"
+#include "./resume.h"
+#include "./scheduler.h"
+#include "./shadow.h"
+#include "./sound.h"
+#include "./tls_session.h"
 
 #include "MODULE_HMI.h"
 MODULE_HMI hmi;
@@ -31,15 +43,53 @@ MODULE_HMI hmi;
 // 100%
 #define SPEAKER_VOLUME 255
 
-#define SCREEN_BRIGHTNESS 128
-
-#define NTP_UPDATE 60  // resync every 15 seconds
 uint32_t lastrequest = 0;
-uint32_t lastTimeUpdate = 0;
 bool subscribed = false;
 
-WiFiClientSecure net = WiFiClientSecure();
-MQTTClient client = MQTTClient(8192);  // up to 8kb shadow
+// networkTask blocks until it is notified with one of these events or the
+// nearest deadline (MQTT keepalive, inbound poll, NTP resync, reconnect) is
+// due
+#define NET_EVENT_REPORT (1 << 0)  // report_state() queued a report
+#define NET_EVENT_WIFI (1 << 1)    // Wi-Fi connected or lost
+#define NET_EVENT_RTC (1 << 2)     // the UI loop sampled or set the BM8563
+#define MQTT_KEEPALIVE 30          // s
+#define NET_RX_POLL 500            // ms, inbound shadow updates
+#define NET_RETRY 1000             // ms, failed publish / NTP
+#define NTP_TIMEOUT 1000           // ms, per query of a burst
+#define NTP_LOCAL_PORT 2390
+TaskHandle_t network_task = NULL;
+
+// Wi-Fi, TLS and MQTT reconnects with backoff, driven by networkTask
+ConnectionManager links;
+
+// nothing to publish and the connection is up, light sleep is fine
+volatile bool network_idle = false;
+
+struct networkStats {
+  uint32_t wakeups = 0;
+  uint32_t notified = 0;  // woken by an event rather than a deadline
+  uint32_t stale = 0;     // shadow documents older than the last one seen
+  uint32_t echoes = 0;    // deltas caused by our own updates
+  uint32_t rejected = 0;  // updates the shadow service refused
+  uint32_t ui_full = 0;   // clock commands posted again, ui_commands was full
+} netstats;
+
+// shadow version of the last document received, owned by networkTask
+uint32_t shadow_version = 0;
+// epoch of the last accepted change, local or desired, owned by the UI loop
+uint32_t last_change = 0;
+bool applying_desired = false;
+// micros() of the poll that saw the input being handled, 0 outside of it
+uint32_t change_us = 0;
+
+// the TLS session is kept through deep sleep for the next handshake
+RTC_DATA_ATTR tlsSessionCache tls_session;
+ResumingClient net(&tls_session);
+// get/accepted (desired, reported with its history and the metadata of
+// both) is the largest message received, a delta is a few hundred bytes
+#define MQTT_READ_BUFFER 4096
+#define MQTT_WRITE_BUFFER (SHADOW_UPDATE_SIZE + SHADOW_TOPIC_LENGTH + 16)
+MQTTClient client = MQTTClient(MQTT_READ_BUFFER, MQTT_WRITE_BUFFER);
 
 // const int tz_shift = 7;  // GMT+7
 const int tz_shift = 0;  // local clock to UTC
@@ -58,85 +108,218 @@ ESP32Time rtc;
 screenRender *active_screen;
 
 WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, ntpServer, gmtOffset_sec, 60000);
+// drift estimates, kept through deep sleep to correct the wakeup time
+RTC_DATA_ATTR clockState clock_state;
+ClockDiscipline discipline(&clock_state);
 
+#define CONTROL_PERIOD INPUT_POLL_FAST  // ms, loop() budget
 void updateControls();
-Ticker main_ticker(updateControls, 10);
+
+// HMI unit registers, as in the M5Unit-HMI library. The increment clears
+// on read. One burst from the increment through the buttons replaces three
+// transactions, but only where the unit auto-increments across the unused
+// registers in between and keeps up with the faster clock: probeHmiBurst()
+// checks at boot, the library reads at 100 kHz are the fallback.
+#define HMI_INCREMENT_REG 0x10
+#define HMI_BUTTON_REG 0x20  // S, 1, 2, 0 - pressed
+#define HMI_BURST_LENGTH (HMI_BUTTON_REG + 3 - HMI_INCREMENT_REG)
+#define HMI_I2C_CLOCK 100000
+#define HMI_I2C_BURST_CLOCK 400000
+#define HMI_PROBE_READS 3
+bool hmi_burst = false;
+InputPipeline input;
+LatencyTracker input_latency;
+
+// longest loop() iteration, overall and while a sound is playing
+struct loopLatency {
+  uint32_t last = 0;
+  uint32_t max = 0;
+  uint32_t max_sound = 0;
+  uint32_t overruns = 0;  // iterations longer than CONTROL_PERIOD
+  bool sound = false;
+} looplatency;
 
 void render_screen();
-Ticker render_screen_ticker(render_screen, 250);
+void connectLinks(uint32_t now);
+void applyDesiredState(const shadowDesired &state);
+int64_t wallMicros();
+void handleResponse(const char *topic, const char *payload, size_t length);
+void printLinks();
+void printOutbox();
+void printClock();
+void printInput();
+void printLights();
+void printFrames();
+
+#if (METRICS_MQTT == 1)
+void publishMetrics();
+#endif
 
 // void hmi_read();
-int32_t inc_count      = 0;
 // Ticker hmi_read_ticker(hmi_read, 100);
 
 // void connectAWS();
 // Ticker connect_AWS_ticker(connectAWS, 250);
 
-// Global flag to indicate a Wi-Fi reconnect is needed
-volatile bool wifiReconnectNeeded = false;
-// volatile bool mqttReconnectNeeded = false;
+// the association attempt in progress was rejected
+volatile bool wifiConnectFailed = false;
 volatile bool net_init = false;
 
-struct WavFile {
-  uint8_t *data;
-  size_t size;
+// running timer kept through deep sleep
+RTC_DATA_ATTR resumeState resume_state;
+
+// last access point, lets the next wakeup skip the channel scan
+#define WIFI_CACHE_MAGIC 0x57494649  // "WIFI"
+struct wifiCache {
+  uint32_t magic;
+  int32_t channel;
+  uint8_t bssid[6];
+};
+RTC_DATA_ATTR wifiCache wifi_cache;
+// the association attempt in progress went to the cached access point
+volatile bool wifi_from_cache = false;
+
+// UI loop and networkTask only talk through these two queues
+#define COMMAND_QUEUE_SIZE 8
+
+// reports waiting for update/accepted, owned by networkTask and kept
+// through deep sleep
+RTC_DATA_ATTR outboxStore outbox_store;
+Outbox outbox(&outbox_store);
+// reports from the UI loop to networkTask
+CommandQueue<outboxEntry, COMMAND_QUEUE_SIZE> report_queue;
+
+// commands from networkTask to the UI loop
+struct uiCommand {
+  enum class Type { Desired, Shift, RtcSample, RtcWrite };
+  Type type;
+  int32_t shift;
+  shadowDesired desired;
 };
+CommandQueue<uiCommand, COMMAND_QUEUE_SIZE> ui_commands;
+
+// clock commands that didn't fit into ui_commands yet, owned by networkTask
+// and posted again on its next iteration, so no step of the clock is lost
+struct {
+  int32_t shift = 0;  // s, summed over the steps not posted yet
+  bool rtc_sample = false;
+  bool rtc_write = false;
+} clock_posts;
+
+// BM8563 access, owned by the UI loop like the rest of the internal I2C bus
+RtcEdge rtc_edge;
+int64_t rtc_write_at = 0;  // wall clock edge to set the BM8563 at, 0 - none
+
+// BM8563 results from the UI loop to networkTask, which owns the discipline
+struct rtcResult {
+  bool written;    // the BM8563 was set, otherwise sampled
+  int64_t wall;    // of the second edge
+  int64_t offset;  // BM8563 minus the wall clock then
+};
+CommandQueue<rtcResult, 4> rtc_results;
 
-WavFile sound_ding;
+// LED strip animation, owned by lightsTask, the UI only sends commands
+#define LIGHTS_QUEUE_SIZE 8
+TaskHandle_t lights_task = NULL;
+LedEngine lights;
+CommandQueue<lightsCommand, LIGHTS_QUEUE_SIZE> lights_commands;
 
-struct reportState {
-  bool sent = true;
-  bool reported = true;
-  bool both = false;
-  String timer_state;
-  u_int32_t start_time;
-} reportstate;
+void set_lights(const lightsCommand &command) {
+  if (lights_commands.push(command) && lights_task != NULL) {
+    xTaskNotifyGive(lights_task);
+  }
+}
 
-String get_topic(String thingName, bool update = false, bool accepted = false) {
-  // topic name for unnamed shadow retrieve / update
-  String topic;
-  topic = "$aws/things/" + thingName + "/shadow/";
-  topic = update ? topic + "update" : topic + "get";
-  topic = accepted ? topic + "/accepted" : topic;
-  DEBUG_PRINTLN("topic: " + topic);
-  return topic;
+// sleeps until a command arrives or, while an effect runs, the next frame
+void lightsTask(void *pvParameters) {
+  TickType_t wait = 0;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, wait);
+    uint32_t now = millis();
+    lightsCommand command;
+    while (lights_commands.pop(&command)) {
+      lights.apply(now, command);
+    }
+    if (lights.nextFrame(now) == 0) {
+      lights.update(now);
+    }
+    uint32_t next = lights.nextFrame(millis());
+    wait = next == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(next);
+  }
+}
+
+void notify_network(uint32_t event) {
+  if (network_task != NULL) {
+    xTaskNotify(network_task, event, eSetBits);
+  }
 }
 
-void report_state(String timer_state, u_int32_t start_time,
-                  bool reported /* = true */, bool both /* = false */) {
+void report_state(PomodoroTimer::PomodoroState timer_state,
+                  uint32_t start_time, bool reported /* = true */,
+                  bool both /* = false */) {
   DEBUG_PRINTLN("report_state");
-  reportstate.reported = reported;
-  reportstate.both = both;
-  reportstate.timer_state = timer_state;
-  reportstate.start_time = start_time;
-  reportstate.sent = false;
+  outboxEntry report;
+  report.timer_state = static_cast<uint8_t>(timer_state);
+  report.reported = reported || both;
+  report.desired = !reported || both;
+  report.start = start_time;
+  snprintf(report.description, sizeof(report.description), "%s",
+           active_screen ? active_screen->getTaskName().c_str() : "");
+  // from the poll that saw the input behind it, a session end is now
+  report.created_us = (change_us != 0 ? change_us : micros()) | 1;
+  if (!applying_desired) {
+    last_change = rtc.getEpoch();
+  }
+  if (!report_queue.push(report)) {
+    DEBUG_PRINTLN("report queue full");
+  }
+  notify_network(NET_EVENT_REPORT);
 }
 
-void send_report_state() {
-  if (!reportstate.sent && client.connected()) {
-    char jsonBuffer[512];
-    StaticJsonDocument<200> doc;
+void allow_sleep(bool allow) {
+  if (allow) {
+    sleepTicker.start();
+  } else {
+    sleepTicker.stop();
+  }
+}
 
-    if (reportstate.reported || reportstate.both) {
-      doc["state"]["reported"]["timer_state"] = reportstate.timer_state;
-      doc["state"]["reported"]["start"] = reportstate.start_time;
-      doc["state"]["reported"]["description"] = active_screen->getTaskName();
-    }
+void play_sound(const char *sound, int count) {
+  soundEngine.play(sound, count);
+}
 
-    if (!reportstate.reported || reportstate.both) {
-      doc["state"]["desired"]["timer_state"] = reportstate.timer_state;
-      doc["state"]["desired"]["start"] = reportstate.start_time;
-    }
+// moves new reports into the outbox and publishes whatever is due there,
+// returns true if the publish failed
+bool send_report_state() {
+  METRIC_SCOPE(SendReport);
+  outboxEntry report;
+  while (report_queue.pop(&report)) {
+    outbox.push(report);
+  }
 
-    serializeJson(doc, jsonBuffer);
-    DEBUG_PRINTLN("send_report_state reported: " + String(jsonBuffer));
-    auto published =
-        client.publish(get_topic(THINGNAME, true, false), jsonBuffer);
-    if (published) {
-      reportstate.sent = true;
-    }
+  uint32_t now = millis();
+  if (!outbox.due(now) || !links.isUp() || !hal::mqtt().connected()) {
+    return false;
   }
+  char jsonBuffer[SHADOW_UPDATE_SIZE];
+  if (outbox.encode(jsonBuffer, sizeof(jsonBuffer)) == 0) {
+    DEBUG_PRINTLN("shadow update doesn't fit");
+    return true;
+  }
+
+  // the batch stays in the outbox until update/accepted echoes its token,
+  // a PUBACK only says the broker got it, not that the shadow took it
+  DEBUG_PRINTF("send_report_state reported: %s\n", jsonBuffer);
+  if (!hal::mqtt().publish(topics.update, jsonBuffer, 1)) {
+    return true;
+  }
+  outbox.published(now);
+  if (outbox.batchNewest().created_us != 0) {
+    uint32_t latency = micros() - outbox.batchNewest().created_us;
+    METRIC_RECORD(ReportLatency, latency);
+    DEBUG_PRINTF("report published %u us after the input\n", latency);
+  }
+  return false;
 }
 
 // void hmi_read() {
@@ -152,16 +335,81 @@ void send_report_state() {
 //   }
 // }
 
-void updateControls() {
-  M5.update();
+bool readHmiBurst(uint8_t *data) {
+  Wire1.beginTransmission(HMI_ADDR);
+  Wire1.write(HMI_INCREMENT_REG);
+  return Wire1.endTransmission(false) == 0 &&
+         Wire1.requestFrom(HMI_ADDR, HMI_BURST_LENGTH) == HMI_BURST_LENGTH &&
+         Wire1.readBytes(data, HMI_BURST_LENGTH) == HMI_BURST_LENGTH;
+}
 
-  inc_count = hmi.getIncrementValue();
+// a unit that doesn't auto-increment, or garbles the reads at the faster
+// clock, returns something other than the released buttons the library
+// reads. A button held at boot fails it too, the fallback is always safe.
+bool probeHmiBurst() {
+  Wire1.setClock(HMI_I2C_BURST_CLOCK);
+  uint8_t data[HMI_BURST_LENGTH];
+  const uint8_t *buttons = &data[HMI_BUTTON_REG - HMI_INCREMENT_REG];
+  bool ok = true;
+  for (int i = 0; i < HMI_PROBE_READS && ok; i++) {
+    ok = readHmiBurst(data) && buttons[0] == 1 && buttons[1] == 1 &&
+         buttons[2] == 1 && hmi.getButtonS() == 1 && hmi.getButton1() == 1 &&
+         hmi.getButton2() == 1;
+  }
+  if (!ok) {
+    Wire1.setClock(HMI_I2C_CLOCK);
+  }
+  return ok;
+}
+
+void readHmi(inputSample *sample) {
+  uint32_t start = micros();
+  if (hmi_burst) {
+    uint8_t data[HMI_BURST_LENGTH];
+    if (readHmiBurst(data)) {
+      const uint8_t *buttons = &data[HMI_BUTTON_REG - HMI_INCREMENT_REG];
+      sample->increment = data[0] | (data[1] << 8) | (data[2] << 16) |
+                          (data[3] << 24);
+      sample->buttons |= (buttons[1] == 0)
+                         << static_cast<int>(InputButton::Hmi1);
+      sample->buttons |= (buttons[2] == 0)
+                         << static_cast<int>(InputButton::Hmi2);
+    }
+    // address, register, address again, the data
+    input.busy(micros() - start, 3 + HMI_BURST_LENGTH);
+    return;
+  }
+  // button S has no action, only the increment and buttons 1 and 2 are read
+  sample->increment = hmi.getIncrementValue();
+  sample->buttons |= (hmi.getButton1() == 0)
+                     << static_cast<int>(InputButton::Hmi1);
+  sample->buttons |= (hmi.getButton2() == 0)
+                     << static_cast<int>(InputButton::Hmi2);
+  // each read like the burst, three bytes of addressing and the data
+  input.busy(micros() - start, 3 * 3 + 4 + 2, 3);
+}
 
-  auto hmi_A = hmi.getButton1();
-  auto hmi_B = hmi.getButton2();
+void handleInput(const inputEvent &event) {
+  bool main_screen =
+      active_screen->getState() == screenRender::ScreenState::MainScreen;
+  int step = 0;
+  switch (event.type) {
+    case inputEvent::Type::Detent:
+      step = event.x;
+      break;
+    case inputEvent::Type::Flick:
+      // sideways like the encoder, right is more
+      if (abs(event.x) > abs(event.y)) {
+        step = event.x > 0 ? 1 : -1;
+      }
+      break;
+    case inputEvent::Type::Press:
+      break;
+    default:
+      return;
+  }
 
-  int step = inc_count / 4;
-  if (step != 0 && active_screen->getState() == screenRender::ScreenState::MainScreen) {
+  if (step != 0 && main_screen) {
     DEBUG_PRINTLN("step: " + String(step));
 
     int pomodoro_minutes_cfg = active_screen->pomodoro_minutes_cfg + step * 5;
@@ -172,28 +420,25 @@ void updateControls() {
     }
 
     active_screen->pomodoro_minutes_cfg = pomodoro_minutes_cfg;
+    return;
   }
-
-  auto count = M5.Touch.getCount();
-  if (count != 0 || step != 0) {
-    if (sleepTicker.state() == RUNNING) {
-      sleepTicker.start();
-      DEBUG_PRINTLN("sleepTicker restarted");
-    }
+  if (event.type != inputEvent::Type::Press) {
+    return;
   }
 
   switch (active_screen->getState()) {
     case screenRender::ScreenState::MainScreen:
-      if (M5.BtnA.wasPressed() || hmi_A == 0) {
+      if (event.button == InputButton::A || event.button == InputButton::Hmi1) {
         active_screen->setState(screenRender::ScreenState::PomodoroScreen,
                                 false, true, active_screen->pomodoro_minutes_cfg,
                                 PomodoroTimer::RestLength::REST);
-      } else if (M5.BtnB.wasPressed()) {
+      } else if (event.button == InputButton::B) {
         active_screen->setState(screenRender::ScreenState::PomodoroScreen,
                                 false, true,
                                 PomodoroTimer::toInt(PomodoroTimer::PomodoroLength::SMALL),
                                 PomodoroTimer::RestLength::REST_SMALL);
-      } else if (M5.BtnC.wasPressed() || hmi_B == 0) {
+      } else if (event.button == InputButton::C ||
+                 event.button == InputButton::Hmi2) {
         active_screen->setState(screenRender::ScreenState::PomodoroScreen, true,
                                 true, PomodoroTimer::toInt(PomodoroTimer::PomodoroLength::SMALL),
                                 PomodoroTimer::RestLength::REST_SMALL);
@@ -202,82 +447,270 @@ void updateControls() {
     case screenRender::ScreenState::PomodoroScreen:
       // break; // or any other for now - to the main screen
     default:
-      if (M5.BtnA.wasPressed() || M5.BtnB.wasPressed() ||
-          M5.BtnC.wasPressed()) {
+      if (event.button == InputButton::A || event.button == InputButton::B ||
+          event.button == InputButton::C) {
         active_screen->setState(screenRender::ScreenState::MainScreen);
       }
       break;
   }
 }
 
-void messageHandler(const String &topic, const String &payload) {
-  DEBUG_PRINTLN("incoming: " + topic + " - " + payload);
-
-  StaticJsonDocument<200> doc;
-  deserializeJson(doc, payload);
-
-  auto state = doc["state"]["desired"];
-  String timer_state = state["timer_state"];
-  int start_time = state["start"];
-
-  DEBUG_PRINTLN("desired timer_state: " + timer_state + " start_time " +
-                start_time);
-  if (reportstate
-          .sent) {  // only act on recieve if there is nothing to send (?)
-    if (timer_state == "POMODORO") {  // TODO(ChistokhinSV) add processing for
-                                      // pause and other states?
-      auto current_time = rtc.getEpoch();
-      auto timer_ongoing = current_time - start_time;
-
-      auto description = state["description"];
-      if (description) {
-        active_screen->setTaskName(description);
-
-        if (active_screen->pomodoro.getState() !=
-                PomodoroTimer::PomodoroState::POMODORO ||
-            active_screen->pomodoro.getStartTime() != start_time) {
-          if (timer_ongoing < 25 * 60) {  // small pomodoro
-            active_screen->setState(screenRender::ScreenState::PomodoroScreen,
-                                    false, false);
-            active_screen->pomodoro.adjustStart(start_time);
-            // report_state(timer_state, start_time);
-          } else if (timer_ongoing < 45 * 60) {  // big pomodoro
-            active_screen->setState(screenRender::ScreenState::PomodoroScreen,
-                                    false, false,
-                                    PomodoroTimer::toInt(PomodoroTimer::PomodoroLength::BIG),
-                                    PomodoroTimer::RestLength::REST);
-            active_screen->pomodoro.adjustStart(start_time);
-          } else {  // stop if more than 45 minutes
-            active_screen->setState(screenRender::ScreenState::MainScreen);
-            report_state("STOPPED", 0, true, true);
-          }
-        }
-      }
+void updateControls() {
+  uint32_t now = millis();
+  if (!input.due(now, digitalRead(POWER_TOUCH_PIN) == LOW)) {
+    return;
+  }
+  METRIC_SCOPE(UpdateControls);
+  M5.update();
 
-    } else if (timer_state == "STOPPED") {
-      if (active_screen->pomodoro.getState() !=
-          PomodoroTimer::PomodoroState::STOPPED) {
-        active_screen->setState(screenRender::ScreenState::MainScreen);
-        report_state("STOPPED", 0, true, false);
-      }
-    } else if (timer_state == "REST") {
-      if (active_screen->pomodoro.getState() !=
-          PomodoroTimer::PomodoroState::REST) {
-        DEBUG_PRINTLN("REST by MQTT");
-        active_screen->setState(screenRender::ScreenState::PomodoroScreen, true,
-                                false, PomodoroTimer::toInt(PomodoroTimer::PomodoroLength::SMALL),
-                                PomodoroTimer::RestLength::REST_SMALL);
-        DEBUG_PRINTLN("adjustStart REST by MQTT");
+  inputSample sample;
+  sample.buttons = (M5.BtnA.isPressed() << static_cast<int>(InputButton::A)) |
+                   (M5.BtnB.isPressed() << static_cast<int>(InputButton::B)) |
+                   (M5.BtnC.isPressed() << static_cast<int>(InputButton::C));
+  readHmi(&sample);
+  auto count = M5.Touch.getCount();
+  if (count != 0) {
+    auto touch = M5.Touch.getDetail();
+    sample.touch = touch.y < M5.Lcd.height();  // below are BtnA, B and C
+    sample.touch_x = touch.x;
+    sample.touch_y = touch.y;
+  }
+  input.sample(now, micros(), sample);
+#if (INPUT_TRACE == 1)
+  static inputSample traced;
+  if (sample.buttons != traced.buttons || sample.increment != 0 ||
+      sample.touch != traced.touch || sample.touch_x != traced.touch_x ||
+      sample.touch_y != traced.touch_y) {
+    char line[INPUT_TRACE_LINE];
+    inputTraceFormat(line, sizeof(line), now, sample);
+    Serial.print(line);
+    traced = sample;
+  }
+#endif
+
+  if (count != 0 || sample.increment != 0 || sample.buttons != 0) {
+    powerManager.input();
+    bootTimeline.mark(BootTimeline::Phase::FirstInput);
+    if (sleepTicker.state() == RUNNING) {
+      sleepTicker.start();
+      DEBUG_PRINTLN("sleepTicker restarted");
+    }
+  }
+
+  inputEvent event;
+  while (input.pop(&event)) {
+    renderScheduler.request(RenderScheduler::Reason::Input);
+    change_us = event.at_us;
+    handleInput(event);
+    change_us = 0;
+    input_latency.handled(event.at_us, micros());
+  }
+}
+
+void messageHandler(const char *topic, const char *payload, size_t length) {
+  // runs on networkTask inside client.loop(), the desired state is applied
+  // by the UI loop in processCommands()
+  METRIC_SCOPE(MessageHandler);
+  DEBUG_PRINTF("incoming: %s - %.*s\n", topic, static_cast<int>(length),
+               payload);
+
+  if (strcmp(topic, topics.update_accepted) == 0 ||
+      strcmp(topic, topics.update_rejected) == 0) {
+    handleResponse(topic, payload, length);
+    return;
+  }
+
+  uiCommand command;
+  command.type = uiCommand::Type::Desired;
+  bool parsed;
+  if (strcmp(topic, topics.update_delta) == 0) {
+    parsed = shadowDecodeDelta(payload, length, &command.desired);
+  } else {  // get/accepted
+    parsed = shadowDecodeDesired(payload, length, &command.desired);
+  }
+  if (!parsed) {
+    DEBUG_PRINTLN("failed to parse shadow document");
+    return;
+  }
+
+  // a get/accepted overtaken by a delta, or a delta delivered twice
+  uint32_t version = command.desired.version;
+  if (version != 0 && static_cast<int32_t>(version - shadow_version) <= 0 &&
+      shadow_version != 0) {
+    DEBUG_PRINTF("stale shadow version %u, have %u\n", version,
+                 shadow_version);
+    netstats.stale++;
+    return;
+  }
+  shadow_version = version != 0 ? version : shadow_version;
+
+  DEBUG_PRINTF("desired timer_state: %s start_time %d version %u\n",
+               shadowStateName(command.desired.timer_state),
+               command.desired.start, version);
+  if (command.desired.client_token != 0) {
+    netstats.echoes++;  // the device already is in that state
+    return;
+  }
+  if (!ui_commands.push(command)) {
+    DEBUG_PRINTLN("UI command queue full");
+  }
+  powerManager.wake();
+
+  //  const char* message = doc["message"];
+}
+
+void handleResponse(const char *topic, const char *payload, size_t length) {
+  // the outbox is owned by networkTask, which is where this runs
+  shadowResponse response;
+  if (!shadowDecodeResponse(payload, length, &response)) {
+    DEBUG_PRINTLN("failed to parse shadow response");
+    return;
+  }
+  if (strcmp(topic, topics.update_accepted) == 0) {
+    outbox.ack(response.client_token);
+    return;
+  }
+  netstats.rejected++;
+  DEBUG_PRINTF("update %u rejected with %u\n", response.client_token,
+               response.code);
+  outbox.rejected(response.client_token, response.code);
+}
+
+void applyDesired(const shadowDesired &state) {
+  // last writer wins: a local change made after the desired state was
+  // written is already on its way to the shadow. Without a timestamp the
+  // order is unknown, and a local change is kept
+  if (state.updated == 0 && last_change != 0) {
+    DEBUG_PRINTLN("desired state without a timestamp, keeping local state");
+    return;
+  }
+  if (static_cast<int32_t>(state.updated - last_change) < 0) {
+    DEBUG_PRINTF("desired state from %u predates the local change at %u\n",
+                 state.updated, last_change);
+    return;
+  }
+  applying_desired = true;
+  applyDesiredState(state);
+  applying_desired = false;
+  if (state.updated != 0) {
+    last_change = state.updated;
+  }
+}
+
+void applyDesiredState(const shadowDesired &state) {
+  // fields missing from a delta are the same as reported, i.e. local
+  auto timer_state = state.has_timer_state
+                         ? state.timer_state
+                         : active_screen->pomodoro.getState();
+  int start_time =
+      state.has_start ? state.start : active_screen->pomodoro.getStartTime();
+  if (state.has_description) {
+    active_screen->setTaskName(state.description);
+  }
+
+  // TODO(ChistokhinSV) add processing for pause and other states?
+  if (timer_state == PomodoroTimer::PomodoroState::POMODORO) {
+    // a session needs a description, set above or, for a delta that
+    // leaves it out, the one already shown
+    if (active_screen->getTaskName().length() == 0) {
+      DEBUG_PRINTLN("desired POMODORO without a description, ignored");
+      return;
+    }
+    auto current_time = rtc.getEpoch();
+    auto timer_ongoing = current_time - start_time;
+    const uint32_t small =
+        PomodoroTimer::toInt(PomodoroTimer::PomodoroLength::SMALL) * 60;
+    const uint32_t big =
+        PomodoroTimer::toInt(PomodoroTimer::PomodoroLength::BIG) * 60;
+
+    if (active_screen->pomodoro.getState() !=
+            PomodoroTimer::PomodoroState::POMODORO ||
+        active_screen->pomodoro.getStartTime() != start_time) {
+      if (timer_ongoing < small) {  // small pomodoro
+        active_screen->setState(screenRender::ScreenState::PomodoroScreen,
+                                false, false);
+        active_screen->pomodoro.adjustStart(start_time);
+        // report_state(timer_state, start_time);
+      } else if (timer_ongoing < big) {  // big pomodoro
+        active_screen->setState(screenRender::ScreenState::PomodoroScreen,
+                                false, false,
+                                PomodoroTimer::toInt(PomodoroTimer::PomodoroLength::BIG),
+                                PomodoroTimer::RestLength::REST);
         active_screen->pomodoro.adjustStart(start_time);
-        DEBUG_PRINTLN("REST by MQTT complete");
+      } else {  // the session is already over
+        active_screen->setState(screenRender::ScreenState::MainScreen);
+        report_state(PomodoroTimer::PomodoroState::STOPPED, 0, true, true);
       }
     }
+  } else if (timer_state == PomodoroTimer::PomodoroState::STOPPED) {
+    if (active_screen->pomodoro.getState() !=
+        PomodoroTimer::PomodoroState::STOPPED) {
+      active_screen->setState(screenRender::ScreenState::MainScreen);
+      report_state(PomodoroTimer::PomodoroState::STOPPED, 0, true, false);
+    }
+  } else if (timer_state == PomodoroTimer::PomodoroState::REST) {
+    if (active_screen->pomodoro.getState() !=
+        PomodoroTimer::PomodoroState::REST) {
+      DEBUG_PRINTLN("REST by MQTT");
+      active_screen->setState(screenRender::ScreenState::PomodoroScreen, true,
+                              false, PomodoroTimer::toInt(PomodoroTimer::PomodoroLength::SMALL),
+                              PomodoroTimer::RestLength::REST_SMALL);
+      DEBUG_PRINTLN("adjustStart REST by MQTT");
+      active_screen->pomodoro.adjustStart(start_time);
+      DEBUG_PRINTLN("REST by MQTT complete");
+    }
   }
+}
 
-  //  const char* message = doc["message"];
+void processCommands() {
+  // all timer and screen mutations requested by networkTask happen here
+  uiCommand command;
+  while (ui_commands.pop(&command)) {
+    switch (command.type) {
+      case uiCommand::Type::Desired:
+        applyDesired(command.desired);
+        break;
+      case uiCommand::Type::Shift:
+        active_screen->pomodoro.shift(command.shift);
+        break;
+      case uiCommand::Type::RtcSample:
+        rtc_edge.start();
+        break;
+      case uiCommand::Type::RtcWrite:
+        // the BM8563 only keeps whole seconds, set it at the next edge
+        rtc_write_at = (wallMicros() / 1000000 + 1) * 1000000;
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+int64_t wallMicros() {
+  timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec * 1000000ll + now.tv_usec;
+}
+
+void setWallMicros(int64_t wall) {
+  timeval now = {static_cast<time_t>(wall / 1000000),
+                 static_cast<suseconds_t>(wall % 1000000)};
+  settimeofday(&now, NULL);
+}
+
+int64_t rtcEpoch(const m5::rtc_datetime_t &datetime) {
+  struct tm timeinfo = {};
+  timeinfo.tm_year = datetime.date.year - 1900;
+  timeinfo.tm_mon = datetime.date.month - 1;
+  timeinfo.tm_mday = datetime.date.date;
+  timeinfo.tm_hour = datetime.time.hours;
+  timeinfo.tm_min = datetime.time.minutes;
+  timeinfo.tm_sec = datetime.time.seconds;
+  return mktime(&timeinfo);  // no TZ set, the BM8563 keeps UTC
 }
 
 void set_rtc() {
+  // runs on the UI loop right after a second edge of the wall clock
   m5::rtc_datetime_t datetime;
   struct tm timeinfo = rtc.getTimeStruct();
   datetime.date.year = timeinfo.tm_year + 1900;
@@ -290,8 +723,45 @@ void set_rtc() {
   DEBUG_PRINTLN("set_rtc(): " + rtc.getTimeDate(true));
 }
 
+void postRtcResult(const rtcResult &result) {
+  if (!rtc_results.push(result)) {
+    DEBUG_PRINTLN("RTC result queue full");
+  }
+  notify_network(NET_EVENT_RTC);
+}
+
+void serviceRtc() {
+  // one short transaction per loop() at most, nothing here waits
+  if (rtc_write_at != 0 && wallMicros() >= rtc_write_at) {
+    rtc_write_at = 0;
+    set_rtc();
+    postRtcResult({true, 0, 0});
+  }
+  if (rtc_edge.active()) {
+    int64_t rtc = rtcEpoch(M5.Rtc.getDateTime());
+    int64_t edge, offset;
+    if (rtc_edge.read(wallMicros(), rtc, &edge, &offset)) {
+      postRtcResult({false, edge, offset});
+    }
+  }
+}
+
 void render_screen() { active_screen->render(); }
 
+void sleepThroughTimer() {
+  auto snapshot = active_screen->pomodoro.snapshot();
+  uint64_t wake_us = resumeWakeDelay(rtc.getEpoch(), rtc.getMicros(),
+                                     snapshot.end);
+  if (wake_us < RESUME_MIN_SLEEP * 1000000ull) {
+    return;
+  }
+  resumeEncode(&resume_state, snapshot,
+               active_screen->getTaskName().c_str());
+  DEBUG_PRINTF("Deep sleep through the timer, wakeup in %llu ms\n",
+               wake_us / 1000);
+  deepSleep(wake_us);
+}
+
 void initFileSystem() {
   if (!LittleFS.begin(true)) {
     DEBUG_PRINTLN("An Error has occurred while mounting LittleFS");
@@ -301,15 +771,37 @@ void initFileSystem() {
   }
 }
 
-void WiFiEvent(WiFiEvent_t event) {
+void WiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info) {
   switch (event) {
-    case SYSTEM_EVENT_STA_DISCONNECTED:
-      DEBUG_PRINTLN("Wi-Fi disconnected, setting flag for reconnect...");
-      wifiReconnectNeeded = true;
+    case SYSTEM_EVENT_STA_DISCONNECTED: {
+      uint8_t reason = info.wifi_sta_disconnected.reason;
+      DEBUG_PRINTF("Wi-Fi disconnected: %u\n", reason);
+      wifiConnectFailed = true;
+      // the access point isn't on the cached channel and BSSID any more,
+      // scan on the next attempt. Ordinary drops keep the cache.
+      if (wifi_from_cache && (reason == WIFI_REASON_NO_AP_FOUND ||
+                              reason == WIFI_REASON_AUTH_FAIL ||
+                              reason == WIFI_REASON_ASSOC_FAIL)) {
+        wifi_cache.magic = 0;
+        wifi_from_cache = false;
+      }
+      renderScheduler.request(RenderScheduler::Reason::Connectivity);
+      notify_network(NET_EVENT_WIFI);
       break;
+    }
     case SYSTEM_EVENT_STA_LOST_IP:
-      DEBUG_PRINTLN("Wi-Fi lost IP, setting flag for reconnect...");
-      wifiReconnectNeeded = true;
+      DEBUG_PRINTLN("Wi-Fi lost IP");
+      renderScheduler.request(RenderScheduler::Reason::Connectivity);
+      notify_network(NET_EVENT_WIFI);
+      break;
+    case SYSTEM_EVENT_STA_GOT_IP:
+      bootTimeline.mark(BootTimeline::Phase::WifiConnected);
+      wifi_cache.channel = WiFi.channel();
+      memcpy(wifi_cache.bssid, WiFi.BSSID(), sizeof(wifi_cache.bssid));
+      wifi_cache.magic = WIFI_CACHE_MAGIC;
+      wifi_from_cache = false;
+      renderScheduler.request(RenderScheduler::Reason::Connectivity);
+      notify_network(NET_EVENT_WIFI);
       break;
     case SYSTEM_EVENT_WIFI_READY:
       DEBUG_PRINTLN("Wi-Fi Ready");
@@ -319,45 +811,152 @@ void WiFiEvent(WiFiEvent_t event) {
   }
 }
 
-void networkTask(void *pvParameters) {
-  DEBUG_PRINTLN("networkTask()");
+// shortens *wait so networkTask wakes up at the given millis() deadline
+void wakeAt(uint32_t now, uint32_t deadline, TickType_t *wait) {
+  int32_t left = deadline - now;
+  TickType_t ticks = left > 0 ? pdMS_TO_TICKS(left) : 0;
+  if (ticks < *wait) {
+    *wait = ticks;
+  }
+}
 
-  for (;;) {
-    auto ntp_epoch = timeClient.isTimeSet() ? timeClient.getEpochTime() : 0;
+bool due(uint32_t now, uint32_t deadline) {
+  return static_cast<int32_t>(now - deadline) >= 0;
+}
 
-    if (wifiReconnectNeeded) {
-      DEBUG_PRINTLN("Wi-Fi init begins");
-      WiFi.mode(WIFI_STA);
-      WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-      wifiReconnectNeeded = false;
+// posts clock_posts to the UI loop, returns false if some are still left
+bool postClock() {
+  uiCommand command;
+  bool posted = false;
+  if (clock_posts.shift != 0) {
+    command.type = uiCommand::Type::Shift;
+    command.shift = clock_posts.shift;
+    if (ui_commands.push(command)) {
+      clock_posts.shift = 0;
+      posted = true;
+    }
+  }
+  if (clock_posts.rtc_write) {
+    command.type = uiCommand::Type::RtcWrite;
+    if (ui_commands.push(command)) {
+      clock_posts.rtc_write = false;
+      posted = true;
+    }
+  }
+  if (clock_posts.rtc_sample) {
+    command.type = uiCommand::Type::RtcSample;
+    if (ui_commands.push(command)) {
+      clock_posts.rtc_sample = false;
+      posted = true;
     }
-    auto wifi_connected = WiFi.isConnected();
+  }
+  if (posted) {
+    powerManager.wake();
+  }
+  bool left =
+      clock_posts.shift != 0 || clock_posts.rtc_write || clock_posts.rtc_sample;
+  if (left) {
+    netstats.ui_full++;
+  }
+  return !left;
+}
 
-    if (wifi_connected) {
-      timeClient.update();
-    }
-
-    if (wifi_connected && (ntp_epoch - lastTimeUpdate) > NTP_UPDATE) {
-      DEBUG_PRINTLN("Updating time...");
-      lastTimeUpdate = ntp_epoch;
-      auto time_updated = timeClient.isTimeSet();
-
-      auto currentRTC = rtc.getEpoch();
-      auto currentNTP = time_updated ? timeClient.getEpochTime() : 0;
-      auto diff = currentNTP - currentRTC;
-      if (timeClient.isTimeSet() && currentRTC > 0 && currentNTP > 0 &&
-          diff > 1) {  // if there is more than 1 second difference
-        DEBUG_PRINTLN("RTC update, currentRTC=" + String(currentRTC) +
-                      ", currentNTP=" + String(currentNTP) +
-                      ", diff=" + String(diff));
-        DEBUG_PRINTLN("networkTask rtc.getTimeDate(): " +
-                      rtc.getTimeDate(true));
-        rtc.setTime(ntp_epoch);
-        active_screen->pomodoro.shift(diff);
-        set_rtc();
-
-        DEBUG_PRINTLN("RTC updated, shifted " + String(diff) + " seconds");
+void stepClock(int64_t offset) {
+  setWallMicros(wallMicros() + offset);
+  clock_posts.shift +=
+      (offset + (offset < 0 ? -500000 : 500000)) / 1000000;
+  clock_posts.rtc_write = true;
+  postClock();
+  DEBUG_PRINTF("Clock stepped by %lld us\n", offset);
+}
+
+// BM8563 samples and writes done by the UI loop
+void takeRtcResults() {
+  rtcResult result;
+  while (rtc_results.pop(&result)) {
+    if (result.written) {
+      discipline.rtcWritten();
+      DEBUG_PRINTLN("BM8563 set");
+      continue;
+    }
+    discipline.rtcSample(result.wall, result.offset);
+    if (result.offset > 500000 || result.offset < -500000) {
+      clock_posts.rtc_write = true;
+      postClock();
+    }
+  }
+}
+
+void syncTime() {
+  DEBUG_PRINTLN("Updating time...");
+  IPAddress server;
+  if (!WiFi.hostByName(ntpServer, server) || !ntpUDP.begin(NTP_LOCAL_PORT)) {
+    return;
+  }
+  uint8_t packet[NTP_PACKET_SIZE];
+  for (int i = 0; i < CLOCK_BURST; i++) {
+    int64_t t1 = wallMicros();
+    ntpEncodeRequest(packet, t1);
+    ntpUDP.beginPacket(server, NTP_PORT);
+    ntpUDP.write(packet, sizeof(packet));
+    ntpUDP.endPacket();
+    uint32_t sent = millis();
+    while (millis() - sent < NTP_TIMEOUT) {
+      if (ntpUDP.parsePacket() > 0) {
+        int64_t t4 = wallMicros();
+        int size = ntpUDP.read(packet, sizeof(packet));
+        clockSample sample;
+        if (size > 0 && ntpDecodeResponse(packet, size, t1, t4, &sample)) {
+          discipline.addSample(sample);
+          break;
+        }
       }
+      delay(1);
+    }
+  }
+  ntpUDP.stop();
+
+  int64_t offset = 0;
+  switch (discipline.update(hal::clock().monotonicMicros(), &offset)) {
+    case ClockDiscipline::Action::Step:
+      stepClock(offset);
+      break;
+    case ClockDiscipline::Action::Slew: {
+      timeval delta = {static_cast<time_t>(offset / 1000000),
+                       static_cast<suseconds_t>(offset % 1000000)};
+      adjtime(&delta, NULL);
+      break;
+    }
+    default:
+      break;
+  }
+  if (discipline.rtcDue(wallMicros())) {
+    // the BM8563 only shows whole seconds, its edge shows the fraction
+    clock_posts.rtc_sample = true;
+    postClock();
+  }
+}
+
+void clock_sleep() {
+  // networkTask is done with the clock by now, the device is going down
+  discipline.sleeping(wallMicros());
+}
+
+void networkTask(void *pvParameters) {
+  DEBUG_PRINTLN("networkTask()");
+
+  TickType_t wait = 0;
+  uint32_t next_ntp = millis();
+  uint32_t next_loop = millis();
+
+  for (;;) {
+    uint32_t events = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &events, wait);
+    uint32_t iteration_start = micros();
+    uint32_t now = millis();
+    netstats.wakeups++;
+    if (events != 0) {
+      netstats.notified++;
     }
 
     if (!net_init) {
@@ -365,41 +964,141 @@ void networkTask(void *pvParameters) {
       netClientInit();
     }
 
-    if (wifi_connected && !client.connected()) {
-      DEBUG_PRINTLN("Connecting to AWS IOT...");
-      client.connect(THINGNAME);
-      subscribed = false;
-      lastrequest = 0;
+    connectLinks(now);
+    now = millis();  // the TLS handshake takes a while
+    auto wifi_connected = links.link(ConnectionManager::Wifi).getState() ==
+                          Link::State::Up;
+
+    // otherwise only a Wi-Fi event, a new report or a reconnect deadline can
+    // change anything
+    wait = portMAX_DELAY;
+
+    takeRtcResults();
+    if (!postClock()) {
+      wakeAt(now, now + CONTROL_PERIOD, &wait);  // the UI loop drains it
+    }
+
+    if (wifi_connected) {
+      if (due(now, next_ntp)) {
+        syncTime();
+        now = millis();  // a burst takes up to seconds
+        next_ntp = now + (discipline.synced()
+                              ? discipline.pollInterval() * 1000
+                              : NET_RETRY);
+      }
+      wakeAt(now, next_ntp, &wait);
+    }
+
+    uint32_t reconnect = links.nextWake(now);
+    if (reconnect != UINT32_MAX) {
+      wakeAt(now, now + reconnect, &wait);
     }
 
-    if (wifi_connected && client.connected()) {
+    if (links.isUp()) {
       if (!subscribed) {
         DEBUG_PRINTLN("AWS IoT Connected!");
-        client.subscribe(get_topic(THINGNAME, false, true));  // updates on GET
-        client.subscribe(
-            get_topic(THINGNAME, true, true));  // updates on UPDATE
+        hal::mqtt().subscribe(topics.get_accepted);     // full state on GET
+        hal::mqtt().subscribe(topics.update_delta);     // changes only
+        hal::mqtt().subscribe(topics.update_accepted);  // outbox acks
+        hal::mqtt().subscribe(topics.update_rejected);
         subscribed = true;
-        timeClient.begin();
-        timeClient.update();
+        outbox.resend();  // an ack may have been lost with the connection
+        renderScheduler.request(RenderScheduler::Reason::Connectivity);
+        next_loop = now;
+        if (!bootTimeline.reached(BootTimeline::Phase::MqttConnected)) {
+          bootTimeline.mark(BootTimeline::Phase::MqttConnected);
+          bootTimeline.report(&Serial);
+        }
       }
 
-      if (lastrequest == 0 && reportstate.sent) {
+      // the shadow would be older than the transitions still in the outbox
+      if (lastrequest == 0 && outbox.empty() && report_queue.empty()) {
         getDeviceShadow();
       }
+    }
 
-      send_report_state();
+    // reports are queued in the outbox while offline too
+    if (send_report_state()) {  // publish failed, try again later
+      wakeAt(now, now + NET_RETRY, &wait);
+    } else if (links.isUp() && !outbox.empty()) {
+      wakeAt(now, now + outbox.waitLeft(now), &wait);  // ack timeout
     }
 
-    // Other network task activities
-    if (wifi_connected && client.connected()) {
-      client.loop();
+    if (links.isUp()) {
+      // inbound messages and the keepalive ping are both handled in loop()
+      if ((events & NET_EVENT_REPORT) || due(now, next_loop)) {
+        uint32_t loop_start = micros();
+        hal::mqtt().loop();
+        METRIC_RECORD(ClientLoop, micros() - loop_start);
+        next_loop = now + min(NET_RX_POLL, MQTT_KEEPALIVE * 1000 / 2);
+      }
+      wakeAt(now, next_loop, &wait);
     }
 
-    if (wifi_connected) {
-      timeClient.update();
+#if (METRICS_MQTT == 1)
+    if (links.isUp()) {
+      publishMetrics();
     }
+#endif
 
-    vTaskDelay(pdMS_TO_TICKS(100));
+    network_idle = links.isUp() && subscribed && outbox.empty() &&
+                   report_queue.empty();
+    METRIC_RECORD(NetworkTask, micros() - iteration_start);
+  }
+}
+
+void connectLinks(uint32_t now) {
+  uint32_t timed_out = links.update(now, WiFi.isConnected(), net.connected(),
+                                    client.connected());
+  if (timed_out & (1u << ConnectionManager::Wifi)) {
+    WiFi.disconnect();  // stop the association attempt before the next one
+  }
+  if (wifiConnectFailed &&
+      links.link(ConnectionManager::Wifi).getState() ==
+          Link::State::Connecting) {
+    links.failed(ConnectionManager::Wifi, now);  // no need to wait it out
+  }
+
+  if (links.shouldConnect(ConnectionManager::Wifi, now)) {
+    DEBUG_PRINTLN("Wi-Fi init begins");
+    links.connecting(ConnectionManager::Wifi, now);
+    wifiConnectFailed = false;
+    wifi_from_cache = wifi_cache.magic == WIFI_CACHE_MAGIC;
+    if (wifi_from_cache) {
+      WiFi.begin(WIFI_SSID, WIFI_PASSWORD, wifi_cache.channel,
+                 wifi_cache.bssid);
+    } else {
+      WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+    }
+  }
+
+  if (links.shouldConnect(ConnectionManager::Tls, now)) {
+    DEBUG_PRINTLN("Connecting to AWS IOT...");
+    links.connecting(ConnectionManager::Tls, now);
+    uint32_t start = micros();
+    if (net.connect(AWS_IOT_ENDPOINT, 8883)) {
+      METRIC_RECORD(TlsConnect, micros() - start);
+      links.connected(ConnectionManager::Tls, millis());
+    } else {
+      links.failed(ConnectionManager::Tls, millis());
+    }
+  }
+
+  if (links.shouldConnect(ConnectionManager::Mqtt, now)) {
+    if (subscribed) {  // connection was lost
+      renderScheduler.request(RenderScheduler::Reason::Connectivity);
+    }
+    subscribed = false;
+    lastrequest = 0;
+    links.connecting(ConnectionManager::Mqtt, now);
+    if (client.connect(THINGNAME, true)) {  // TLS is already up
+      links.connected(ConnectionManager::Mqtt, millis());
+    } else {
+      // TLS stays up for the next attempt, links.update() sees it if the
+      // broker closes it
+      DEBUG_PRINTF("MQTT connect failed: %d\n", client.returnCode());
+      links.failed(ConnectionManager::Mqtt, millis());
+    }
   }
 }
 
@@ -412,49 +1111,98 @@ void netClientInit() {
   net.setHandshakeTimeout(15);
 
   client.begin(AWS_IOT_ENDPOINT, 8883, net);
-  client.onMessage(messageHandler);
+  client.setKeepAlive(MQTT_KEEPALIVE);
+  hal::mqtt().onMessage(messageHandler);
 
   net_init = true;
 }
 
+#if (METRICS_MQTT == 1)
+void publishMetrics() {
+  static uint32_t last_publish = 0;
+  auto now = rtc.getEpoch();
+  if (now - last_publish < METRICS_INTERVAL) {
+    return;
+  }
+
+  static const String topic = String("pomodoro/") + THINGNAME + "/metrics";
+  char jsonBuffer[512];
+  if (metrics.toJson(jsonBuffer, sizeof(jsonBuffer)) > 0 &&
+      client.publish(topic, jsonBuffer)) {
+    last_publish = now;
+  }
+}
+#endif
+
 void getDeviceShadow() {
   DEBUG_PRINTLN("Getting the device shadow...");
 
-  char jsonBuffer[512];
-  StaticJsonDocument<200> doc;
-  doc["request"] = "GET SHADOW";
-  serializeJson(doc, jsonBuffer);
+  static const char jsonBuffer[] = "{\"request\":\"GET SHADOW\"}";
 
   Serial.print("Publishing: ");
   Serial.println(jsonBuffer);
 
-  client.publish(get_topic(THINGNAME, false, false),
-                 jsonBuffer);  // ask for current state
+  hal::mqtt().publish(topics.get, jsonBuffer);  // ask for current state
   lastrequest = rtc.getEpoch();
+  shadow_version = 0;  // the shadow may have been recreated meanwhile
 
   Serial.println(rtc.getTimeDate(true));
 }
 void setup() {
+  bootTimeline.mark(BootTimeline::Phase::Setup);
   DEBUG_PRINTLN("Main setup() function");
   esp_sleep_wakeup_cause_t wakeup_cause = esp_sleep_get_wakeup_cause();
   M5.begin();
-
-  // timeClient.end();  // stop NTP client to reduce affecting SSL handshake
+  if (wakeup_cause != ESP_SLEEP_WAKEUP_UNDEFINED) {
+    // the system clock ran on the sleep clock, take out its known drift
+    setWallMicros(wallMicros() + discipline.wakeCorrection(wallMicros()));
+  } else if (M5.Rtc.getDateTime().date.year >= 2023) {
+    // cold boot, the BM8563 is the only time there is until NTP
+    int64_t rtc_time = rtcEpoch(M5.Rtc.getDateTime()) * 1000000 + 500000;
+    setWallMicros(rtc_time + discipline.rtcCorrection(rtc_time));
+  }
+  bootTimeline.mark(BootTimeline::Phase::Display);
+  bootTimeline.setWakeup(wakeup_cause, wifi_cache.magic == WIFI_CACHE_MAGIC);
+  shadowInitTopics(THINGNAME);
 
   DEBUG_PRINTLN("WAKEUP CAUSE: " + String(wakeup_cause));
 
   WiFi.onEvent(WiFiEvent);
-  wifiReconnectNeeded = true;
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false);  // networkTask reconnects with backoff
+  links.seed(esp_random());
   xTaskCreatePinnedToCore(networkTask,   /* Function to implement the task */
                           "NetworkTask", /* Name of the task */
                           10000,         /* Stack size in words */
                           NULL,          /* Task input parameter */
                           1,             /* Priority of the task */
-                          NULL,          /* Task handle */
+                          &network_task, /* Task handle */
                           1);            /* Core where the task should run */
 
+  // fast path to the first frame: sounds and images are loaded on first
+  // use, the HMI unit is brought up after the frame is on the LCD
   initFileSystem();
   M5.Lcd.setBrightness(SCREEN_BRIGHTNESS);
+  powerManager.begin();
+
+  // the screen turns the strip off first thing. 3072 bytes of stack, the
+  // frame levels and the strip driver's show() left too little of 2048
+  xTaskCreatePinnedToCore(lightsTask, "LightsTask", 3072, NULL, 2,
+                          &lights_task, 1);
+  active_screen = new screenRender();
+
+  PomodoroTimer::Snapshot snapshot;
+  char task_name[SHADOW_DESCRIPTION_LENGTH];
+  if (resumeDecode(resume_state, &snapshot, task_name, sizeof(task_name))) {
+    DEBUG_PRINTLN("Resuming the timer after deep sleep");
+    active_screen->resume(snapshot, task_name);
+    bootTimeline.mark(BootTimeline::Phase::Restored);
+  }
+  resumeClear(&resume_state);
+
+  render_screen();
+  active_screen->flush();
+  bootTimeline.mark(BootTimeline::Phase::FirstPixel);
 
   DEBUG_PRINTLN("Speaker init");
   M5.Speaker.setVolume(SPEAKER_VOLUME);
@@ -464,24 +1212,181 @@ void setup() {
   DEBUG_PRINTLN(rtc.getTimeDate(true));
 
   DEBUG_PRINTLN("HMI init");
-  hmi.begin(&Wire1, HMI_ADDR, 21, 22, 100000);
+  hmi.begin(&Wire1, HMI_ADDR, 21, 22, HMI_I2C_CLOCK);
   DEBUG_PRINTLN(hmi.getFirmwareVersion());
+  hmi_burst = probeHmiBurst();
+  DEBUG_PRINTF("HMI burst reads %s\n", hmi_burst ? "at 400 kHz" : "off");
+  bootTimeline.mark(BootTimeline::Phase::InputReady);
 
   DEBUG_PRINTLN("Starting timers");
 
-  active_screen = new screenRender();
-
-  main_ticker.start();
-  render_screen_ticker.start();
+  input.reset(millis());
+  looplatency.last = micros();
   // connect_AWS_ticker.start();
   // hmi_read_ticker.start();
 }
 
+void measureLoopLatency() {
+  uint32_t now = micros();
+  uint32_t elapsed = now - looplatency.last;
+  looplatency.last = now;
+  METRIC_RECORD(Loop, elapsed);
+
+  if (elapsed > looplatency.max) {
+    looplatency.max = elapsed;
+  }
+  if (elapsed > CONTROL_PERIOD * 1000) {
+    looplatency.overruns++;
+  }
+
+  bool sound = soundEngine.isBusy();
+  if (sound) {
+    looplatency.max_sound = max(looplatency.max_sound, elapsed);
+  } else if (looplatency.sound) {
+    DEBUG_PRINTF("loop latency during sound: max=%u us, overall max=%u us, "
+                 "overruns=%u\n",
+                 looplatency.max_sound, looplatency.max,
+                 looplatency.overruns);
+    looplatency.max_sound = 0;
+  }
+  looplatency.sound = sound;
+}
+
+void printLinks() {
+  char buffer[320];
+  links.describe(buffer, sizeof(buffer), millis());
+  Serial.print(buffer);
+  const tlsSessionStats &tls = net.getStats();
+  Serial.printf(
+      "tls full=%u resumed=%u fallbacks=%u failures=%u unsaved=%u\n",
+      tls.full, tls.resumed, tls.fallbacks, tls.failures, tls.unsaved);
+}
+
+void printOutbox() {
+  const outboxStats &stats = outbox.getStats();
+  Serial.printf(
+      "outbox pending=%u pushed=%u coalesced=%u dropped=%u published=%u "
+      "acked=%u retries=%u rejected=%u\n",
+      outbox.size(), stats.pushed, stats.coalesced, stats.dropped,
+      stats.published, stats.acked, stats.retries, stats.rejected);
+}
+
+void printClock() {
+  const clockState &state = discipline.getState();
+  const clockStats &stats = discipline.getStats();
+  Serial.printf(
+      "clock syncs=%u samples=%u spikes=%u steps=%u slews=%u offset=%lld us "
+      "delay=%lld us max=%lld us wake=%lld us\n",
+      stats.syncs, stats.samples, stats.spikes, stats.steps, stats.slews,
+      stats.last_offset, stats.last_delay, stats.max_offset,
+      stats.wake_correction);
+  Serial.printf(
+      "drift system=%.2f%s sleep=%.2f%s bm8563=%.2f%s ppm, poll=%u s\n",
+      state.system_ppm, state.valid & CLOCK_SYSTEM ? "" : "?",
+      state.sleep_ppm, state.valid & CLOCK_SLEEP ? "" : "?", state.rtc_ppm,
+      state.valid & CLOCK_RTC ? "" : "?", discipline.pollInterval());
+}
+
+void printInput() {
+  const inputStats &stats = input.getStats();
+  Serial.printf("input polls=%u fast=%u events=%u dropped=%u bounces=%u\n",
+                stats.polls, stats.fast_polls, stats.events,
+                input.getDropped(), stats.bounces);
+  Serial.printf("i2c transactions=%u bytes=%u busy=%llu us (%.2f%%)\n",
+                stats.transactions, stats.bus_bytes, stats.bus_us,
+                input.busUtilization(millis()));
+  char buffer[160];
+  input_latency.describe(buffer, sizeof(buffer));
+  Serial.print(buffer);
+}
+
+void printFrames() {
+  char buffer[160];
+  active_screen->getTiming().describe(buffer, sizeof(buffer));
+  int target = active_screen->getTarget();
+  Serial.printf("display %s target %u bytes, ", targetName(target),
+                static_cast<uint32_t>(targetMemory(
+                    target, M5.Lcd.width(), M5.Lcd.height(),
+                    SCREEN_BUFFERS)));
+  Serial.print(buffer);
+}
+
+void printLights() {
+  char buffer[96];
+  lights.describe(buffer, sizeof(buffer), millis());
+  Serial.print(buffer);
+  Serial.printf("lights dropped=%u\n", lights_commands.getDropped());
+}
+
+void handleSerial() {
+  // on demand dumps: 'm' - print metrics, 'r' - reset them
+  while (Serial.available() > 0) {
+    switch (Serial.read()) {
+      case 'm':
+        metrics.dump(&Serial);
+        powerManager.dump(&Serial);
+        Serial.printf(
+            "net wakeups=%u notified=%u shadow version=%u stale=%u "
+            "echoes=%u rejected=%u ui_full=%u\n",
+            netstats.wakeups, netstats.notified, shadow_version,
+            netstats.stale, netstats.echoes, netstats.rejected,
+            netstats.ui_full);
+        printLinks();
+        printOutbox();
+        printClock();
+        printInput();
+        printLights();
+        printFrames();
+        break;
+      case 'r':
+        metrics.reset();
+        input.reset(millis());
+        input_latency.reset();
+        // the engine belongs to lightsTask
+        set_lights({lightsCommand::Type::Reset, false, 0, 0});
+        active_screen->resetTiming();
+        Serial.println("metrics reset");
+        break;
+      default:
+        break;
+    }
+  }
+}
+
 void loop() {
-  main_ticker.update();
-  render_screen_ticker.update();
+  measureLoopLatency();
+  handleSerial();
+  processCommands();
+  serviceRtc();
+
+  updateControls();
+  if (renderScheduler.beginFrame()) {
+    input_latency.frameStart(micros());
+    render_screen();  // the transfer to the LCD goes on in the background
+  }
+  uint32_t shown_us;
+  while (active_screen->frameShown(&shown_us)) {
+    int events = input_latency.frameDone(shown_us);
+    for (int i = 0; i < events; i++) {
+      METRIC_RECORD(InputLatency, input_latency.latest(i));
+    }
+  }
   // hmi_read_ticker.update();
   // connect_AWS_ticker.update();
 
   active_screen->update();
+  soundEngine.update();
+
+  bool idle = !renderScheduler.isPending() && ui_commands.empty() &&
+              !active_screen->transferring() && !soundEngine.isBusy() &&
+              network_idle && M5.Touch.getCount() == 0 &&
+              !rtc_edge.active() && rtc_write_at == 0;
+  auto state = active_screen->pomodoro.getState();
+  if (powerManager.deepSleepDue(state, idle)) {
+    sleepThroughTimer();
+  }
+  if (powerManager.update(state, idle,
+                          active_screen->pomodoro.getDeadline())) {
+    looplatency.last = micros();  // sleeping is not loop latency
+  }
 }
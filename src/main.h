@@ -9,6 +9,11 @@ Copyright 2023 Sergei Chistokhin
 #ifndef _MAIN_H_
 #define _MAIN_H_
 
+#include <stdint.h>
+
+#include "./PomodoroTimer.h"
+
+#ifndef NATIVE
 #include <ESP32Time.h>
 #include <MQTTClient.h>
 
@@ -19,8 +24,20 @@ extern const int daylightOffset_sec;
 extern ESP32Time rtc;
 extern MQTTClient client;
 
+struct lightsCommand;
+
 extern void set_rtc();
-extern void report_state(String timer_state, u_int32_t start_time,
-                         bool reported = true, bool both = false);
+extern void clock_sleep();
+// hands the command to the lights task, see lights.h
+extern void set_lights(const lightsCommand &command);
+#endif  // NATIVE
+
+// application hooks used by the portable code, the native build provides
+// its own implementations in native/hooks.cpp
+extern void report_state(PomodoroTimer::PomodoroState timer_state,
+                         uint32_t start_time, bool reported = true,
+                         bool both = false);
+extern void allow_sleep(bool allow);
+extern void play_sound(const char *sound, int count);
 
 #endif  // _MAIN_H_
@@ -0,0 +1,123 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./metrics.h"
+
+#include <Arduino.h>
+
+Metrics metrics;
+
+int Histogram::bucket(uint32_t us) {
+  if (us < METRICS_SUB_BUCKETS) {
+    return us;
+  }
+  int msb = 31 - __builtin_clz(us);
+  int sub = (us >> (msb - 2)) & (METRICS_SUB_BUCKETS - 1);
+  return (msb - 1) * METRICS_SUB_BUCKETS + sub;
+}
+
+uint32_t Histogram::bucketMax(int index) {
+  if (index < METRICS_SUB_BUCKETS) {
+    return index;
+  }
+  int msb = index / METRICS_SUB_BUCKETS + 1;
+  int sub = index % METRICS_SUB_BUCKETS;
+  uint64_t low = static_cast<uint64_t>(METRICS_SUB_BUCKETS + sub) << (msb - 2);
+  uint64_t high = low + (1ull << (msb - 2)) - 1;
+  return high > UINT32_MAX ? UINT32_MAX : high;
+}
+
+void Histogram::add(uint32_t us) {
+  count++;
+  sum += us;
+  if (us < min) min = us;
+  if (us > max) max = us;
+  buckets[bucket(us)]++;
+}
+
+void Histogram::reset() { *this = Histogram(); }
+
+uint32_t Histogram::percentile(int p) const {
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = (static_cast<uint64_t>(count) * p + 99) / 100;
+  uint64_t seen = 0;
+  for (int i = 0; i < METRICS_BUCKETS; i++) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return bucketMax(i) < max ? bucketMax(i) : max;
+    }
+  }
+  return max;
+}
+
+const char* Metrics::name(Metric metric) {
+  switch (metric) {
+    case Metric::UpdateControls:
+      return "controls";
+    case Metric::Render:
+      return "render";
+    case Metric::PushBackBuffer:
+      return "push";
+    case Metric::LcdTransfer:
+      return "lcd_transfer";
+    case Metric::PngDecode:
+      return "png";
+    case Metric::NetworkTask:
+      return "net";
+    case Metric::ClientLoop:
+      return "mqtt_loop";
+    case Metric::SendReport:
+      return "report";
+    case Metric::ReportLatency:
+      return "report_latency";
+    case Metric::MessageHandler:
+      return "message";
+    case Metric::Sound:
+      return "sound";
+    case Metric::Loop:
+      return "loop";
+    case Metric::InputLatency:
+      return "input_latency";
+    case Metric::TlsConnect:
+      return "tls_connect";
+    default:
+      return "?";
+  }
+}
+
+void Metrics::reset() {
+  for (auto& histogram : histograms) {
+    histogram.reset();
+  }
+}
+
+void Metrics::dump(Print* out) const {
+  out->println("metric         count      min      avg      max      p99 (us)");
+  for (int i = 0; i < static_cast<int>(Metric::Count); i++) {
+    const Histogram& h = histograms[i];
+    out->printf("%-10s %9u %8u %8u %8u %8u\n", name(static_cast<Metric>(i)),
+                h.getCount(), h.getMin(), h.getAvg(), h.getMax(),
+                h.percentile(99));
+  }
+}
+
+size_t Metrics::toJson(char* buffer, size_t size) const {
+  // compact form: {"name":[count,min,avg,max,p99],...}
+  size_t len = snprintf(buffer, size, "{");
+  for (int i = 0; i < static_cast<int>(Metric::Count) && len < size; i++) {
+    const Histogram& h = histograms[i];
+    len += snprintf(buffer + len, size - len, "%s\"%s\":[%u,%u,%u,%u,%u]",
+                    i ? "," : "", name(static_cast<Metric>(i)), h.getCount(),
+                    h.getMin(), h.getAvg(), h.getMax(), h.percentile(99));
+  }
+  if (len < size) {
+    len += snprintf(buffer + len, size - len, "}");
+  }
+  return len < size ? len : 0;
+}
@@ -0,0 +1,100 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <Arduino.h>
+#include <stdint.h>
+
+// set to 0 to compile all timers out
+#define METRICS 1
+// publish metrics to METRICS_TOPIC every METRICS_INTERVAL seconds
+#define METRICS_MQTT 0
+#define METRICS_INTERVAL 300
+
+// histogram resolution: 4 buckets per power of two (25%) up to 2^32 us
+#define METRICS_SUB_BUCKETS 4
+#define METRICS_BUCKETS (31 * METRICS_SUB_BUCKETS)
+
+enum class Metric {
+  UpdateControls,
+  Render,
+  PushBackBuffer,
+  LcdTransfer,
+  PngDecode,
+  NetworkTask,
+  ClientLoop,
+  SendReport,
+  ReportLatency,
+  MessageHandler,
+  Sound,
+  Loop,
+  InputLatency,
+  TlsConnect,
+  Count
+};
+
+// fixed size log-linear histogram of durations in microseconds
+class Histogram {
+ public:
+  void add(uint32_t us);
+  void reset();
+  uint32_t getCount() const { return count; }
+  uint32_t getMin() const { return count ? min : 0; }
+  uint32_t getMax() const { return max; }
+  uint32_t getAvg() const { return count ? sum / count : 0; }
+  uint32_t percentile(int p) const;
+
+ private:
+  uint32_t count = 0;
+  uint32_t min = UINT32_MAX;
+  uint32_t max = 0;
+  uint64_t sum = 0;
+  uint32_t buckets[METRICS_BUCKETS] = {};
+
+  static int bucket(uint32_t us);
+  static uint32_t bucketMax(int index);
+};
+
+// every metric is written by a single task, readers may see a torn update
+// of a histogram which is acceptable for statistics
+class Metrics {
+ public:
+  void record(Metric metric, uint32_t us) {
+    histograms[static_cast<int>(metric)].add(us);
+  }
+  const Histogram& get(Metric metric) const {
+    return histograms[static_cast<int>(metric)];
+  }
+  void reset();
+  void dump(Print* out) const;
+  size_t toJson(char* buffer, size_t size) const;
+
+  static const char* name(Metric metric);
+
+ private:
+  Histogram histograms[static_cast<int>(Metric::Count)];
+};
+
+extern Metrics metrics;
+
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Metric metric) : metric(metric), start(micros()) {}
+  ~ScopedTimer() { metrics.record(metric, micros() - start); }
+
+ private:
+  Metric metric;
+  uint32_t start;
+};
+
+#if (METRICS == 1)
+#define METRIC_SCOPE(m) ScopedTimer metric_scope_(Metric::m)
+#define METRIC_RECORD(m, us) metrics.record(Metric::m, us)
+#else
+#define METRIC_SCOPE(m)
+#define METRIC_RECORD(m, us)
+#endif
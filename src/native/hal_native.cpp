@@ -0,0 +1,217 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./hal_native.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+VirtualClock virtualClock;
+DirFileSystem dirFileSystem;
+NullLedStrip nullLedStrip;
+LoopbackMqtt loopbackMqtt;
+
+namespace hal {
+
+Clock& clock() { return virtualClock; }
+FileSystem& fs() { return dirFileSystem; }
+LedStrip& leds() { return nullLedStrip; }
+MqttTransport& mqtt() { return loopbackMqtt; }
+
+}  // namespace hal
+
+int32_t DirFileSystem::size(const char* path) {
+  FILE* file = fopen((root + path).c_str(), "rb");
+  if (file == nullptr) {
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  int32_t size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+size_t DirFileSystem::read(const char* path, size_t offset, uint8_t* buffer,
+                           size_t length) {
+  FILE* file = fopen((root + path).c_str(), "rb");
+  if (file == nullptr) {
+    return 0;
+  }
+  size_t read = fseek(file, offset, SEEK_SET) == 0
+                    ? fread(buffer, 1, length, file)
+                    : 0;
+  fclose(file);
+  return read;
+}
+
+bool LoopbackMqtt::publish(const char* topic, const char* payload,
+                           int qos) {
+  if (!online) {
+    return false;
+  }
+  published++;
+  published_bytes += strlen(topic) + strlen(payload);
+  inject(topic, payload);
+  return true;
+}
+
+bool LoopbackMqtt::subscribe(const char* topic) {
+  subscriptions.emplace_back(topic);
+  return online;
+}
+
+void LoopbackMqtt::inject(const char* topic, const char* payload) {
+  if (std::find(subscriptions.begin(), subscriptions.end(), topic) !=
+      subscriptions.end()) {
+    inbox.emplace_back(topic, payload);
+  }
+}
+
+void LoopbackMqtt::loop() {
+  while (online && !inbox.empty()) {
+    auto message = inbox.front();
+    inbox.pop_front();
+    if (message_handler != nullptr) {
+      message_handler(message.first.c_str(), message.second.c_str(),
+                      message.second.size());
+    }
+  }
+}
+
+void Framebuffer::fillRect(int x, int y, int w, int h, uint16_t color) {
+  for (int row = y; row < y + h; row++) {
+    std::fill_n(&pixels[row * width + x], w, color);
+  }
+}
+
+size_t Framebuffer::push(const Framebuffer& src, int x, int y, int w, int h) {
+  for (int row = y; row < y + h; row++) {
+    memcpy(&pixels[row * width + x], &src.pixels[row * src.width + x],
+           w * sizeof(uint16_t));
+  }
+  return w * h * sizeof(uint16_t);
+}
+
+void Framebuffer::blit(const Framebuffer& src, int src_x, int src_y, int w,
+                       int h, int x, int y, uint16_t transparent) {
+  for (int row = 0; row < h; row++) {
+    const uint16_t* from = &src.pixels[(src_y + row) * src.width + src_x];
+    uint16_t* to = &pixels[(y + row) * width + x];
+    for (int column = 0; column < w; column++) {
+      if (from[column] != transparent) {
+        to[column] = from[column];
+      }
+    }
+  }
+}
+
+static uint32_t bigEndian(const uint8_t* bytes) {
+  return (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+static uint8_t paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return a;
+  }
+  return pb <= pc ? b : c;
+}
+
+bool Framebuffer::drawPng(const char* path, int x, int y) {
+  int32_t size = hal::fs().size(path);
+  if (size < 33) {
+    return false;
+  }
+  std::vector<uint8_t> file(size);
+  if (hal::fs().read(path, 0, file.data(), size) != file.size() ||
+      memcmp(&file[12], "IHDR", 4) != 0) {
+    return false;
+  }
+  int w = bigEndian(&file[16]);
+  int h = bigEndian(&file[20]);
+  int channels = file[25] == 6 ? 4 : file[25] == 2 ? 3 : 0;
+  if (file[24] != 8 || channels == 0 || file[28] != 0) {
+    return false;
+  }
+
+  std::vector<uint8_t> compressed;
+  for (size_t at = 8; at + 12 <= file.size();) {
+    size_t length = bigEndian(&file[at]);
+    if (at + 12 + length > file.size()) {
+      return false;
+    }
+    if (memcmp(&file[at + 4], "IDAT", 4) == 0) {
+      compressed.insert(compressed.end(), &file[at + 8],
+                        &file[at + 8] + length);
+    }
+    at += 12 + length;
+  }
+  size_t stride = w * channels;
+  std::vector<uint8_t> raw(h * (stride + 1));
+  uLongf raw_size = raw.size();
+  if (uncompress(raw.data(), &raw_size, compressed.data(),
+                 compressed.size()) != Z_OK ||
+      raw_size != raw.size()) {
+    return false;
+  }
+
+  // undo the row filters in place, a row refers to the one above it
+  for (int row = 0; row < h; row++) {
+    uint8_t* line = &raw[row * (stride + 1) + 1];
+    const uint8_t* above = row > 0 ? line - (stride + 1) : nullptr;
+    for (size_t i = 0; i < stride; i++) {
+      int a = i >= static_cast<size_t>(channels) ? line[i - channels] : 0;
+      int b = above != nullptr ? above[i] : 0;
+      int c = above != nullptr && i >= static_cast<size_t>(channels)
+                  ? above[i - channels]
+                  : 0;
+      switch (line[-1]) {
+        case 1:
+          line[i] += a;
+          break;
+        case 2:
+          line[i] += b;
+          break;
+        case 3:
+          line[i] += (a + b) / 2;
+          break;
+        case 4:
+          line[i] += paeth(a, b, c);
+          break;
+      }
+    }
+  }
+
+  for (int row = std::max(0, -y); row < h && y + row < height; row++) {
+    const uint8_t* from = &raw[row * (stride + 1) + 1];
+    uint16_t* to = &pixels[(y + row) * width];
+    for (int column = std::max(0, -x); column < w && x + column < width;
+         column++) {
+      const uint8_t* rgba = &from[column * channels];
+      int alpha = channels == 4 ? rgba[3] : 255;
+      if (alpha == 0) {
+        continue;
+      }
+      uint16_t& pixel = to[x + column];
+      int r = rgba[0], g = rgba[1], b = rgba[2];
+      if (alpha < 255) {
+        r = (r * alpha + ((pixel >> 8) & 0xF8) * (255 - alpha)) / 255;
+        g = (g * alpha + ((pixel >> 3) & 0xFC) * (255 - alpha)) / 255;
+        b = (b * alpha + ((pixel << 3) & 0xF8) * (255 - alpha)) / 255;
+      }
+      pixel = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+    }
+  }
+  return true;
+}
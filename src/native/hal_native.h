@@ -0,0 +1,123 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../hal.h"
+
+// Linux stand-ins for the hardware interfaces, used by the native build
+
+class VirtualClock : public hal::Clock {
+ public:
+  uint32_t epoch() override { return wall_us / 1000000; }
+  uint32_t subsecondMicros() override { return wall_us % 1000000; }
+  uint32_t millis() override { return mono_us / 1000; }
+  uint32_t micros() override { return mono_us; }
+  uint64_t monotonicMicros() override { return mono_us; }
+
+  void setEpoch(uint32_t epoch) { wall_us = epoch * 1000000ull; }
+  void step(int64_t us) { wall_us += us; }  // wall clock only, like NTP
+  void advance(uint64_t us) {
+    wall_us += us;
+    mono_us += us;
+  }
+
+ private:
+  uint64_t wall_us = 1700000000ull * 1000000;
+  uint64_t mono_us = 0;
+};
+
+// files are read from a directory on the host, "data" by default
+class DirFileSystem : public hal::FileSystem {
+ public:
+  explicit DirFileSystem(const std::string& root = "data") : root(root) {}
+  int32_t size(const char* path) override;
+  size_t read(const char* path, size_t offset, uint8_t* buffer,
+              size_t length) override;
+
+ private:
+  std::string root;
+};
+
+class NullLedStrip : public hal::LedStrip {
+ public:
+  void show(const uint32_t* colors, int count) override {
+    frame.assign(colors, colors + count);
+    shows++;
+  }
+
+  std::vector<uint32_t> frame;
+  uint32_t shows = 0;
+};
+
+// delivers published messages back to the subscribers on loop(), incoming
+// shadow documents can be simulated with inject()
+class LoopbackMqtt : public hal::MqttTransport {
+ public:
+  bool connected() override { return online; }
+  bool publish(const char* topic, const char* payload,
+               int qos = 0) override;
+  bool subscribe(const char* topic) override;
+  void onMessage(Handler handler) override { message_handler = handler; }
+  void loop() override;
+
+  void inject(const char* topic, const char* payload);
+
+  bool online = true;
+  uint32_t published = 0;
+  uint64_t published_bytes = 0;
+
+ private:
+  Handler message_handler = nullptr;
+  std::vector<std::string> subscriptions;
+  std::deque<std::pair<std::string, std::string>> inbox;
+};
+
+#define SCREEN_WIDTH 320  // the Core2 LCD
+#define SCREEN_HEIGHT 240
+
+// RGB565 frame buffer standing in for the LCD
+class Framebuffer {
+ public:
+  Framebuffer(int width, int height)
+      : width(width), height(height), pixels(width * height) {}
+
+  void fillRect(int x, int y, int w, int h, uint16_t color);
+  // copies a region of src to the same position, returns bytes transferred
+  size_t push(const Framebuffer& src, int x, int y, int w, int h);
+  // copies w x h from (src_x, src_y) of src to (x, y), skipping transparent
+  void blit(const Framebuffer& src, int src_x, int src_y, int w, int h, int x,
+            int y, uint16_t transparent);
+  // decodes the PNG at path on hal::fs() to (x, y), clipped, blending by its
+  // alpha like drawPngFile of LovyanGFX. Only 8 bit RGB and RGBA without
+  // interlacing, what data/ has; false for anything else.
+  bool drawPng(const char* path, int x, int y);
+
+  const int width;
+  const int height;
+
+ private:
+  std::vector<uint16_t> pixels;
+};
+
+extern VirtualClock virtualClock;
+extern DirFileSystem dirFileSystem;
+extern NullLedStrip nullLedStrip;
+extern LoopbackMqtt loopbackMqtt;
+
+// native/hooks.cpp: the hooks of main.h count what they were asked for
+extern uint32_t sounds_played;
+extern uint32_t reports;
+// heap allocations since the start, operator new and the malloc family
+uint32_t heapAllocations();
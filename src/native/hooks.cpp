@@ -0,0 +1,75 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+Application hooks of main.h for the native build and the heap allocation
+counter, shared by the benchmarks and the tests.
+
+**/
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+#include "../main.h"
+#include "../shadow.h"
+#include "./hal_native.h"
+
+uint32_t sounds_played = 0;
+uint32_t reports = 0;
+
+// operator new plus the malloc family, the latter through -Wl,--wrap in the
+// native build flags
+static std::atomic<uint32_t> allocations{0};
+
+uint32_t heapAllocations() { return allocations; }
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+  allocations++;
+  return __real_malloc(size);
+}
+void* __wrap_calloc(size_t count, size_t size) {
+  allocations++;
+  return __real_calloc(count, size);
+}
+void* __wrap_realloc(void* ptr, size_t size) {
+  allocations++;
+  return __real_realloc(ptr, size);
+}
+}
+
+void* operator new(size_t size) {
+  allocations++;
+  void* ptr = __real_malloc(size ? size : 1);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+// noinline keeps gcc from pairing the inlined free() with operator new
+__attribute__((noinline)) void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+__attribute__((noinline)) void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void report_state(PomodoroTimer::PomodoroState timer_state,
+                  uint32_t start_time, bool reported, bool both) {
+  char buffer[512];
+  shadowEncodeReport(buffer, sizeof(buffer), timer_state, start_time, "",
+                     reported || both, !reported || both);
+  hal::mqtt().publish(topics.update, buffer);
+  reports++;
+}
+
+void allow_sleep(bool allow) {}
+
+void play_sound(const char* sound, int count) { sounds_played += count; }
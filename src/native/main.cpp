@@ -0,0 +1,914 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+Native build entry point: runs the portable firmware logic against the
+Linux stand-ins and prints a small benchmark report. The checks that fail
+the build are in test/test_native, the unit test build leaves this out.
+The report exits non-zero when the latency replay is over its budget.
+
+  program replay <trace> [p95 budget, us]
+feeds an input trace (INPUT_TRACE in input.h prints them on the device)
+through the input pipeline, the UI and the frame composition, and reports
+the input to photon latency. Fails if the 95th percentile is over budget.
+
+**/
+
+#ifndef PIO_UNIT_TESTING
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../PomodoroTimer.h"
+#include "../adpcm.h"
+#include "../command_queue.h"
+#include "../connection.h"
+#include "../discipline.h"
+#include "../frametime.h"
+#include "../glyphs.h"
+#include "../input.h"
+#include "../latency.h"
+#include "../lights.h"
+#include "../main.h"
+#include "../outbox.h"
+#include "../png.h"
+#include "../resume.h"
+#include "../scheduler.h"
+#include "../shadow.h"
+#include "../target.h"
+#include "./hal_native.h"
+#include "./replay.h"
+
+#define THINGNAME "native"
+
+class Bench {
+ public:
+  explicit Bench(const char* name) : name(name) {}
+  template <typename F>
+  void run(uint32_t iterations, F body) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+      body(i);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double ns =
+        std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    printf("%-24s %10u x %10.1f ns\n", name, iterations, ns);
+  }
+
+ private:
+  const char* name;
+};
+
+static void benchTimer() {
+  // 25 minute pomodoro followed by the rest, polled every 10 ms like loop()
+  const uint32_t step_us = 10000;
+  const uint32_t steps = (25 + 5) * 60 * 100 + 100;
+
+  PomodoroTimer pomodoro;
+  pomodoro.startTimer(true, false, true);
+  auto last_state = pomodoro.getState();
+  renderScheduler.setCountdown(true);
+  renderScheduler.request(RenderScheduler::Reason::State);
+
+  Bench("timer update").run(steps, [&](uint32_t) {
+    virtualClock.advance(step_us);
+    pomodoro.update();
+    auto state = pomodoro.getState();
+    if (state != last_state) {
+      last_state = state;
+      renderScheduler.setCountdown(
+          state == PomodoroTimer::PomodoroState::POMODORO ||
+          state == PomodoroTimer::PomodoroState::REST);
+      renderScheduler.request(RenderScheduler::Reason::State);
+    }
+    renderScheduler.beginFrame();
+  });
+  printf("  frames=%u reports=%u sounds=%u state=%d\n",
+         renderScheduler.getFrames(), reports, sounds_played,
+         static_cast<int>(pomodoro.getState()));
+}
+
+static void benchDeadline() {
+  // session end error on the virtual clock, polled like the awake loop()
+  // and sleeping to the second edges like PowerManager, with an NTP step of
+  // the wall clock in the middle of the session. test_timer_deadline
+  // checks the error and the steps of the countdown.
+  const uint32_t length = PomodoroTimer::toInt(
+                              PomodoroTimer::PomodoroLength::SMALL) * 60;
+  int64_t errors[2] = {0, 0};
+  uint32_t random = 2463534242u;
+
+  Bench("timer deadline").run(2, [&](uint32_t sleeping) {
+    PomodoroTimer pomodoro;
+    virtualClock.advance(123457);  // off the second edge
+    uint64_t wall = virtualClock.epoch() * 1000000ull +
+                    virtualClock.subsecondMicros();
+    uint64_t expected = virtualClock.monotonicMicros() +
+                        (virtualClock.epoch() + length) * 1000000ull - wall;
+    pomodoro.startTimer(true, false, false);
+    bool stepped = false;
+
+    while (pomodoro.getState() == PomodoroTimer::PomodoroState::POMODORO) {
+      uint64_t now = virtualClock.monotonicMicros();
+      uint64_t us;
+      if (sleeping) {
+        us = 1000000 - virtualClock.subsecondMicros() + 2000;
+        uint64_t deadline = pomodoro.getDeadline();
+        if (deadline < now + us) {
+          us = deadline > now ? deadline - now : 1;
+        }
+      } else {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        us = 1000 + random % 8000;  // 1 - 9 ms
+      }
+      virtualClock.advance(us);
+      if (!stepped && pomodoro.getRemainingTime() < length / 2) {
+        virtualClock.step(3000000);  // NTP found the RTC 3 s behind
+        pomodoro.shift(3);
+        stepped = true;
+      }
+      pomodoro.update();
+    }
+    errors[sleeping] = virtualClock.monotonicMicros() - expected;
+  });
+  printf("  end error: polled=%lld us sleeping=%lld us\n",
+         static_cast<long long>(errors[0]), static_cast<long long>(errors[1]));
+}
+
+static void benchShadow() {
+  char buffer[512];
+  uint32_t before = heapAllocations();
+  Bench("shadow encode").run(100000, [&](uint32_t i) {
+    shadowEncodeReport(buffer, sizeof(buffer),
+                       PomodoroTimer::PomodoroState::POMODORO,
+                       1700000000 + i, "write the report", true, true);
+  });
+  printf("  allocations=%u\n", heapAllocations() - before);
+
+  // full get/accepted document, only state.desired passes the filter
+  const char* document =
+      "{\"state\":{\"desired\":{\"timer_state\":\"POMODORO\","
+      "\"start\":1700000000,\"description\":\"write the report\"},"
+      "\"reported\":{\"timer_state\":\"REST\",\"start\":1699999000,"
+      "\"description\":\"previous task\"}},\"metadata\":{\"desired\":"
+      "{\"timer_state\":{\"timestamp\":1700000000}}},"
+      "\"version\":42,\"timestamp\":1700000001}";
+  size_t length = strlen(document);
+  shadowDesired desired;
+  before = heapAllocations();
+  Bench("shadow decode").run(100000, [&](uint32_t) {
+    shadowDecodeDesired(document, length, &desired);
+  });
+  printf("  allocations=%u timer_state=%s start=%u description=%s "
+         "version=%u\n",
+         heapAllocations() - before, shadowStateName(desired.timer_state),
+         desired.start, desired.description, desired.version);
+
+  // update/delta after the Lambda moved the start, the rest is unchanged
+  const char* delta =
+      "{\"version\":43,\"timestamp\":1700000100,\"state\":"
+      "{\"start\":1700000060},\"metadata\":{\"start\":"
+      "{\"timestamp\":1700000100}}}";
+  length = strlen(delta);
+  Bench("shadow delta decode").run(100000, [&](uint32_t) {
+    shadowDecodeDelta(delta, length, &desired);
+  });
+  printf("  timer_state=%s start=%u version=%u updated=%u\n",
+         desired.has_timer_state ? "set" : "unchanged", desired.start,
+         desired.version, desired.updated);
+}
+
+static void benchSound() {
+  int32_t size = hal::fs().size(DING_SOUND);
+  if (size <= static_cast<int32_t>(sizeof(imaHeader))) {
+    printf("%-24s skipped, run scripts/soundbank.py first\n", "adpcm decode");
+    return;
+  }
+  std::vector<uint8_t> data(size);
+  hal::fs().read(DING_SOUND, 0, data.data(), size);
+  const imaHeader* header = reinterpret_cast<const imaHeader*>(data.data());
+  size_t bytes = size - sizeof(imaHeader);
+  std::vector<int16_t> pcm(bytes * 2);
+
+  Bench("adpcm decode (sound)").run(100, [&](uint32_t) {
+    adpcmState state = {header->predictor, header->index};
+    adpcmDecode(data.data() + sizeof(imaHeader), bytes, pcm.data(), &state);
+  });
+  printf("  %u samples @ %u Hz\n", header->samples, header->sample_rate);
+}
+
+static void benchFrame() {
+  // what a full frame and a countdown second send to the LCD, with a memory
+  // copy standing in for the transfer. screen.cpp draws with LovyanGFX and
+  // doesn't build here, so this is no measure of the renderer itself.
+  Framebuffer back_buffer(SCREEN_WIDTH, SCREEN_HEIGHT);
+  Framebuffer lcd(SCREEN_WIDTH, SCREEN_HEIGHT);
+  size_t bytes = 0;
+
+  Bench("lcd model full push").run(1000, [&](uint32_t i) {
+    back_buffer.fillRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, i);
+    bytes = lcd.push(back_buffer, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+  });
+  printf("  %zu bytes/frame\n", bytes);
+
+  // countdown second: timer digits and progress bar regions
+  Bench("lcd model damaged push").run(1000, [&](uint32_t i) {
+    back_buffer.fillRect(0, 72, SCREEN_WIDTH, 96, i);
+    back_buffer.fillRect(0, 200, SCREEN_WIDTH, 40, i);
+    bytes = lcd.push(back_buffer, 0, 72, SCREEN_WIDTH, 96) +
+            lcd.push(back_buffer, 0, 200, SCREEN_WIDTH, 40);
+  });
+  printf("  %zu bytes/frame\n", bytes);
+}
+
+static void benchAssets() {
+  // the images of a frame, decoded into the back buffer every frame as
+  // drawPngFile did, then once into a buffer of their own that is blitted,
+  // what AssetCache does with its sprites
+  static const char* const assets[] = {"/background1.png", "/WIFI.png",
+                                       "/MQTT.png"};
+  const uint16_t transparent = 0x0120;
+  Framebuffer back_buffer(SCREEN_WIDTH, SCREEN_HEIGHT);
+  for (const char* path : assets) {
+    int32_t width, height;
+    if (!pngSize(path, &width, &height) ||
+        !back_buffer.drawPng(path, 0, 0)) {
+      printf("%-24s skipped, can't decode %s\n", "png", path);
+      continue;
+    }
+    std::string name = std::string("decode ") + (path + 1);
+    Bench(name.c_str()).run(100, [&](uint32_t) {
+      back_buffer.drawPng(path, 0, 0);
+    });
+
+    Framebuffer cached(width, height);
+    cached.fillRect(0, 0, width, height, transparent);
+    cached.drawPng(path, 0, 0);
+    name = std::string("cached ") + (path + 1);
+    Bench(name.c_str()).run(10000, [&](uint32_t) {
+      back_buffer.blit(cached, 0, 0, std::min(width, SCREEN_WIDTH),
+                       std::min(height, SCREEN_HEIGHT), 0, 0, transparent);
+    });
+    printf("  %dx%d\n", width, height);
+  }
+}
+
+// the countdown text as it was formatted before the glyph atlas
+static std::string streamTime(const PomodoroTimer& pomodoro) {
+  uint32_t remaining = pomodoro.getRemainingTime();
+  std::stringstream ss;
+  ss << std::setw(2) << std::setfill('0') << remaining / 60 << ":"
+     << std::setw(2) << std::setfill('0') << remaining % 60;
+  return ss.str();
+}
+
+static void benchGlyphs() {
+  // the per frame work of the countdown that doesn't depend on the LCD:
+  // formatting, then composing the digits from a Font7 x2 sized sheet
+  const uint16_t transparent = 0x0120;
+  const uint16_t green = 0x07E0;
+  glyphMetrics metrics;
+  metrics.height = 96;
+  for (int i = 0; i < GLYPH_COUNT; i++) {
+    metrics.width[i] = GLYPH_CHARSET[i] == ':' ? 24 : 64;
+  }
+  int32_t sheet_width = glyphArrange(&metrics);
+  Framebuffer sheet(sheet_width, metrics.height);
+  sheet.fillRect(0, 0, sheet_width, metrics.height, transparent);
+  for (int i = 0; i < GLYPH_COUNT; i++) {
+    // a segment per glyph is enough to exercise the transparent key
+    sheet.fillRect(metrics.x[i] + 8, 8, metrics.width[i] - 16, 12, green);
+  }
+  Framebuffer back_buffer(SCREEN_WIDTH, SCREEN_HEIGHT);
+
+  PomodoroTimer pomodoro;
+  pomodoro.startTimer(true, false, false);
+  size_t length = 0;
+  uint32_t before = heapAllocations();
+  Bench("timer text stringstream").run(100000, [&](uint32_t) {
+    length += streamTime(pomodoro).size();
+  });
+  uint32_t stream_allocations = heapAllocations() - before;
+  before = heapAllocations();
+  char text[TIMER_TEXT_SIZE];
+  Bench("timer text formatTime").run(100000, [&](uint32_t) {
+    length += pomodoro.formatTime(text);
+  });
+  uint32_t format_allocations = heapAllocations() - before;
+  printf("  allocations/frame stringstream=%.1f formatTime=%.1f\n",
+         stream_allocations / 100000.0, format_allocations / 100000.0);
+
+  glyphCell cells[GLYPH_TEXT_LENGTH];
+  int count = 0;
+  before = heapAllocations();
+  Bench("timer glyph compose").run(10000, [&](uint32_t i) {
+    virtualClock.advance(1000000);
+    pomodoro.formatTime(text);
+    count = glyphLayout(metrics, text, SCREEN_WIDTH / 2, cells,
+                        GLYPH_TEXT_LENGTH);
+    int32_t top = SCREEN_HEIGHT / 2 - metrics.height / 2;
+    back_buffer.fillRect(0, top, SCREEN_WIDTH, metrics.height, 0);
+    for (int cell = 0; cell < count; cell++) {
+      back_buffer.blit(sheet, cells[cell].sheet_x, 0, cells[cell].width,
+                       metrics.height, cells[cell].x, top, transparent);
+    }
+  });
+  printf("  %d glyphs, sheet %dx%d, allocations=%u\n", count, sheet_width,
+         metrics.height, heapAllocations() - before);
+}
+
+static void benchInput() {
+  // a minute in 1 ms steps: idle, then three chattering presses of HMI
+  // button 1, a turn of the encoder, a tap, a flick and a hold, idle again.
+  // The bus time is the wire time at 100 kHz of the three library reads the
+  // firmware does per poll without the burst, adaptive against every 10 ms
+  // before.
+  const uint32_t read_bytes = 3 * 3 + 4 + 2;
+  const uint32_t read_us = read_bytes * 9 * 1000000 / 100000;
+  const uint32_t presses[] = {10000, 11000, 12500};
+  InputPipeline input;
+  input.reset(0);
+  uint32_t detect_max = 0, detect_sum = 0;
+  uint32_t pressed_at = 0;
+  int32_t encoder = 0;  // counts the unit holds until it is read
+
+  Bench("input poll").run(60000, [&](uint32_t now) {
+    inputSample sample;
+    for (uint32_t start : presses) {
+      // 15 ms of contact chatter, then held for 200 ms
+      if (now >= start && now < start + 215 &&
+          (now >= start + 15 || (now - start) % 6 < 3)) {
+        sample.buttons |= 1 << static_cast<int>(InputButton::Hmi1);
+        pressed_at = start;
+      }
+    }
+    bool touch = false;
+    if (now >= 20000 && now < 20080) {  // tap
+      touch = true;
+      sample.touch_x = 100;
+    } else if (now >= 22000 && now < 22150) {  // flick to the right
+      touch = true;
+      sample.touch_x = 100 + (now - 22000);
+    } else if (now >= 24000 && now < 25000) {  // hold
+      touch = true;
+      sample.touch_x = 100;
+    }
+    sample.touch = touch;
+    sample.touch_y = 120;
+    if (now >= 15000 && now < 16000 && now % 50 == 0) {
+      encoder++;  // a slow turn, 20 counts
+    }
+    if (!input.due(now, touch)) {
+      return;
+    }
+    sample.increment = encoder;
+    encoder = 0;
+    input.sample(now, now * 1000, sample);
+    input.busy(read_us, read_bytes, 3);
+    inputEvent event;
+    while (input.pop(&event)) {
+      if (event.type == inputEvent::Type::Press) {
+        uint32_t detect = event.at_us / 1000 - pressed_at;
+        detect_max = detect > detect_max ? detect : detect_max;
+        detect_sum += detect;
+      }
+    }
+  });
+
+  const inputStats& stats = input.getStats();
+  printf("  polls=%u fast=%u (%u at a fixed 10 ms) detect avg=%u max=%u ms\n",
+         stats.polls, stats.fast_polls, 60000 / INPUT_POLL_FAST,
+         detect_sum / 3, detect_max);
+  printf("  bus %.2f%% (%.2f%% before)\n", input.busUtilization(60000),
+         read_us * 100.0f / (INPUT_POLL_FAST * 1000));
+}
+
+static void benchLights() {
+  // test_lights checks the effect math and the dithering
+  // ten minutes of a session with the UI sending the remaining time on
+  // every render, a flash at each end. The strip was shown on every render
+  // before, once a second plus the state changes.
+  LedEngine session;
+  session.reset(0);
+  nullLedStrip.shows = 0;
+  int last_permille = -1;
+  uint32_t focus_pushes = 0;
+  Bench("lights").run(600000, [&](uint32_t now) {
+    bool resting = now >= 300000;
+    if (now == 300000) {
+      focus_pushes = session.getStats().pushes;
+    }
+    if (now == 0 || now == 300000) {
+      session.apply(now, {lightsCommand::Type::Flash, false, 0,
+                          resting ? 0x008000u : 0xFF0000u});
+    }
+    int permille = 1000 - (now % 300000) / 300;
+    if (now % 1000 == 0 && permille != last_permille) {
+      last_permille = permille;
+      session.apply(now, {lightsCommand::Type::Progress, resting,
+                          static_cast<uint16_t>(permille),
+                          resting ? 0x008000u : 0xFF0000u});
+    }
+    if (session.nextFrame(now) == 0) {
+      session.update(now);
+    }
+  });
+  const lightsStats& stats = session.getStats();
+  printf("  frames=%u pushes=%u skipped=%u shows=%u\n", stats.frames,
+         stats.pushes, stats.skipped, nullLedStrip.shows);
+  printf("  %u updates/min, pomodoro %u rest %u (60 before)\n",
+         session.pushesPerMinute(600000), focus_pushes / 5,
+         (stats.pushes - focus_pushes) / 5);
+}
+
+static int replayReport(const char* trace, uint32_t budget) {
+  LatencyTracker latency;
+  uint32_t frames = 0;
+  Bench("latency replay").run(1, [&](uint32_t) {
+    replay(trace, &latency, &frames);
+  });
+  char buffer[160];
+  latency.describe(buffer, sizeof(buffer));
+  bool within = latency.percentile(95) <= budget;
+  printf("  frames=%u %s  p95 %u us, budget %u us %s\n", frames, buffer,
+         latency.percentile(95), budget, within ? "ok" : "FAIL");
+  return within ? 0 : 1;
+}
+
+static int benchLatency() { return replayReport(replay_trace, REPLAY_BUDGET); }
+
+static void benchPipeline() {
+  // back to back full frames, drawn in the given time and sent at
+  // REPLAY_LCD_SPI. With one buffer drawing waits for the transfer, with two
+  // the next frame is drawn while the last one is sent.
+  const uint32_t bytes = SCREEN_WIDTH * SCREEN_HEIGHT * 2;
+  const uint32_t transfer = bytes * 8ull * 1000000 / REPLAY_LCD_SPI;
+  const uint32_t frames = 100;
+  const uint32_t draws[] = {5000, 15000, 30000, 45000};
+  const int cases = sizeof(draws) / sizeof(draws[0]);
+  uint32_t period[cases][2];
+  float overlap[cases][2];
+
+  Bench("frame pipeline").run(1, [&](uint32_t) {
+    for (int c = 0; c < cases; c++) {
+      for (int buffers = 1; buffers <= 2; buffers++) {
+        FrameTiming timing;
+        uint32_t now = 0, transfer_end = 0;
+        bool in_flight = false;
+        auto finish = [&]() {
+          if (!in_flight) {
+            return;
+          }
+          uint32_t waited = transfer_end > now ? transfer_end - now : 0;
+          now += waited;
+          timing.waited(waited);
+          timing.done(transfer_end);
+          in_flight = false;
+        };
+        for (uint32_t i = 0; i < frames; i++) {
+          if (buffers == 1) {
+            finish();  // the only buffer is still being sent
+          }
+          now += draws[c];
+          timing.drawn(draws[c]);
+          finish();  // the LCD takes one transfer at a time
+          timing.started(now, 0, bytes);
+          transfer_end = now + transfer;
+          in_flight = true;
+          timing.frameEnd();
+        }
+        if (buffers == 1) {
+          finish();
+        } else {
+          timing.done(transfer_end);  // polled, nothing waits for it
+        }
+        period[c][buffers - 1] = std::max(now, transfer_end) / frames;
+        overlap[c][buffers - 1] = timing.overlap();
+      }
+    }
+  });
+
+  // test_frame_pipeline checks the periods and the overlap
+  for (int c = 0; c < cases; c++) {
+    uint32_t draw = draws[c];
+    printf("  draw %5u us: %5u -> %5u us/frame (%4.1f -> %4.1f fps), "
+           "overlap %5.1f%%\n",
+           draw, period[c][0], period[c][1], 1e6f / period[c][0],
+           1e6f / period[c][1], overlap[c][1]);
+  }
+  printf("  transfer %u us, %u bytes\n", transfer, bytes);
+}
+
+static void benchTargets() {
+  // the countdown screen drawn into each render target and pushed to an
+  // LCD model: every frame in full, then a countdown second (digits,
+  // progress bar, status icons). The colors are exact in RGB332, so the LCD
+  // has to end up the same whatever the target.
+  struct box {
+    int16_t x, y, w, h;
+    uint16_t color;
+  };
+  const int width = SCREEN_WIDTH, height = SCREEN_HEIGHT;
+  const box regions[] = {
+      {0, 72, width, 96, 0}, {0, 200, width, 40, 0}, {240, 0, 80, 24, 0}};
+  const int region_count = sizeof(regions) / sizeof(regions[0]);
+  // the boxes of frame i, black regions first
+  auto scene = [&](uint32_t i, box* boxes) {
+    int count = 0;
+    for (const box& region : regions) {
+      boxes[count++] = region;
+    }
+    for (int d = 0; d < 4; d++) {
+      int16_t x = 16 + d * 76 + (i + d) % 3 * 8;
+      boxes[count++] = {x, 80, 48, 80, 0x07E0};
+    }
+    boxes[count++] = {0, 200, static_cast<int16_t>(i % width), 40, 0x001F};
+    boxes[count++] = {244, 4, 48, 16, 0xF800};
+    boxes[count++] = {296, 4, static_cast<int16_t>(4 + i % 20), 16, 0xFFFF};
+    return count;
+  };
+  const int max_boxes = region_count + 7;
+
+  std::vector<uint16_t> lcd[3];
+  size_t bytes[3][2];
+  for (int target = 0; target < 3; target++) {
+    lcd[target].assign(width * height, 0);
+    uint16_t* screen = lcd[target].data();
+    std::vector<uint16_t> full565(target == SCREEN_TARGET_RGB565
+                                      ? width * height : 0);
+    std::vector<uint8_t> full332(target == SCREEN_TARGET_RGB332
+                                     ? width * height : 0);
+    std::vector<uint16_t> band(width * SCREEN_BAND_HEIGHT);
+
+    // boxes clipped to rows [top, bottom), into buffer rows from top
+    auto fill = [&](const box* boxes, int count, int top, int bottom) {
+      for (int b = 0; b < count; b++) {
+        const box& r = boxes[b];
+        int y0 = std::max<int>(r.y, top);
+        int y1 = std::min<int>(r.y + r.h, bottom);
+        for (int y = y0; y < y1; y++) {
+          int row = (y - top) * width + r.x;
+          if (target == SCREEN_TARGET_RGB332) {
+            std::fill_n(&full332[row], r.w, targetColor332(r.color));
+          } else if (target == SCREEN_TARGET_RGB565) {
+            std::fill_n(&full565[row], r.w, r.color);
+          } else {
+            std::fill_n(&band[row], r.w, r.color);
+          }
+        }
+      }
+    };
+    auto push = [&](int x, int y, int w, int h, int top) {
+      for (int row = y; row < y + h; row++) {
+        uint16_t* to = screen + row * width + x;
+        int from = (row - top) * width + x;
+        for (int px = 0; px < w; px++) {
+          if (target == SCREEN_TARGET_RGB332) {
+            to[px] = targetColor565(full332[from + px]);  // on the push
+          } else if (target == SCREEN_TARGET_RGB565) {
+            to[px] = full565[from + px];
+          } else {
+            to[px] = band[from + px];
+          }
+        }
+      }
+      return static_cast<size_t>(w) * h * 2;
+    };
+    auto frame = [&](uint32_t i, bool full) {
+      box boxes[max_boxes];
+      int count = scene(i, boxes);
+      size_t sent = 0;
+      if (target != SCREEN_TARGET_BANDS) {
+        if (full) {
+          box all = {0, 0, width, height, 0};
+          fill(&all, 1, 0, height);
+        }
+        fill(boxes, count, 0, height);
+        if (full) {
+          return push(0, 0, width, height, 0);
+        }
+        for (const box& region : regions) {
+          sent += push(region.x, region.y, region.w, region.h, 0);
+        }
+        return sent;
+      }
+      targetRows damage[region_count + 1];
+      int rows = 0;
+      if (full) {
+        damage[rows++] = {0, height};
+      } else {
+        for (const box& region : regions) {
+          damage[rows++] = {region.y, region.h};
+        }
+      }
+      int16_t bands[(height + SCREEN_BAND_HEIGHT - 1) / SCREEN_BAND_HEIGHT];
+      int band_count = targetBands(damage, rows, height, bands,
+                                   sizeof(bands) / sizeof(bands[0]));
+      for (int b = 0; b < band_count; b++) {
+        int top = bands[b];
+        int bottom = std::min(top + SCREEN_BAND_HEIGHT, height);
+        if (full) {
+          box all = {0, 0, width, height, 0};
+          fill(&all, 1, top, bottom);
+        }
+        fill(boxes, count, top, bottom);
+        if (full) {
+          sent += push(0, top, width, bottom - top, top);
+          continue;
+        }
+        for (const box& region : regions) {
+          int y0 = std::max<int>(region.y, top);
+          int y1 = std::min<int>(region.y + region.h, bottom);
+          if (y1 > y0) {
+            sent += push(region.x, y0, region.w, y1 - y0, top);
+          }
+        }
+      }
+      return sent;
+    };
+
+    const int iterations = 1000;
+    char name[32];
+    for (int full = 1; full >= 0; full--) {
+      snprintf(name, sizeof(name), "target %s %s", targetName(target),
+               full ? "full" : "damaged");
+      Bench(name).run(iterations, [&](uint32_t i) {
+        bytes[target][full] = frame(i, full);
+      });
+    }
+  }
+
+  for (int target = 0; target < 3; target++) {
+    // the LCD gets 16 bit whatever the target, the transfer at
+    // REPLAY_LCD_SPI overlaps drawing the next band or frame
+    printf("  %-6s %6zu bytes in %-8s full %6zu bytes %5u us, damaged %6zu "
+           "bytes %5u us\n",
+           targetName(target), targetMemory(target, width, height, 2),
+           target == SCREEN_TARGET_BANDS ? "internal" : "PSRAM",
+           bytes[target][1],
+           static_cast<uint32_t>(bytes[target][1] * 8ull * 1000000 /
+                                 REPLAY_LCD_SPI),
+           bytes[target][0],
+           static_cast<uint32_t>(bytes[target][0] * 8ull * 1000000 /
+                                 REPLAY_LCD_SPI));
+  }
+}
+
+static void benchQueue() {
+  // producer and consumer threads hammer the queue like networkTask and the
+  // UI loop do, test_queue.cpp checks what arrives (under TSan with
+  // pio test -e native_tsan)
+  struct command {
+    uint32_t sequence;
+    uint32_t check;
+  };
+  const uint32_t count = 1000000;
+  static CommandQueue<command, 8> commands;
+  static CommandQueue<command, 8> replies;
+  uint32_t received = 0;
+
+  std::thread consumer([&] {
+    command item;
+    uint32_t expected = 0;
+    while (expected < count) {
+      if (!commands.pop(&item)) {
+        std::this_thread::yield();
+        continue;
+      }
+      expected = item.sequence + 1;
+      while (!replies.push(item)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  Bench("queue round trip").run(count, [&](uint32_t i) {
+    command item = {i, ~i};
+    while (!commands.push(item)) {
+      command reply;
+      while (replies.pop(&reply)) {
+        received++;
+      }
+      std::this_thread::yield();
+    }
+  });
+  command reply;
+  while (received < count) {
+    if (replies.pop(&reply)) {
+      received++;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  consumer.join();
+  printf("  received=%u\n", received);
+}
+
+static void benchResume() {
+  // deep sleep state codec, test_resume.cpp checks what comes back and the
+  // wakeup arithmetic
+  PomodoroTimer pomodoro;
+  pomodoro.startTimer(true, false, false);
+  auto snapshot = pomodoro.snapshot();
+  resumeState state;
+  PomodoroTimer::Snapshot restored;
+  char description[SHADOW_DESCRIPTION_LENGTH];
+  Bench("resume encode+decode").run(100000, [&](uint32_t) {
+    resumeEncode(&state, snapshot, "write the report");
+    resumeDecode(state, &restored, description, sizeof(description));
+  });
+}
+
+static void benchLinks() {
+  // one hour against a flaky broker in 100 ms steps: down for 10 minutes,
+  // then accepting and dropping every connection after 5 s for 10 minutes,
+  // plus a Wi-Fi drop in between
+  const uint32_t minute = 60000;
+  const uint32_t step = 100;
+  const uint32_t steps = 60 * minute / step;
+  ConnectionManager links;
+  links.seed(12345);
+  bool wifi = false, tls = false, mqtt = false;
+  uint32_t wifi_done = 0, mqtt_since = 0;
+  uint32_t max_backoff = 0, recovered = 0, sessions = 0, passes = 0;
+
+  Bench("links flapping broker").run(steps, [&](uint32_t i) {
+    uint32_t now = i * step;
+    bool broker = now < 5 * minute || now >= 15 * minute;
+    bool flapping = now >= 30 * minute && now < 40 * minute;
+    bool event = false;  // what would notify networkTask
+    if (now == 20 * minute) {
+      wifi = tls = mqtt = false;
+      event = true;
+    }
+    if (tls && (!broker || (flapping && now - mqtt_since >= 5000))) {
+      tls = mqtt = false;
+      event = true;
+    }
+    if (!wifi && links.link(ConnectionManager::Wifi).getState() ==
+                     Link::State::Connecting &&
+        now >= wifi_done) {
+      wifi = true;
+      event = true;
+    }
+
+    if (!event && links.nextWake(now) > 0) {
+      return;  // networkTask would still be blocked
+    }
+    passes++;
+    links.update(now, wifi, tls, mqtt);
+    if (links.shouldConnect(ConnectionManager::Wifi, now)) {
+      links.connecting(ConnectionManager::Wifi, now);
+      wifi_done = now + 2000;
+    }
+    if (links.shouldConnect(ConnectionManager::Tls, now)) {
+      links.connecting(ConnectionManager::Tls, now);
+      tls = broker;
+      if (tls) {
+        links.connected(ConnectionManager::Tls, now);
+      } else {
+        links.failed(ConnectionManager::Tls, now);
+      }
+    }
+    if (links.shouldConnect(ConnectionManager::Mqtt, now)) {
+      links.connecting(ConnectionManager::Mqtt, now);
+      mqtt = true;
+      mqtt_since = now;
+      links.connected(ConnectionManager::Mqtt, now);
+      sessions++;
+      if (recovered == 0 && now >= 15 * minute) {
+        recovered = now - 15 * minute;
+      }
+    }
+    for (int layer = 0; layer < ConnectionManager::LayerCount; layer++) {
+      uint32_t backoff =
+          links.link(static_cast<ConnectionManager::Layer>(layer))
+              .getBackoff();
+      if (backoff > max_backoff) {
+        max_backoff = backoff;
+      }
+    }
+  });
+
+  char buffer[320];
+  links.describe(buffer, sizeof(buffer), steps * step);
+  printf("%s", buffer);
+  printf("  passes=%u sessions=%u recovered_after=%u ms max_backoff=%u ms\n",
+         passes, sessions, recovered, max_backoff);
+}
+
+static void benchOutbox() {
+  // a transition pushed, published and acknowledged, test_outbox.cpp checks
+  // the order, the retries and the reboots
+  static outboxStore store;  // stands in for RTC memory
+  outboxEntry entry = {
+      static_cast<uint8_t>(PomodoroTimer::PomodoroState::POMODORO), true,
+      false, 0, 1, "task"};
+  char buffer[SHADOW_UPDATE_SIZE];
+  Outbox outbox(&store);
+  uint32_t now = 0;
+  Bench("outbox push+encode+ack").run(100000, [&](uint32_t i) {
+    entry.start = i;
+    outbox.push(entry);
+    outbox.encode(buffer, sizeof(buffer));
+    uint32_t token = outbox.token();
+    outbox.published(now);
+    outbox.ack(token);
+    now += 1000;
+  });
+}
+
+// server side of an SNTP exchange, received at t2 and answered at t3
+static void ntpReply(const uint8_t* request, int64_t t2, int64_t t3,
+                     uint8_t* reply) {
+  uint8_t stamp[NTP_PACKET_SIZE];
+  memset(reply, 0, NTP_PACKET_SIZE);
+  reply[0] = 0x24;  // version 4, server
+  reply[1] = 2;     // stratum
+  memcpy(reply + 24, request + 40, 8);
+  ntpEncodeRequest(stamp, t2);  // a transmit timestamp is a timestamp
+  memcpy(reply + 32, stamp + 40, 8);
+  ntpEncodeRequest(stamp, t3);
+  memcpy(reply + 40, stamp + 40, 8);
+}
+
+static void benchClock() {
+  // an SNTP reply decoded and fed to the discipline every second,
+  // test_clock.cpp checks the offsets, the drift estimates and the BM8563
+  static clockState state;  // stands in for RTC memory
+  ClockDiscipline discipline(&state);
+  const int64_t now = 1700000000ll * 1000000;
+  uint8_t request[NTP_PACKET_SIZE], reply[NTP_PACKET_SIZE];
+  int64_t offset;
+  Bench("clock decode+update").run(100000, [&](uint32_t i) {
+    int64_t t1 = now + i * 1000000ll;
+    ntpEncodeRequest(request, t1);
+    ntpReply(request, t1 + 20000 + i % 1000, t1 + 20100 + i % 1000, reply);
+    clockSample sample;
+    ntpDecodeResponse(reply, sizeof(reply), t1, t1 + 40000, &sample);
+    discipline.addSample(sample);
+    discipline.update(1000000 + i * 1000000ull, &offset);
+  });
+}
+
+static bool readFile(const char* path, std::string* out) {
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) {
+    printf("can't read %s\n", path);
+    return false;
+  }
+  char buffer[1024];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    out->append(buffer, read);
+  }
+  fclose(file);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 2 && strcmp(argv[1], "replay") == 0) {
+    std::string trace;
+    if (!readFile(argv[2], &trace)) {
+      return 1;
+    }
+    return replayReport(trace.c_str(),
+                        argc > 3 ? atoi(argv[3]) : REPLAY_BUDGET);
+  }
+  shadowInitTopics(THINGNAME);
+  printf("benchmark                 iterations   time/iteration\n");
+  benchTimer();
+  benchDeadline();
+  benchShadow();
+  benchSound();
+  benchGlyphs();
+  benchInput();
+  benchLights();
+  int status = benchLatency();  // the only check with a budget to keep
+  benchFrame();
+  benchAssets();
+  benchPipeline();
+  benchTargets();
+  benchQueue();
+  benchResume();
+  benchLinks();
+  benchOutbox();
+  benchClock();
+  printf("mqtt: %u messages, %llu bytes published\n", loopbackMqtt.published,
+         static_cast<unsigned long long>(loopbackMqtt.published_bytes));
+  return status;
+}
+
+#endif  // PIO_UNIT_TESTING
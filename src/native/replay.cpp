@@ -0,0 +1,154 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./replay.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "../PomodoroTimer.h"
+#include "../glyphs.h"
+#include "../input.h"
+#include "../scheduler.h"
+#include "./hal_native.h"
+
+const char* const replay_trace =
+    "# ms buttons increment touch x y\n"
+    "1000 00 0 0 0 0\n"
+    "2000 00 4 0 0 0\n"
+    "2150 00 4 0 0 0\n"
+    "2300 00 4 0 0 0\n"
+    "3000 02 0 0 0 0\n"
+    "3004 00 0 0 0 0\n"
+    "3008 02 0 0 0 0\n"
+    "3150 00 0 0 0 0\n"
+    "6000 08 0 0 0 0\n"
+    "6100 00 0 0 0 0\n"
+    "7000 00 0 1 100 120\n"
+    "7080 00 0 0 100 120\n"
+    "8000 00 0 1 100 120\n"
+    "8060 00 0 1 180 120\n"
+    "8100 00 0 0 180 120\n";
+
+// The UI loop of the firmware as far as the host has it: the pipeline and
+// the latency tracker as on the device, a main screen with the minutes and
+// the countdown, composed from a glyph sheet and pushed to an LCD buffer.
+// Virtual time, the composition's CPU time and the modelled SPI transfer
+// are added to it.
+void replay(const char* trace, LatencyTracker* latency_out,
+            uint32_t* frames_out) {
+  glyphMetrics metrics;
+  metrics.height = 96;
+  for (int i = 0; i < GLYPH_COUNT; i++) {
+    metrics.width[i] = GLYPH_CHARSET[i] == ':' ? 24 : 64;
+  }
+  Framebuffer sheet(glyphArrange(&metrics), metrics.height);
+  Framebuffer back_buffer(SCREEN_WIDTH, SCREEN_HEIGHT);
+  Framebuffer lcd(SCREEN_WIDTH, SCREEN_HEIGHT);
+
+  InputPipeline input;
+  LatencyTracker& latency = *latency_out;
+  RenderScheduler scheduler;
+  PomodoroTimer pomodoro;
+  int minutes = PomodoroTimer::toInt(PomodoroTimer::PomodoroLength::SMALL);
+  inputSample raw;
+  int32_t encoder = 0;
+  uint64_t now_us = 0;
+  const char* next = trace;
+  uint32_t next_at = 0;
+  inputSample next_sample;
+  auto parse = [&]() {
+    while (*next != '\0') {
+      const char* line = next;
+      next = strchr(next, '\n');
+      next = next ? next + 1 : line + strlen(line);
+      if (inputTraceParse(line, &next_at, &next_sample)) {
+        return true;
+      }
+    }
+    return false;
+  };
+  bool more = parse();
+  uint32_t end = 0;
+
+  while (more || now_us / 1000 < end) {
+    uint32_t now = now_us / 1000;
+    while (more && next_at <= now) {
+      encoder += next_sample.increment;
+      raw = next_sample;
+      end = next_at + 1000;
+      more = parse();
+    }
+
+    if (input.due(now, raw.touch)) {
+      inputSample sample = raw;
+      sample.increment = encoder;
+      encoder = 0;
+      input.sample(now, now_us, sample);
+    }
+    inputEvent event;
+    while (input.pop(&event)) {
+      bool running =
+          pomodoro.getState() != PomodoroTimer::PomodoroState::STOPPED;
+      int step = event.type == inputEvent::Type::Detent ? event.x
+                 : event.type == inputEvent::Type::Flick
+                     ? (event.x > 0 ? 1 : -1)
+                     : 0;
+      if (!running && step != 0) {
+        minutes = std::min(60, std::max(5, minutes + step * 5));
+      } else if (event.type == inputEvent::Type::Press) {
+        if (!running && (event.button == InputButton::A ||
+                         event.button == InputButton::Hmi1)) {
+          pomodoro.setLength(minutes);
+          pomodoro.startTimer(true, false, false);
+          scheduler.setCountdown(true);
+        } else if (running && event.button == InputButton::A) {
+          pomodoro.stopTimer();
+          scheduler.setCountdown(false);
+        }
+      }
+      scheduler.request(RenderScheduler::Reason::Input);
+      latency.handled(event.at_us, now_us);
+    }
+
+    if (scheduler.beginFrame()) {
+      latency.frameStart(now_us);
+      auto start = std::chrono::steady_clock::now();
+      char text[TIMER_TEXT_SIZE];
+      if (pomodoro.getState() == PomodoroTimer::PomodoroState::STOPPED) {
+        snprintf(text, sizeof(text), "%d", minutes);
+      } else {
+        pomodoro.formatTime(text);
+      }
+      glyphCell cells[GLYPH_TEXT_LENGTH];
+      int count = glyphLayout(metrics, text, SCREEN_WIDTH / 2, cells,
+                              GLYPH_TEXT_LENGTH);
+      int32_t top = SCREEN_HEIGHT / 2 - metrics.height / 2;
+      back_buffer.fillRect(0, top, SCREEN_WIDTH, metrics.height, 0);
+      for (int i = 0; i < count; i++) {
+        back_buffer.blit(sheet, cells[i].sheet_x, 0, cells[i].width,
+                         metrics.height, cells[i].x, top, 0);
+      }
+      size_t bytes = lcd.push(back_buffer, 0, top, SCREEN_WIDTH,
+                              metrics.height);
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      now_us += std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+                    .count() +
+                bytes * 8 * 1000000ull / REPLAY_LCD_SPI;
+      latency.frameDone(now_us);
+    }
+
+    uint64_t step_us = 1000 - now_us % 1000;
+    now_us += step_us;
+    virtualClock.advance(step_us);
+  }
+
+  *frames_out = scheduler.getFrames();
+}
@@ -0,0 +1,22 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stdint.h>
+
+#include "../latency.h"
+
+#define REPLAY_LCD_SPI 40000000  // Hz, the transfer is modelled, not run
+#define REPLAY_BUDGET 60000      // us, default p95 budget
+
+// the idle screen, turning to 35 minutes, starting the timer with HMI
+// button 1, stopping it with BtnA, then a tap and a flick
+extern const char* const replay_trace;
+
+// feeds an input trace through the input pipeline, the UI and the frame
+// composition on the virtual clock, the latencies go to *latency
+void replay(const char* trace, LatencyTracker* latency, uint32_t* frames);
@@ -0,0 +1,137 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./outbox.h"
+
+#include <string.h>
+
+Outbox::Outbox(outboxStore* store) : store(store) {
+  if (store->magic != OUTBOX_MAGIC || store->head >= OUTBOX_SIZE ||
+      store->count > OUTBOX_SIZE) {
+    memset(store, 0, sizeof(*store));
+    store->magic = OUTBOX_MAGIC;
+    store->token = 1;
+  }
+  for (size_t i = 0; i < store->count; i++) {
+    slot(i).created_us = 0;  // micros() of the boot before the deep sleep
+  }
+}
+
+const outboxEntry& Outbox::at(size_t index) const {
+  return store->entries[(store->head + index) % OUTBOX_SIZE];
+}
+
+void Outbox::push(const outboxEntry& entry) {
+  stats.pushed++;
+  // the same session again for the same sections, e.g. only the
+  // description changed
+  if (store->count > in_flight) {
+    outboxEntry& last = slot(store->count - 1);
+    if (last.timer_state == entry.timer_state && last.start == entry.start &&
+        last.reported == entry.reported && last.desired == entry.desired) {
+      memcpy(last.description, entry.description, sizeof(last.description));
+      stats.coalesced++;
+      return;
+    }
+  }
+
+  if (store->count == OUTBOX_SIZE) {
+    dropOldest();
+  }
+  slot(store->count) = entry;
+  store->count++;
+}
+
+void Outbox::dropOldest() {
+  store->head = (store->head + 1) % OUTBOX_SIZE;
+  store->count--;
+  if (in_flight > 0) {
+    in_flight--;  // the ack covers one entry less
+  }
+  stats.dropped++;
+}
+
+bool Outbox::due(uint32_t now) const {
+  return store->count > 0 &&
+         (in_flight == 0 || now - sent_at >= OUTBOX_ACK_TIMEOUT);
+}
+
+uint32_t Outbox::waitLeft(uint32_t now) const {
+  if (store->count == 0) {
+    return UINT32_MAX;
+  }
+  if (in_flight == 0 || now - sent_at >= OUTBOX_ACK_TIMEOUT) {
+    return 0;
+  }
+  return OUTBOX_ACK_TIMEOUT - (now - sent_at);
+}
+
+size_t Outbox::encode(char* buffer, size_t size) {
+  batch = 0;
+  if (store->count == 0) {
+    return 0;
+  }
+
+  // the oldest entries with the same sections, the rest go in the next
+  // batch once this one is acknowledged
+  const outboxEntry& first = at(0);
+  shadowTransition history[OUTBOX_SIZE];
+  while (batch < store->count && at(batch).reported == first.reported &&
+         at(batch).desired == first.desired) {
+    const outboxEntry& entry = at(batch);
+    history[batch++] = {
+        static_cast<PomodoroTimer::PomodoroState>(entry.timer_state),
+        entry.start};
+  }
+
+  // a single transition is a plain report
+  const outboxEntry& last = batchNewest();
+  return shadowEncodeReport(
+      buffer, size, static_cast<PomodoroTimer::PomodoroState>(last.timer_state),
+      last.start, last.description, first.reported, first.desired, history,
+      batch > 1 ? batch : 0, store->token);
+}
+
+void Outbox::published(uint32_t now) {
+  if (in_flight > 0) {
+    stats.retries++;
+  }
+  in_flight = batch;
+  in_flight_token = store->token;
+  sent_at = now;
+  stats.published++;
+  if (++store->token == 0) {
+    store->token = 1;  // 0 marks someone else's update
+  }
+}
+
+bool Outbox::ack(uint32_t token) {
+  if (in_flight == 0 || token != in_flight_token) {
+    return false;  // late ack of a batch that was sent again
+  }
+  stats.acked += in_flight;
+  dropInFlight();
+  return true;
+}
+
+bool Outbox::rejected(uint32_t token, uint32_t code) {
+  if (in_flight == 0 || token != in_flight_token) {
+    return false;
+  }
+  // 400 malformed, 409 version conflict, 413 payload too large
+  if (code == 400 || code == 409 || code == 413) {
+    stats.rejected += in_flight;
+    dropInFlight();
+  }
+  return true;
+}
+
+void Outbox::dropInFlight() {
+  store->head = (store->head + in_flight) % OUTBOX_SIZE;
+  store->count -= in_flight;
+  in_flight = 0;
+}
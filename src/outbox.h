@@ -0,0 +1,101 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./PomodoroTimer.h"
+#include "./shadow.h"
+
+// Shadow reports waiting for the broker. Transitions are kept in order in a
+// small ring, the store lives in RTC memory so they survive deep sleep.
+// Pending entries go out as one update, the latest state as state.reported
+// and / or state.desired and the transitions as its history. Only entries
+// for the same sections share an update, so one with a desired change
+// doesn't publish desired for the others. The batch stays in the
+// ring until update/accepted echoes its clientToken and is sent again if no
+// acknowledgement comes. Portable, owned by networkTask.
+
+#define OUTBOX_MAGIC 0x584F424F  // "OBOX"
+#define OUTBOX_SIZE 8
+#define OUTBOX_ACK_TIMEOUT 10000  // ms, publish to update/accepted
+
+struct outboxEntry {
+  uint8_t timer_state;  // PomodoroTimer::PomodoroState
+  bool reported;
+  bool desired;
+  uint32_t start;
+  uint32_t created_us;  // for the input to publish latency, 0 - unknown
+  char description[SHADOW_DESCRIPTION_LENGTH];
+};
+
+struct outboxStore {
+  uint32_t magic;
+  uint8_t head;   // oldest entry
+  uint8_t count;
+  uint32_t token;  // next clientToken
+  outboxEntry entries[OUTBOX_SIZE];
+};
+
+struct outboxStats {
+  uint32_t pushed = 0;
+  uint32_t coalesced = 0;  // merged into the previous entry
+  uint32_t dropped = 0;    // oldest entry lost to a full ring
+  uint32_t published = 0;  // updates, each one a batch
+  uint32_t acked = 0;      // entries acknowledged
+  uint32_t retries = 0;    // batches sent again after the timeout
+  uint32_t rejected = 0;   // entries dropped, the shadow will never take them
+};
+
+class Outbox {
+ public:
+  // keeps the entries found in a valid store, clears anything else
+  explicit Outbox(outboxStore* store);
+
+  void push(const outboxEntry& entry);
+  bool empty() const { return store->count == 0; }
+  size_t size() const { return store->count; }
+  const outboxEntry& at(size_t index) const;  // 0 - oldest
+  const outboxEntry& newest() const { return at(store->count - 1); }
+
+  // a batch is waiting to be published, first time or after the timeout
+  bool due(uint32_t now) const;
+  // ms until due() may turn true again, UINT32_MAX if nothing is pending
+  uint32_t waitLeft(uint32_t now) const;
+  // encodes the oldest pending entries for the same sections as one update,
+  // 0 if it doesn't fit
+  size_t encode(char* buffer, size_t size);
+  const outboxEntry& batchNewest() const { return at(batch - 1); }
+  uint32_t token() const { return store->token; }  // of the encoded batch
+  void published(uint32_t now);  // the encoded batch went out
+  // update/accepted with this clientToken, true if it was the batch in flight
+  bool ack(uint32_t token);
+  // update/rejected with this clientToken: a version conflict or a document
+  // the service can't take drops the batch, it would fail the same way again,
+  // anything else (throttling, a server error) leaves it for the retry after
+  // the ack timeout. True if it was the batch in flight
+  bool rejected(uint32_t token, uint32_t code);
+  // the connection dropped, publish the batch again once it is back
+  void resend() { in_flight = 0; }
+
+  const outboxStats& getStats() const { return stats; }
+
+ private:
+  outboxStore* store;
+  uint8_t batch = 0;      // entries in the last encode()
+  uint8_t in_flight = 0;  // entries published and not acknowledged yet
+  uint32_t in_flight_token = 0;
+  uint32_t sent_at = 0;
+  outboxStats stats;
+
+  outboxEntry& slot(size_t index) {
+    return store->entries[(store->head + index) % OUTBOX_SIZE];
+  }
+  void dropOldest();
+  void dropInFlight();
+};
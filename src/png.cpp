@@ -0,0 +1,30 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./png.h"
+
+#include <string.h>
+
+#include "./hal.h"
+
+bool pngSize(const char* path, int32_t* width, int32_t* height) {
+  // width and height are the first fields of the IHDR chunk
+  static const uint8_t signature[8] = {0x89, 'P',  'N',  'G',
+                                       '\r', '\n', 0x1A, '\n'};
+  uint8_t header[24];
+  auto read = hal::fs().read(path, 0, header, sizeof(header));
+  if (read != sizeof(header) ||
+      memcmp(header, signature, sizeof(signature)) != 0 ||
+      memcmp(&header[12], "IHDR", 4) != 0) {
+    return false;
+  }
+  *width = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) |
+           header[19];
+  *height = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) |
+            header[23];
+  return true;
+}
@@ -0,0 +1,13 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stdint.h>
+
+// image size from the IHDR chunk of a PNG on hal::fs(), without decoding
+// it. False if the file is missing or isn't a PNG.
+bool pngSize(const char* path, int32_t* width, int32_t* height);
@@ -0,0 +1,181 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./power.h"
+
+#include <M5Unified.h>
+#include <WiFi.h>
+#include <driver/gpio.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+
+#include <algorithm>
+
+#include "./debug.h"
+#include "./hal.h"
+#include "./input.h"
+#include "./shadow.h"
+
+PowerManager powerManager;
+
+// indexed by PomodoroTimer::PomodoroState, the stopped state is covered by
+// the deep sleep ticker
+const PowerManager::Policy PowerManager::policies[POWER_STATES] = {
+    {SCREEN_BRIGHTNESS, SCREEN_BRIGHTNESS, 0, false, 0},    // UNDEFINED
+    {SCREEN_BRIGHTNESS, SCREEN_DIMMED, 15, true, 120},      // POMODORO
+    {SCREEN_BRIGHTNESS, SCREEN_DIMMED * 2, 30, true, 120},  // REST
+    {SCREEN_BRIGHTNESS, SCREEN_DIMMED * 2, 30, false, 0},   // PAUSED
+    {SCREEN_BRIGHTNESS, SCREEN_BRIGHTNESS, 0, false, 0},    // STOPPED
+};
+
+#if (POWER_SAVE == 1) && CONFIG_PM_ENABLE && \
+    CONFIG_FREERTOS_USE_TICKLESS_IDLE
+#define POWER_AUTOMATIC 1
+#endif
+
+// a touch cuts a wait for the second edge short, whichever way it sleeps
+static void IRAM_ATTR touchInterrupt() {
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(
+      static_cast<TaskHandle_t>(powerManager.loopTask()), &woken);
+  if (woken) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+void PowerManager::begin() {
+  loop_task = xTaskGetCurrentTaskHandle();
+  last_input = millis();
+  brightness = SCREEN_BRIGHTNESS;
+
+#ifdef POWER_AUTOMATIC
+  // the idle task sleeps whenever loop() blocks, Wi-Fi wakes it on beacons
+  esp_pm_config_esp32_t config = {240, 80, true};
+  automatic = esp_pm_configure(&config) == ESP_OK;
+  if (automatic) {
+    gpio_wakeup_enable(POWER_TOUCH_PIN, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+  }
+#endif
+  attachInterrupt(POWER_TOUCH_PIN, touchInterrupt, FALLING);
+  DEBUG_PRINTF("PowerManager: %s light sleep\n",
+               automatic ? "automatic" : "manual");
+}
+
+void PowerManager::input() {
+  last_input = millis();
+}
+
+void PowerManager::wake() {
+  if (loop_task != nullptr) {
+    xTaskNotifyGive(static_cast<TaskHandle_t>(loop_task));
+  }
+}
+
+void PowerManager::setBrightness(uint8_t value) {
+  if (value != brightness) {
+    brightness = value;
+    M5.Lcd.setBrightness(value);
+  }
+}
+
+bool PowerManager::update(PomodoroTimer::PomodoroState state, bool idle,
+                          uint64_t deadline) {
+  int index = static_cast<int>(state);
+  const Policy& policy = policies[index];
+  bool dim = policy.dim_after > 0 &&
+             millis() - last_input >= policy.dim_after * 1000u;
+  setBrightness(dim ? policy.dimmed : policy.brightness);
+
+#if (POWER_SAVE == 1)
+  if (dim && policy.light_sleep && idle) {
+    // the next second edge for the countdown, or the session end itself
+    uint32_t us = 1000000 - hal::clock().subsecondMicros() + POWER_WAKE_LATE;
+    uint64_t now = hal::clock().monotonicMicros();
+    if (deadline != 0 && deadline < now + us) {
+      us = deadline > now ? deadline - now : 0;
+    }
+    if (us > 0) {
+      sleep(us, index);
+      return true;
+    }
+  }
+#endif
+  return false;
+}
+
+bool PowerManager::deepSleepDue(PomodoroTimer::PomodoroState state,
+                                bool idle) const {
+  const Policy& policy = policies[static_cast<int>(state)];
+  return policy.deep_sleep_after > 0 && idle &&
+         millis() - last_input >= policy.deep_sleep_after * 1000u;
+}
+
+void PowerManager::sleep(uint32_t us, int state) {
+  uint32_t start = micros();  // esp_timer keeps counting in light sleep
+
+  // the HMI unit can't wake the CPU, waits end in time for the idle poll
+  uint32_t wait_ms = std::min<uint32_t>((us + 999) / 1000, INPUT_POLL_IDLE);
+  if (automatic) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
+  } else if (WiFi.isConnected()) {
+    // light sleep would stop the radio under the MQTT session, so the CPU
+    // waits and the modem sleeps between beacons
+    WiFi.setSleep(true);
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
+  } else {
+    esp_sleep_enable_timer_wakeup(us);
+    gpio_wakeup_enable(POWER_TOUCH_PIN, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+    esp_light_sleep_start();
+    gpio_wakeup_disable(POWER_TOUCH_PIN);
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO) {
+      input();
+    }
+  }
+
+  uint32_t slept = micros() - start;
+  stats[state].sleep_us += slept;
+  stats[state].sleeps++;
+  slept_us += slept;
+}
+
+void PowerManager::sampleCurrent(PomodoroTimer::PomodoroState state,
+                                 int32_t ma) {
+  // the previous reading stands for the time awake since it was taken, the
+  // sleeps in between are counted apart
+  uint32_t now = millis();
+  if (last_state >= 0) {
+    uint32_t elapsed = now - last_sample;
+    uint32_t slept = slept_us / 1000;
+    uint32_t awake = elapsed > slept ? elapsed - slept : 0;
+    stats[last_state].charge += static_cast<int64_t>(last_ma) * awake;
+    stats[last_state].awake_ms += awake;
+    stats[last_state].ms += elapsed;
+  }
+  last_state = static_cast<int>(state);
+  last_ma = ma;
+  last_sample = now;
+  slept_us = 0;
+}
+
+void PowerManager::dump(Print* out) const {
+  out->printf("%-10s %8s %10s %7s %8s\n", "state", "awake_mA", "time_s",
+              "sleep%", "sleeps");
+  for (int i = 0; i < POWER_STATES; i++) {
+    const stateStats& s = stats[i];
+    if (s.ms == 0 && s.sleeps == 0) {
+      continue;
+    }
+    out->printf("%-10s %8d %10u %7u %8u\n",
+                shadowStateName(static_cast<PomodoroTimer::PomodoroState>(i)),
+                s.awake_ms ? static_cast<int32_t>(s.charge / s.awake_ms) : 0,
+                s.ms / 1000,
+                s.ms ? static_cast<uint32_t>(s.sleep_us / 10 / s.ms) : 0,
+                s.sleeps);
+  }
+}
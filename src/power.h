@@ -0,0 +1,91 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <Arduino.h>
+#include <stdint.h>
+
+#include "./PomodoroTimer.h"
+
+// set to 0 to keep the CPU awake, dimming still works
+#define POWER_SAVE 1
+
+#define SCREEN_BRIGHTNESS 128
+#define SCREEN_DIMMED 16
+
+// wake up this long after the RTC second edge, so the frame shows the new
+// second right away
+#define POWER_WAKE_LATE 2000  // us
+
+// FT6336U touch controller interrupt, low while the screen is touched,
+// buttons A, B and C are touch areas on Core2 too
+#define POWER_TOUCH_PIN GPIO_NUM_39
+
+#define POWER_STATES 5  // PomodoroTimer::PomodoroState values
+
+// Dims the LCD after a period without input and light-sleeps the CPU between
+// second edges while a timer is running. Wakes on the next second edge, on
+// touch and, where automatic light sleep is available (CONFIG_PM_ENABLE and
+// tickless idle), on network traffic too. Otherwise the CPU is only put to
+// light sleep by hand while Wi-Fi is down: esp_light_sleep_start() would
+// stop the radio under the broker connection, so with Wi-Fi up loop() just
+// blocks until the edge and modem sleep saves what it can. The blocking
+// waits last INPUT_POLL_IDLE at most, the HMI encoder is polled.
+class PowerManager {
+ public:
+  struct Policy {
+    uint8_t brightness;         // while in use
+    uint8_t dimmed;             // after dim_after seconds without input
+    uint16_t dim_after;         // s, 0 - never dim
+    bool light_sleep;           // sleep between second edges while dimmed
+    uint16_t deep_sleep_after;  // s without input, 0 - stay up
+  };
+
+  void begin();
+  void input();  // touch, button or encoder activity
+  void wake();   // cut the current sleep short, from any task
+  void* loopTask() const { return loop_task; }
+  // call at the end of loop(), idle - nothing is waiting for the CPU,
+  // deadline - session end on the monotonic clock, 0 - none. Returns true
+  // if the CPU has been sleeping
+  bool update(PomodoroTimer::PomodoroState state, bool idle,
+              uint64_t deadline);
+  // time to deep-sleep through the rest of the running timer
+  bool deepSleepDue(PomodoroTimer::PomodoroState state, bool idle) const;
+
+  // battery current readings attributed to the timer state, taken awake
+  // and so only standing for the time awake since the last one
+  void sampleCurrent(PomodoroTimer::PomodoroState state, int32_t ma);
+  void dump(Print* out) const;
+
+ private:
+  struct stateStats {
+    int64_t charge = 0;  // mA * ms, awake
+    uint32_t awake_ms = 0;
+    uint32_t ms = 0;
+    uint64_t sleep_us = 0;
+    uint32_t sleeps = 0;
+  };
+
+  static const Policy policies[POWER_STATES];
+
+  bool automatic = false;  // automatic light sleep in the idle task
+  void* loop_task = nullptr;
+  uint32_t last_input = 0;
+  uint8_t brightness = 0;
+
+  stateStats stats[POWER_STATES];
+  int last_state = -1;
+  int32_t last_ma = 0;
+  uint32_t last_sample = 0;
+  uint32_t slept_us = 0;  // since the last sample
+
+  void setBrightness(uint8_t value);
+  void sleep(uint32_t us, int state);
+};
+
+extern PowerManager powerManager;
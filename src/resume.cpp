@@ -0,0 +1,79 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./resume.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static uint32_t checksum(const resumeState& state) {
+  // FNV-1a
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(&state);
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < offsetof(resumeState, checksum); i++) {
+    hash = (hash ^ data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+void resumeEncode(resumeState* out, const PomodoroTimer::Snapshot& timer,
+                  const char* description) {
+  memset(out, 0, sizeof(*out));
+  out->magic = RESUME_MAGIC;
+  out->version = RESUME_VERSION;
+  out->timer_state = static_cast<uint8_t>(timer.state);
+  out->start = timer.start;
+  out->end = timer.end;
+  out->pause_time = timer.pause_time;
+  out->pomodoro_minutes = timer.pomodoro_minutes;
+  out->rest_minutes = timer.rest_minutes;
+  snprintf(out->description, sizeof(out->description), "%s",
+           description ? description : "");
+  out->checksum = checksum(*out);
+}
+
+bool resumeDecode(const resumeState& in, PomodoroTimer::Snapshot* timer,
+                  char* description, size_t size) {
+  if (size > 0) {
+    description[0] = '\0';
+  }
+  if (in.magic != RESUME_MAGIC || in.version != RESUME_VERSION ||
+      in.checksum != checksum(in)) {
+    return false;
+  }
+  auto state = static_cast<PomodoroTimer::PomodoroState>(in.timer_state);
+  if (state != PomodoroTimer::PomodoroState::POMODORO &&
+      state != PomodoroTimer::PomodoroState::REST) {
+    return false;
+  }
+  if (in.end < in.start || in.pomodoro_minutes == 0 || in.rest_minutes == 0) {
+    return false;
+  }
+
+  *timer = {state,        in.start,           in.end,
+            in.pause_time, in.pomodoro_minutes, in.rest_minutes};
+  if (size > 0) {
+    snprintf(description, size, "%.*s",
+             static_cast<int>(sizeof(in.description)), in.description);
+  }
+  return true;
+}
+
+void resumeClear(resumeState* state) { memset(state, 0, sizeof(*state)); }
+
+uint64_t resumeWakeDelay(uint32_t now, uint32_t now_us, uint32_t end,
+                         uint32_t glance) {
+  if (static_cast<int32_t>(end - now) <= 0) {
+    return 0;
+  }
+  uint32_t seconds = end - now;
+  if (glance > 0 && glance < seconds) {
+    seconds = glance;
+  }
+  // to the start of the target second, then a little into it
+  return static_cast<uint64_t>(seconds) * 1000000 - now_us + RESUME_WAKE_LATE;
+}
@@ -0,0 +1,58 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./PomodoroTimer.h"
+#include "./shadow.h"
+
+// Timer state kept in RTC slow memory while the device deep-sleeps through a
+// running pomodoro, so setup() can continue it without a shadow GET.
+// Portable, the RTC_DATA_ATTR instance lives in main.cpp.
+
+#define RESUME_MAGIC 0x52444D50  // "PMDR"
+#define RESUME_VERSION 1
+
+// seconds between wakeups to glance at the remaining time,
+// 0 - sleep until the end of the session
+#define RESUME_GLANCE 0
+
+// wake up this long after the second the session ends
+#define RESUME_WAKE_LATE 50000  // us
+
+// sessions ending sooner than that are finished awake
+#define RESUME_MIN_SLEEP 10  // s
+
+struct resumeState {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t timer_state;
+  uint8_t reserved;
+  uint32_t start;
+  uint32_t end;
+  uint32_t pause_time;
+  uint16_t pomodoro_minutes;
+  uint16_t rest_minutes;
+  char description[SHADOW_DESCRIPTION_LENGTH];
+  uint32_t checksum;  // FNV-1a of everything above
+};
+
+void resumeEncode(resumeState* out, const PomodoroTimer::Snapshot& timer,
+                  const char* description);
+// false if there is nothing valid to resume, description is always
+// terminated
+bool resumeDecode(const resumeState& in, PomodoroTimer::Snapshot* timer,
+                  char* description, size_t size);
+void resumeClear(resumeState* state);
+
+// microseconds from now (epoch seconds + microseconds into the second) to
+// the next wakeup: the session end or the next glance, whichever is first,
+// 0 if the session is already over
+uint64_t resumeWakeDelay(uint32_t now, uint32_t now_us, uint32_t end,
+                         uint32_t glance = RESUME_GLANCE);
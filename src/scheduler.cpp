@@ -0,0 +1,49 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./scheduler.h"
+
+#include "./hal.h"
+
+RenderScheduler renderScheduler;
+
+void RenderScheduler::request(Reason reason) {
+  pending.fetch_or(1u << static_cast<int>(reason));
+}
+
+bool RenderScheduler::beginFrame() {
+  uint32_t second = hal::clock().epoch();
+  if (second != last_second) {
+    last_second = second;
+    // the remaining time rolls over together with the RTC second
+    if (countdown || second - last_status >= RENDER_STATUS_INTERVAL) {
+      request(Reason::Second);
+    }
+  }
+
+  uint32_t reasons = pending.exchange(0);
+  if (reasons == 0) {
+    return false;
+  }
+
+  frames++;
+  for (int i = 0; i < static_cast<int>(Reason::Count); i++) {
+    if (reasons & (1u << i)) {
+      requests[i]++;
+    }
+  }
+  if (reasons & (1u << static_cast<int>(Reason::Second))) {
+    last_status = second;
+    uint32_t latency = hal::clock().subsecondMicros();
+    edge_frames++;
+    edge_latency_us += latency;
+    if (latency > edge_latency_max_us) {
+      edge_latency_max_us = latency;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,51 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stdint.h>
+
+#include <atomic>
+
+// seconds between status bar refreshes when no countdown is running
+#define RENDER_STATUS_INTERVAL 5
+
+// Decides when a new frame is needed: on real changes (state transitions,
+// task name, connectivity, input) and on the RTC second edge while the
+// countdown is running, instead of a fixed rate ticker
+class RenderScheduler {
+ public:
+  enum class Reason { Second, State, TaskName, Connectivity, Input, Count };
+
+  void request(Reason reason);  // safe to call from any task
+  bool beginFrame();  // call from loop(), true if a frame should be drawn
+  void setCountdown(bool running) { countdown = running; }
+  bool isPending() const { return pending.load() != 0; }
+
+  uint32_t getFrames() const { return frames; }
+  uint32_t getRequests(Reason reason) const {
+    return requests[static_cast<int>(reason)];
+  }
+  // delay between the RTC second edge and the frame showing it
+  uint32_t getEdgeLatencyAvg() const {
+    return edge_frames ? edge_latency_us / edge_frames : 0;
+  }
+  uint32_t getEdgeLatencyMax() const { return edge_latency_max_us; }
+
+ private:
+  std::atomic<uint32_t> pending{0};
+  bool countdown = false;
+  uint32_t last_second = 0;
+  uint32_t last_status = 0;
+
+  uint32_t frames = 0;
+  uint32_t requests[static_cast<int>(Reason::Count)] = {};
+  uint32_t edge_frames = 0;
+  uint64_t edge_latency_us = 0;
+  uint32_t edge_latency_max_us = 0;
+};
+
+extern RenderScheduler renderScheduler;
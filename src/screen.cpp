@@ -11,33 +11,42 @@ Copyright 2023 Sergei Chistokhin
 #include <M5Unified.h>
 #include <WiFi.h>
 #include <esp_bt.h>
+#include <esp_heap_caps.h>
 #include <esp_bt_main.h>
 #include <esp_wifi.h>
 
+#include <algorithm>
 #include <string>
 
+#include "./assets.h"
 #include "./debug.h"
+#include "./hal.h"
 #include "./main.h"
+#include "./metrics.h"
+#include "./power.h"
+#include "./scheduler.h"
 
 #define FASTLED_INTERNAL
 #include <FastLED.h>
 
 #define WAKE_TIMEOUT 30  // seconds
-void goToSleep() {
-  set_rtc();
+void deepSleep(uint64_t wake_us) {
+  M5.Lcd.waitDMA();  // a frame may still be on its way to the LCD
+  clock_sleep();  // the wakeup is corrected with the sleep clock drift
   esp_wifi_stop();
   esp_bluedroid_disable();
   esp_bluedroid_deinit();
   esp_bt_controller_disable();
   esp_bt_controller_deinit();
   esp_bt_mem_release(ESP_BT_MODE_BTDM);
-  M5.Power.deepSleep();
+  M5.Power.deepSleep(wake_us);  // timer wakeup armed if wake_us > 0
 }
+void goToSleep() { deepSleep(0); }
 Ticker sleepTicker(goToSleep, WAKE_TIMEOUT * 1000, MILLIS);
 
 screenRender::screenRender()
     : active_state(ScreenState::MainScreen),
-      back_buffer(&M5.Lcd),
+      back_buffer(&buffers[0]),
       description(""),
       transition(false),
       lastrender(0) {
@@ -48,18 +57,117 @@ screenRender::screenRender()
   screen_center_x = screen_width / 2;
   screen_center_y = screen_height / 2;
 
-  back_buffer.setColorDepth(M5.Lcd.getColorDepth());
-  back_buffer.setPsram(true);
-  back_buffer.createSprite(screen_width, screen_height);
-  back_buffer.setTextDatum(textdatum_t::middle_center);
-
-  FastLED.addLeds<SK6812, LED_DATA_PIN, GRB>(leds, NUM_LEDS);
-  FastLED.clear();
-  FastLED.setBrightness(LED_BRIGHTNESS);
-  FastLED.show();
+#if SCREEN_TARGET == SCREEN_TARGET_BANDS
+  for (int i = 0; i < SCREEN_BUFFERS; i++) {
+    band_memory[i] = static_cast<uint16_t *>(
+        heap_caps_malloc(screen_width * SCREEN_BAND_HEIGHT * 2,
+                         MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+    if (band_memory[i] == nullptr) {
+      DEBUG_PRINTF("screen: no internal RAM for the bands, using %s\n",
+                   targetName(SCREEN_TARGET_RGB565));
+      target = SCREEN_TARGET_RGB565;
+      break;
+    }
+  }
+  for (int i = 0; i < SCREEN_BUFFERS; i++) {
+    if (target != SCREEN_TARGET_BANDS) {
+      heap_caps_free(band_memory[i]);  // those allocated before, or null
+      band_memory[i] = nullptr;
+      continue;
+    }
+    // the sprite is just the band, setBand() moves its origin down the
+    // screen
+    buffers[i].setBuffer(band_memory[i], screen_width, SCREEN_BAND_HEIGHT,
+                         lgfx::rgb565_2Byte);
+    buffers[i].setTextDatum(textdatum_t::middle_center);
+  }
+#endif
+  if (target != SCREEN_TARGET_BANDS) {
+    for (M5Canvas &buffer : buffers) {
+      buffer.setColorDepth(target == SCREEN_TARGET_RGB332
+                               ? lgfx::rgb332_1Byte
+                               : M5.Lcd.getColorDepth());
+      buffer.setPsram(true);
+      buffer.createSprite(screen_width, screen_height);
+      buffer.setTextDatum(textdatum_t::middle_center);
+    }
+  }
+  DEBUG_PRINTF("screen: %s target, %u bytes\n", targetName(target),
+               static_cast<uint32_t>(targetMemory(
+                   target, screen_width, screen_height, SCREEN_BUFFERS)));
+
+  back_buffer->setFont(TIMER_FONT);
+  back_buffer->setTextSize(2);
+  int timer_height = back_buffer->fontHeight();
+  back_buffer->setFont(SMALL_FONT);
+  back_buffer->setTextSize(0);
+  int small_height = back_buffer->fontHeight();
+
+  int task_y = screen_center_y - timer_height / 2 - 30;
+  int status_icons_x = screen_width - STATUS_BATTERY_WIDTH - STATUS_BORDER -
+                       (STATUS_BORDER + STATUS_ICON_SIZE) * 2;
+  setRegion(TimerDigits, 0, screen_center_y - timer_height / 2, screen_width,
+            timer_height);
+  setRegion(TaskName, 0, task_y - small_height / 2, screen_width,
+            small_height);
+  setRegion(ProgressBar, 0, screen_height - PROGRESS_BAR_HEIGHT, screen_width,
+            PROGRESS_BAR_HEIGHT);
+  setRegion(StatusIcons, status_icons_x, 0, screen_width - status_icons_x,
+            STATUS_BAR_HEIGHT);
+  setRegion(BatteryText, 0, 0, status_icons_x, STATUS_BAR_HEIGHT);
+  setRegion(ConfigMinutes, 5, 225 - small_height / 2, 100,
+            std::min(small_height, screen_height - (225 - small_height / 2)));
+
+  // the countdown is composed from the sheet instead of the font
+  glyphCache.load(TIMER_FONT, 2, TIMER_COLOR);
+
+  setLights({lightsCommand::Type::Off});
 }
 
 void screenRender::render() {
+  METRIC_SCOPE(Render);
+  auto start = micros();
+  frame_start = start;
+  sampleStatus();
+  sampleFrame();
+  damaged = 0;
+  bytes_pushed = 0;
+  if (target == SCREEN_TARGET_BANDS) {
+    renderBands();
+  } else {
+    if (SCREEN_BUFFERS == 1) {
+      uint32_t wait = micros();
+      finishTransfer(true);  // the only buffer is still being sent
+      timing.waited(micros() - wait);
+    }
+    drawn = back;
+    full_redraw = false;
+    if (stale & (1 << back)) {
+      redrawAll();
+    }
+    bands_end = screen_height;
+    setBand(0, screen_height);
+    renderScreen();
+  }
+  bytes_pushed_total += bytes_pushed;
+  timing.frameEnd();
+  render_us += micros() - start;
+  if (++frames % FRAME_STATS_INTERVAL == 0) {
+    DEBUG_PRINTF(
+        "render: %u us/frame, %u bytes/frame, assets hit=%u miss=%u, "
+        "glyphs hit=%u miss=%u\n",
+        render_us / FRAME_STATS_INTERVAL,
+        static_cast<uint32_t>(bytes_pushed_total / frames),
+        assetCache.getHits(), assetCache.getMisses(), glyphCache.getHits(),
+        glyphCache.getMisses());
+    DEBUG_PRINTF("render: second edge latency avg=%u us max=%u us\n",
+                 renderScheduler.getEdgeLatencyAvg(),
+                 renderScheduler.getEdgeLatencyMax());
+    render_us = 0;
+  }
+}
+
+void screenRender::renderScreen() {
   switch (active_state) {
     case ScreenState::MainScreen:
       renderMainScreen();
@@ -76,6 +184,63 @@ void screenRender::render() {
   }
 }
 
+void screenRender::renderBands() {
+  // a pass without rows only finds the elements that changed, then just the
+  // bands they touch are drawn, each one into the other band buffer while
+  // the last one is sent
+  drawn = 0;
+  full_redraw = false;
+  if (lcd_stale) {
+    redrawAll();
+  }
+  setBand(0, 0);
+  renderScreen();
+
+  targetRows damage[ElementCount + 1];
+  int count = 0;
+  if (full_redraw) {
+    damage[count++] = {0, static_cast<int16_t>(screen_height)};
+  }
+  for (int i = 0; i < ElementCount; i++) {
+    if (damaged & (1 << i)) {
+      damage[count++] = {static_cast<int16_t>(regions[i].y),
+                         static_cast<int16_t>(regions[i].h)};
+    }
+  }
+  // enough for the longer side of the LCD
+  int16_t bands[(320 + SCREEN_BAND_HEIGHT - 1) / SCREEN_BAND_HEIGHT];
+  int band_count = targetBands(damage, count, screen_height, bands,
+                               sizeof(bands) / sizeof(bands[0]));
+  if (band_count == 0) {
+    frameDone(micros());  // nothing changed, the LCD is already up to date
+    return;
+  }
+  bands_end = std::min<int32_t>(bands[band_count - 1] + SCREEN_BAND_HEIGHT,
+                                screen_height);
+  for (int i = 0; i < band_count; i++) {
+    setBand(bands[i],
+            std::min<int32_t>(SCREEN_BAND_HEIGHT, screen_height - bands[i]));
+    renderScreen();
+  }
+  lcd_stale = false;
+}
+
+void screenRender::setBand(int32_t y, int32_t h) {
+  band_y = y;
+  band_h = h;
+  if (target == SCREEN_TARGET_BANDS && h > 0) {
+    if (SCREEN_BUFFERS == 1) {
+      uint32_t wait = micros();
+      finishTransfer(true);  // the only band is still being sent
+      timing.waited(micros() - wait);
+    }
+    // the band buffer holds rows y to y + h, the clip keeps every write
+    // inside it
+    origin_y = y;
+  }
+  back_buffer->setClipRect(0, row(y), screen_width, h);
+}
+
 void screenRender::setState(ScreenState state, bool rest, bool report_desired,
                             int pomodoro_minutes,
                             PomodoroTimer::RestLength pomodoro_rest_minutes) {
@@ -85,10 +250,10 @@ void screenRender::setState(ScreenState state, bool rest, bool report_desired,
     switch (state) {
       case ScreenState::MainScreen:
         DEBUG_PRINTLN("screenRender::setState to MainScreen");
+        description = "";  // before the STOPPED report captures it
         if (pomodoro.isRunning()) {
           pomodoro.stopTimer();
         }
-        description = "";
         break;
       case ScreenState::PomodoroScreen:
         DEBUG_PRINTLN("screenRender::setState to PomodoroScreen");
@@ -101,77 +266,311 @@ void screenRender::setState(ScreenState state, bool rest, bool report_desired,
         break;
     }
     active_state = state;
+    renderScheduler.request(RenderScheduler::Reason::State);
   }
   transition = false;
 }
 
+void screenRender::resume(const PomodoroTimer::Snapshot &snapshot,
+                          const char *taskName) {
+  // straight to the pomodoro screen, setState() would start a new timer
+  pomodoro.restore(snapshot);
+  description = taskName;
+  active_state = ScreenState::PomodoroScreen;
+  renderScheduler.request(RenderScheduler::Reason::State);
+}
+
+void screenRender::setTaskName(const char *taskName) {
+  if (description != taskName) {
+    description = taskName;
+    renderScheduler.request(RenderScheduler::Reason::TaskName);
+  }
+}
+
 void screenRender::drawProgressBar(int x, int y, int w, int h, int val,
                                    int color) {
-  back_buffer.drawRect(x, y, w, h, color);
-  back_buffer.fillRect(x + 1, y + 1, w * (static_cast<float>(val) / 100.0f),
-                       h - 1, color);
+  back_buffer->drawRect(x, row(y), w, h, color);
+  back_buffer->fillRect(x + 1, row(y + 1),
+                        w * (static_cast<float>(val) / 100.0f), h - 1, color);
+}
+
+void screenRender::sampleStatus() {
+  status.battery = M5.Power.getBatteryLevel();
+  status.drain = M5.Power.getBatteryCurrent();
+  powerManager.sampleCurrent(pomodoro.getState(), status.drain);
+  status.charging =
+      M5.Power.isCharging() == m5::Power_Class::is_charging_t::is_charging;
+  status.wifi = WiFi.status() == WL_CONNECTED;
+  status.mqtt = client.connected();
+}
+
+void screenRender::sampleFrame() {
+  frame.pomodoro = pomodoro.getState();
+  pomodoro.formatTime(frame.time);
+  frame.progress = pomodoro.getTimerPercentage();
+  frame.remaining = pomodoro.getRemainingPermille();
+  frame.minutes = pomodoro_minutes_cfg;
 }
 
 void screenRender::drawStatusIcons() {
   // at least draw a progress bar to show battery level
-  int battery = M5.Power.getBatteryLevel();
-  int power_drain = M5.Power.getBatteryCurrent();
+  int battery = status.battery;
+  int power_drain = status.drain;
+  bool charging = status.charging;
+  bool wifi_connected = status.wifi;
+  bool mqtt_connected = status.mqtt;
+
+  int w = STATUS_BATTERY_WIDTH;
+  int h = STATUS_ICON_SIZE;
+  int border = STATUS_BORDER;
+  auto icon_x = screen_width - w - border;
+  back_buffer->setTextSize(0);
 
-  String power_drain_str = String(power_drain) + " mA";
-  if (M5.Power.isCharging() == m5::Power_Class::is_charging_t::is_charging) {
-    power_drain_str += " (+)";
+  if (beginRegion(BatteryText,
+                  (static_cast<uint32_t>(power_drain) << 1) | charging)) {
+    String power_drain_str = String(power_drain) + " mA";
+    if (charging) {
+      power_drain_str += " (+)";
+    }
+    back_buffer->setTextColor(TFT_WHITE);
+    back_buffer->setTextDatum(textdatum_t::top_left);
+    back_buffer->drawString(power_drain_str, border, row(h / 2 + border),
+                            &Font8x8C64);
+    back_buffer->setTextDatum(textdatum_t::middle_center);
+    endRegion();
   }
 
-  int w = 40;
-  int h = 10;
-  int border = 2;
-  auto icon_x = screen_width - w - border;
-  back_buffer.setTextSize(0);
-  drawProgressBar(icon_x, border, w, h + border, battery, TFT_RED);
-  back_buffer.setTextColor(TFT_WHITE);
-  back_buffer.drawString(String(battery), icon_x + w / 2, h / 2 + border,
-                         &Font8x8C64);
-
-  back_buffer.setTextDatum(textdatum_t::top_left);
-  back_buffer.drawString(power_drain_str, border, h / 2 + border, &Font8x8C64);
-  back_buffer.setTextDatum(textdatum_t::middle_center);
-
-  if (WiFi.status() == WL_CONNECTED) {
-    back_buffer.drawPngFile(LittleFS, ICON_WIFI, icon_x - border - h, border);
-  } else {
-    back_buffer.drawPngFile(LittleFS, ICON_NOWIFI, icon_x - border - h, border);
-  }
-  if (client.connected()) {
-    back_buffer.drawPngFile(LittleFS, ICON_MQTT, icon_x - (border + h) * 2,
-                            border);
+  if (beginRegion(StatusIcons, battery | (wifi_connected << 8) |
+                                   (mqtt_connected << 9))) {
+    drawProgressBar(icon_x, border, w, h + border, battery, TFT_RED);
+    back_buffer->setTextColor(TFT_WHITE);
+    back_buffer->drawString(String(battery), icon_x + w / 2,
+                            row(h / 2 + border), &Font8x8C64);
+
+    if (wifi_connected) {
+      assetCache.draw(back_buffer, ICON_WIFI, icon_x - border - h,
+                      row(border), true);
+    } else {
+      assetCache.draw(back_buffer, ICON_NOWIFI, icon_x - border - h,
+                      row(border), true);
+    }
+    if (mqtt_connected) {
+      assetCache.draw(back_buffer, ICON_MQTT, icon_x - (border + h) * 2,
+                      row(border), true);
+    }
+    endRegion();
   }
 }
 
 void screenRender::drawTaskName(String task_name, int prev_font_height) {
   if (task_name.length() > 0) {
-    back_buffer.setTextSize(0);
-    back_buffer.setFont(SMALL_FONT);
-    back_buffer.drawString(task_name, screen_center_x,
-                           screen_center_y - prev_font_height / 2 - 30);
+    back_buffer->setTextSize(0);
+    back_buffer->setFont(SMALL_FONT);
+    back_buffer->drawString(
+        task_name, screen_center_x,
+        row(screen_center_y - prev_font_height / 2 - 30));
   }
 }
 
-void screenRender::setCompletion(int width, CRGB color) {
-  fill_solid(leds, NUM_LEDS, CRGB::Black);
-  int ledsToLight = 2 * ((100 - width + 19) / 20);
-  int start = (NUM_LEDS - ledsToLight) / 2;
+void screenRender::setCompletion(int remaining, uint32_t color,
+                                 bool breathe) {
+  lightsCommand command = {lightsCommand::Type::Progress};
+  command.breathe = breathe;
+  command.remaining = remaining;
+  command.color = color;
+  setLights(command);
+}
 
-  for (int i = start; i < start + ledsToLight; i++) {
-    leds[i] = color;
+void screenRender::setLights(const lightsCommand& command) {
+  // the engine animates on its own, so a render only sends what changed
+  if (command.type != lightsCommand::Type::Flash && lights_valid &&
+      command.type == lights_sent.type &&
+      command.breathe == lights_sent.breathe &&
+      command.remaining == lights_sent.remaining &&
+      command.color == lights_sent.color) {
+    return;
+  }
+  if (command.type != lightsCommand::Type::Flash) {
+    lights_sent = command;
+    lights_valid = true;
   }
-  FastLED.show();
+  set_lights(command);
 }
 
 void screenRender::pushBackBuffer() {
   drawStatusIcons();
+  if (band_h == 0) {
+    return;  // the bands are still looking for what changed
+  }
+
+  METRIC_SCOPE(PushBackBuffer);
+  uint32_t start = micros();
+  timing.drawn(start - frame_start);
+  // the LCD takes one transfer at a time, the last one is likely done by now
+  finishTransfer(true);
+  uint32_t started = micros();
+  timing.waited(started - start);
+
+  bool bands = target == SCREEN_TARGET_BANDS;
+  uint32_t bytes = 0;
+  M5.Lcd.startWrite();
+  // a buffer redrawn in full only to catch up with the other one pushes
+  // just the elements that differ from the LCD
+  if (lcd_stale) {
+    if (!bands) {
+      lcd_stale = false;  // the bands clear it after the last one
+    }
+    pushRows(band_y, band_h);
+    bytes = frameBytes(screen_width, band_h);
+    for (Region &region : regions) {
+      region.shown = region.value[drawn];
+      region.shown_valid = region.valid[drawn];
+    }
+  } else {
+    for (int i = 0; i < ElementCount; i++) {
+      Region &region = regions[i];
+      bool changed = bands ? (damaged & (1 << i)) != 0
+                           : region.valid[drawn] &&
+                                 !(region.shown_valid &&
+                                   region.shown == region.value[drawn]);
+      int32_t y = std::max(region.y, band_y);
+      int32_t h = std::min(region.y + region.h, band_y + band_h) - y;
+      if (!changed || h <= 0) {
+        continue;
+      }
+      M5.Lcd.setClipRect(region.x, y, region.w, h);
+      pushRows(y, h);
+      bytes += frameBytes(region.w, h);
+      region.shown = region.value[drawn];
+      region.shown_valid = true;
+    }
+    M5.Lcd.clearClipRect();
+  }
+  bytes_pushed += bytes;
+  uint32_t now = micros();
+  timing.started(now, now - started, bytes);
+  transfer_ends_frame = band_y + band_h >= bands_end;
+  if (bytes > 0) {
+    in_flight = true;  // the transaction ends once the DMA is done
+  } else {
+    M5.Lcd.endWrite();
+    if (transfer_ends_frame) {
+      frameDone(now);
+    }
+  }
+
+  stale &= ~(1 << back);
+  back = (back + 1) % SCREEN_BUFFERS;
+  back_buffer = &buffers[back];
+  frame_start = micros();  // the next band is drawn from here
+}
+
+void screenRender::pushRows(int32_t y, int32_t h) {
+  // whole rows are contiguous in the sprite, the LCD clip cuts regions out
+#if SCREEN_TARGET == SCREEN_TARGET_RGB332
+  // converted to the LCD format on the way, by the CPU into DMA buffers
+  auto pixels = static_cast<const lgfx::rgb332_t *>(back_buffer->getBuffer());
+#else
+  // the sprite holds the pixels in the byte order of the LCD
+  auto pixels = static_cast<const lgfx::swap565_t *>(back_buffer->getBuffer());
+#endif
+  M5.Lcd.pushImageDMA(0, y, screen_width, h, pixels + row(y) * screen_width);
+}
+
+void screenRender::redrawAll() {
+  full_redraw = true;
+  // nothing drawn into the buffer before is left once it is cleared
+  for (Region &region : regions) {
+    region.valid[drawn] = false;
+  }
+}
+
+bool screenRender::finishTransfer(bool wait) {
+  if (!in_flight || (!wait && M5.Lcd.dmaBusy())) {
+    return false;
+  }
+  M5.Lcd.waitDMA();
+  M5.Lcd.endWrite();
+  in_flight = false;
+  uint32_t now = micros();
+  METRIC_RECORD(LcdTransfer, timing.done(now));
+  if (transfer_ends_frame) {
+    frameDone(now);
+  }
+  return true;
+}
+
+void screenRender::frameDone(uint32_t now_us) {
+  if (shown_count < SCREEN_BUFFERS + 1) {
+    shown_us[shown_count++] = now_us;
+  }
+}
+
+bool screenRender::frameShown(uint32_t *at_us) {
+  if (shown_count == 0) {
+    finishTransfer(false);
+  }
+  if (shown_count == 0) {
+    return false;
+  }
+  *at_us = shown_us[0];
+  shown_count--;
+  std::copy(shown_us + 1, shown_us + 1 + shown_count, shown_us);
+  return true;
+}
+
+void screenRender::setRegion(Element element, int32_t x, int32_t y, int32_t w,
+                             int32_t h) {
+  regions[element] = {x, y, w, h, {}, {}, 0, false};
+}
+
+bool screenRender::beginRegion(Element element, uint32_t value) {
+  Region &region = regions[element];
+  if (target != SCREEN_TARGET_BANDS || band_h == 0) {
+    if (!full_redraw && region.valid[drawn] &&
+        region.value[drawn] == value) {
+      return false;
+    }
+    region.value[drawn] = value;
+    region.valid[drawn] = true;
+    damaged |= 1 << element;
+    if (band_h == 0) {
+      return false;  // only looking for what changed
+    }
+  } else if (!full_redraw && !(damaged & (1 << element))) {
+    return false;
+  }
+
+  int32_t y = std::max(region.y, band_y);
+  int32_t h = std::min(region.y + region.h, band_y + band_h) - y;
+  if (h <= 0) {
+    return false;  // in another band
+  }
+  back_buffer->setClipRect(region.x, row(y), region.w, h);
+  if (!full_redraw) {
+    // restore the screen background below the element
+    if (active_state == ScreenState::MainScreen) {
+      assetCache.draw(back_buffer, BACKGROUND, 0, row(0));
+    } else {
+      back_buffer->fillRect(region.x, row(region.y), region.w, region.h,
+                            TFT_BLACK);
+    }
+  }
+  return true;
+}
 
-  M5.Lcd.waitDisplay();
-  back_buffer.pushSprite(&M5.Lcd, 0, 0);
+uint32_t screenRender::frameBytes(int32_t w, int32_t h) {
+  // of the LCD, the sprite may have fewer bits per pixel
+  return (w * h * (M5.Lcd.getColorDepth() & 0xFF) + 7) / 8;
+}
+
+uint32_t screenRender::hashString(const char *str) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  while (*str) {
+    hash = (hash ^ static_cast<uint8_t>(*str++)) * 16777619u;
+  }
+  return hash;
 }
 
 void screenRender::update() {
@@ -180,6 +579,22 @@ void screenRender::update() {
 
   if (!transition) {
     auto pomo = pomodoro.getState();
+    if (pomo != last_pomodoro_state) {
+      if (last_pomodoro_state != PomodoroTimer::PomodoroState::UNDEFINED) {
+        lightsCommand flash = {lightsCommand::Type::Flash};
+        flash.color = pomo == PomodoroTimer::PomodoroState::REST ? CRGB::Green
+                      : pomo == PomodoroTimer::PomodoroState::POMODORO
+                          ? CRGB::Red
+                          : CRGB::White;
+        setLights(flash);
+      }
+      last_pomodoro_state = pomo;
+      renderScheduler.setCountdown(
+          pomo == PomodoroTimer::PomodoroState::POMODORO ||
+          pomo == PomodoroTimer::PomodoroState::REST);
+      renderScheduler.request(RenderScheduler::Reason::State);
+    }
+
     ScreenState newstate;
     switch (pomo) {
       case PomodoroTimer::PomodoroState::PAUSED:
@@ -203,61 +618,100 @@ void screenRender::update() {
 }
 
 void screenRender::renderMainScreen() {
-  back_buffer.fillSprite(TFT_BLACK);
-  back_buffer.drawPngFile(LittleFS, BACKGROUND);
+  if (rendered_state != ScreenState::MainScreen) {
+    rendered_state = ScreenState::MainScreen;
+    invalidate();  // both buffers show the old screen
+    redrawAll();
+  }
 
-  back_buffer.setTextColor(TEXT_COLOR);
-  back_buffer.setFont(LARGE_FONT);
-  back_buffer.setTextSize(2);
-  int timer_text_height = back_buffer.fontHeight();
+  if (full_redraw) {
+    back_buffer->fillSprite(TFT_BLACK);
+    assetCache.draw(back_buffer, BACKGROUND, 0, row(0));
 
-  back_buffer.drawString("TIMER", screen_center_x, screen_center_y);
+    back_buffer->setTextColor(TEXT_COLOR);
+    back_buffer->setFont(LARGE_FONT);
+    back_buffer->setTextSize(2);
+    int timer_text_height = back_buffer->fontHeight();
 
-  back_buffer.setTextSize(1);
-  back_buffer.drawString("POMODORO", screen_center_x,
-                         screen_center_y - timer_text_height / 2);
+    back_buffer->drawString("TIMER", screen_center_x, row(screen_center_y));
 
-  back_buffer.setTextSize(0);
-  back_buffer.setFont(SMALL_FONT);
-  back_buffer.drawString(String(pomodoro_minutes_cfg), 55, 225);
-  back_buffer.drawString("25", 160, 225);
-  back_buffer.drawString("Rest", 270, 225);
+    back_buffer->setTextSize(1);
+    back_buffer->drawString("POMODORO", screen_center_x,
+                            row(screen_center_y - timer_text_height / 2));
 
-  fill_solid(leds, NUM_LEDS, CRGB::Black);
-  FastLED.show();
+    back_buffer->setTextSize(0);
+    back_buffer->setFont(SMALL_FONT);
+    back_buffer->drawString("25", 160, row(225));
+    back_buffer->drawString("Rest", 270, row(225));
+
+    setLights({lightsCommand::Type::Off});
+  }
+
+  if (beginRegion(ConfigMinutes, frame.minutes)) {
+    back_buffer->setTextColor(TEXT_COLOR);
+    back_buffer->setTextSize(0);
+    back_buffer->setFont(SMALL_FONT);
+    back_buffer->drawString(String(frame.minutes), 55, row(225));
+    endRegion();
+  }
 
   pushBackBuffer();
 }
 
 void screenRender::renderPomodoroScreen(bool pause /*= false*/) {
-  back_buffer.fillSprite(TFT_BLACK);
-  back_buffer.setTextColor(TIMER_COLOR);
-  back_buffer.setFont(TIMER_FONT);
-  back_buffer.setTextSize(2);
-  back_buffer.drawString(pomodoro.formattedTime().c_str(), screen_center_x,
-                         screen_center_y);
-
-  switch (pomodoro.getState()) {
+  if (rendered_state != ScreenState::PomodoroScreen) {
+    rendered_state = ScreenState::PomodoroScreen;
+    invalidate();  // both buffers show the old screen
+    redrawAll();
+  }
+
+  if (full_redraw) {
+    back_buffer->fillSprite(TFT_BLACK);
+  }
+
+  back_buffer->setFont(TIMER_FONT);
+  back_buffer->setTextSize(2);
+  int timer_height = back_buffer->fontHeight();
+  const char *time = frame.time;
+  if (beginRegion(TimerDigits, hashString(time))) {
+    if (!glyphCache.draw(back_buffer, TIMER_FONT, 2, TIMER_COLOR, time,
+                         screen_center_x, row(screen_center_y))) {
+      back_buffer->setTextColor(TIMER_COLOR);
+      back_buffer->drawString(time, screen_center_x, row(screen_center_y));
+    }
+    endRegion();
+  }
+
+  String task_name;
+  switch (frame.pomodoro) {
     case PomodoroTimer::PomodoroState::REST:
-      drawTaskName("REST", back_buffer.fontHeight());
+      task_name = "REST";
       break;
     case PomodoroTimer::PomodoroState::PAUSED:
-      drawTaskName("PAUSED", back_buffer.fontHeight());
+      task_name = "PAUSED";
       break;
     case PomodoroTimer::PomodoroState::POMODORO:
-      drawTaskName(description, back_buffer.fontHeight());
+      task_name = description;
     default:
       break;
   }
+  if (beginRegion(TaskName, hashString(task_name.c_str()))) {
+    back_buffer->setTextColor(TIMER_COLOR);
+    drawTaskName(task_name, timer_height);
+    endRegion();
+  }
 
-  int progress = pomodoro.getTimerPercentage();
+  int progress = frame.progress;
 
-  drawProgressBar(0, screen_height - PROGRESS_BAR_HEIGHT, screen_width,
-                  PROGRESS_BAR_HEIGHT, progress, TFT_BLUE);
-  if (pomodoro.getState() == PomodoroTimer::PomodoroState::REST) {
-    setCompletion(progress, CRGB::Green);
+  if (beginRegion(ProgressBar, progress)) {
+    drawProgressBar(0, screen_height - PROGRESS_BAR_HEIGHT, screen_width,
+                    PROGRESS_BAR_HEIGHT, progress, TFT_BLUE);
+    endRegion();
+  }
+  if (frame.pomodoro == PomodoroTimer::PomodoroState::REST) {
+    setCompletion(frame.remaining, CRGB::Green, true);
   } else {
-    setCompletion(progress, CRGB::Red);
+    setCompletion(frame.remaining, CRGB::Red);
   }
 
   pushBackBuffer();
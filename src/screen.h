@@ -12,6 +12,10 @@ Copyright 2023 Sergei Chistokhin
 #include <M5Unified.h>
 #include <PomodoroTimer.h>
 
+#include "./frametime.h"
+#include "./lights.h"
+#include "./target.h"
+
 #define BACKGROUND "/background1.png"
 #define ICON_MQTT "/MQTT.png"
 #define ICON_WIFI "/WIFI.png"
@@ -24,14 +28,30 @@ Copyright 2023 Sergei Chistokhin
 #define TEXT_COLOR TFT_WHITE
 #define TIMER_COLOR TFT_GREEN
 
-// SK6812 LED strip
+// SK6812 LED strip, animated by the lights task, see lights.h
 #define LED_DATA_PIN 25
-#define LED_BRIGHTNESS 20
-#define NUM_LEDS 10
+#define NUM_LEDS LIGHTS_COUNT
 
 #define PROGRESS_BAR_HEIGHT 40
 
+// status bar at the top of the screen
+#define STATUS_BAR_HEIGHT 16
+#define STATUS_BORDER 2
+#define STATUS_ICON_SIZE 10
+#define STATUS_BATTERY_WIDTH 40
+
+#define FRAME_STATS_INTERVAL 100  // frames between render time reports
+
+// back buffers: with 2 the next frame (or band) is drawn while the last
+// one is on its way to the LCD by DMA, with 1 drawing waits for the transfer
+#define SCREEN_BUFFERS 2
+// what the back buffers are, see target.h. Bands fall back to RGB565 if
+// there is no internal RAM for them.
+#define SCREEN_TARGET SCREEN_TARGET_RGB565
+
 extern Ticker sleepTicker;
+// wake_us > 0 - wake up by timer after that many microseconds
+void deepSleep(uint64_t wake_us);
 
 class screenRender {
  public:
@@ -55,34 +75,150 @@ class screenRender {
                     PomodoroTimer::RestLength::REST_SMALL);
   ScreenState getState() const { return active_state; }
   void update();
-  void setTaskName(String taskName) { description = taskName; }
-  String getTaskName() const { return description; }
+  void setTaskName(const char* taskName);
+  void resume(const PomodoroTimer::Snapshot& snapshot, const char* taskName);
+  const String& getTaskName() const { return description; }
+
+  void invalidate() {
+    stale = (1 << SCREEN_BUFFERS) - 1;
+    lcd_stale = true;
+  }
+  uint32_t getBytesPushed() const { return bytes_pushed; }  // last frame
+  uint64_t getBytesPushedTotal() const { return bytes_pushed_total; }
+
+  // true once for every frame rendered, in order, when its pixels are on
+  // the LCD, with the time they got there. Polls the transfer.
+  bool frameShown(uint32_t* at_us);
+  bool transferring() const { return in_flight; }
+  void flush() { finishTransfer(true); }  // waits for the LCD transfer
+  const FrameTiming& getTiming() const { return timing; }
+  int getTarget() const { return target; }
+  void resetTiming() { timing.reset(); }
 
  private:
   ScreenState active_state;
-  M5Canvas back_buffer;
+  M5Canvas buffers[SCREEN_BUFFERS];
+  M5Canvas* back_buffer;  // the one drawn into, the other may be in transfer
+  int back = 0;
+  int target = SCREEN_TARGET;
+#if SCREEN_TARGET == SCREEN_TARGET_BANDS
+  uint16_t* band_memory[SCREEN_BUFFERS] = {};
+#endif
+  // rows drawn in this pass, everything else is clipped. Full screen unless
+  // the target is bands, no rows while the bands find what changed.
+  int32_t band_y = 0;
+  int32_t band_h = 0;
+  // screen row of the first row of the back buffer, the band's for bands.
+  // The drawing code passes its screen rows through row().
+  int32_t origin_y = 0;
+  int32_t bands_end = 0;  // the transfer ending there completes the frame
   int lastrender;
   String description;
   bool transition;  // in transition state, no need to check it
 
+  uint32_t frames = 0;
+  uint32_t render_us = 0;
+
+  // damage tracking: every element remembers its box, the value last drawn
+  // into each buffer and the one on the LCD. Only elements that changed
+  // since the buffer was drawn are redrawn, and only those that differ
+  // from the LCD are pushed. Bands keep nothing between frames, for them
+  // the first value is the one on the LCD.
+  enum Element {
+    TimerDigits,
+    TaskName,
+    ProgressBar,
+    StatusIcons,
+    BatteryText,
+    ConfigMinutes,
+    ElementCount
+  };
+
+  struct Region {
+    int32_t x, y, w, h;
+    uint32_t value[SCREEN_BUFFERS];
+    bool valid[SCREEN_BUFFERS];
+    uint32_t shown;
+    bool shown_valid;
+  };
+
+  Region regions[ElementCount];
+  int drawn = 0;         // index of the values of the buffer drawn into
+  uint32_t damaged = 0;  // bit per element redrawn in this frame
+  bool full_redraw = true;  // of the buffer drawn into
+  uint8_t stale = (1 << SCREEN_BUFFERS) - 1;  // bit per buffer to redraw
+  bool lcd_stale = true;  // the next push has to be the whole buffer
+
+  FrameTiming timing;
+  uint32_t frame_start = 0;
+  bool in_flight = false;  // DMA transfer of the last frame
+  bool transfer_ends_frame = true;  // not a band before the last one
+  uint32_t shown_us[SCREEN_BUFFERS + 1];
+  int shown_count = 0;
+  ScreenState rendered_state = ScreenState::Undefined;
+
+  uint32_t bytes_pushed = 0;
+  uint64_t bytes_pushed_total = 0;
+
   int screen_width;
   int screen_height;
   int screen_center_x;
   int screen_center_y;
 
+  // read once per frame, however many bands draw the status bar
+  struct Status {
+    int battery;
+    int32_t drain;  // mA
+    bool charging;
+    bool wifi;
+    bool mqtt;
+  };
+  Status status = {};
+
+  // the timer as of the start of the frame, the pass that finds what
+  // changed and every band draw the same values
+  struct Frame {
+    PomodoroTimer::PomodoroState pomodoro;
+    char time[TIMER_TEXT_SIZE];
+    int progress;   // %
+    int remaining;  // permille
+    int minutes;    // pomodoro_minutes_cfg
+  };
+  Frame frame = {};
+
   PomodoroTimer::PomodoroState last_pomodoro_state =
       PomodoroTimer::PomodoroState::UNDEFINED;
 
-  CRGB leds[NUM_LEDS];
+  lightsCommand lights_sent = {};  // last command, only changes are sent
+  bool lights_valid = false;
 
   void renderMainScreen();
   void renderPomodoroScreen(bool pause = false);
   void renderSettingsScreen();
+  void renderScreen();
+  void renderBands();
+  void setBand(int32_t y, int32_t h);
 
   void drawProgressBar(int x, int y, int w, int h, int val,
                        int color = TFT_BLUE);
+  void sampleStatus();
+  void sampleFrame();
   void drawStatusIcons();
   void drawTaskName(String task_name, int prev_font_height = 0);
-  void setCompletion(int width, CRGB color = CRGB::White);
+  void setCompletion(int remaining, uint32_t color, bool breathe = false);
+  void setLights(const lightsCommand& command);
   void pushBackBuffer();
+  void redrawAll();
+  bool finishTransfer(bool wait);
+  void frameDone(uint32_t now_us);
+
+  void setRegion(Element element, int32_t x, int32_t y, int32_t w, int32_t h);
+  bool beginRegion(Element element, uint32_t value);
+  void endRegion() {
+    back_buffer->setClipRect(0, row(band_y), screen_width, band_h);
+  }
+  int32_t row(int32_t y) const { return y - origin_y; }
+  uint32_t frameBytes(int32_t w, int32_t h);
+  void pushRows(int32_t y, int32_t h);
+  static uint32_t hashString(const char* str);
 };
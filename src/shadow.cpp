@@ -0,0 +1,273 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./shadow.h"
+
+#include <ArduinoJson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+shadowTopics topics;
+
+// indexed by PomodoroTimer::PomodoroState
+static constexpr const char* const state_names[] = {
+    "UNDEFINED", "POMODORO", "REST", "PAUSED", "STOPPED"};
+static constexpr int state_count =
+    sizeof(state_names) / sizeof(state_names[0]);
+
+// the desired state fields, as listed in the parser filters
+static constexpr const char* const fields[] = {"timer_state", "start",
+                                               "description"};
+static constexpr int field_count = sizeof(fields) / sizeof(fields[0]);
+
+// pool bytes of copies of the strings, the longest one with max
+static constexpr size_t stringsSize(const char* const* strings, int count,
+                                    bool max = false) {
+  size_t size = 0;
+  for (int i = 0; i < count; i++) {
+    size_t length =
+        JSON_STRING_SIZE(std::char_traits<char>::length(strings[i]));
+    size = max ? std::max(size, length) : size + length;
+  }
+  return size;
+}
+
+// root {state, clientToken}, state {reported, desired}, reported
+// {timer_state, start, description, history}, desired {timer_state, start}
+// and the history array of {timer_state, start}. Keys and values are
+// const char*, stored by pointer, so no strings take pool space.
+static constexpr size_t batch_doc_size =
+    JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(4) +
+    JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(SHADOW_HISTORY_LENGTH) +
+    SHADOW_HISTORY_LENGTH * JSON_OBJECT_SIZE(2);
+
+void shadowInitTopics(const char* thing_name) {
+  snprintf(topics.get, sizeof(topics.get), "$aws/things/%s/shadow/get",
+           thing_name);
+  snprintf(topics.get_accepted, sizeof(topics.get_accepted),
+           "$aws/things/%s/shadow/get/accepted", thing_name);
+  snprintf(topics.update, sizeof(topics.update),
+           "$aws/things/%s/shadow/update", thing_name);
+  snprintf(topics.update_accepted, sizeof(topics.update_accepted),
+           "$aws/things/%s/shadow/update/accepted", thing_name);
+  snprintf(topics.update_delta, sizeof(topics.update_delta),
+           "$aws/things/%s/shadow/update/delta", thing_name);
+  snprintf(topics.update_rejected, sizeof(topics.update_rejected),
+           "$aws/things/%s/shadow/update/rejected", thing_name);
+}
+
+const char* shadowStateName(PomodoroTimer::PomodoroState state) {
+  int index = static_cast<int>(state);
+  return index >= 0 && index < state_count ? state_names[index]
+                                           : state_names[0];
+}
+
+PomodoroTimer::PomodoroState shadowParseState(const char* name) {
+  for (int i = 0; name != nullptr && i < state_count; i++) {
+    if (strcmp(state_names[i], name) == 0) {
+      return static_cast<PomodoroTimer::PomodoroState>(i);
+    }
+  }
+  return PomodoroTimer::PomodoroState::UNDEFINED;
+}
+
+size_t shadowEncodeReport(char* buffer, size_t size,
+                          PomodoroTimer::PomodoroState timer_state,
+                          uint32_t start, const char* description,
+                          bool reported, bool desired,
+                          const shadowTransition* history,
+                          size_t history_length, uint32_t client_token) {
+  // const char* values are stored by pointer, nothing is copied
+  StaticJsonDocument<batch_doc_size> doc;
+  const char* state_name = shadowStateName(timer_state);
+  char token[24];
+
+  if (reported) {
+    doc["state"]["reported"]["timer_state"] = state_name;
+    doc["state"]["reported"]["start"] = start;
+    doc["state"]["reported"]["description"] = description;
+    if (history_length > SHADOW_HISTORY_LENGTH) {
+      history = history + history_length - SHADOW_HISTORY_LENGTH;
+      history_length = SHADOW_HISTORY_LENGTH;
+    }
+    if (history_length > 0) {
+      auto array = doc["state"]["reported"].createNestedArray("history");
+      for (size_t i = 0; i < history_length; i++) {
+        auto item = array.createNestedObject();
+        item["timer_state"] = shadowStateName(history[i].timer_state);
+        item["start"] = history[i].start;
+      }
+    }
+  }
+
+  if (desired) {
+    doc["state"]["desired"]["timer_state"] = state_name;
+    doc["state"]["desired"]["start"] = start;
+  }
+
+  if (client_token != 0) {
+    snprintf(token, sizeof(token), SHADOW_TOKEN_PREFIX "%u", client_token);
+    doc["clientToken"] = static_cast<const char*>(token);
+  }
+
+  if (doc.overflowed() || measureJson(doc) >= size) {
+    return 0;
+  }
+  return serializeJson(doc, buffer, size);
+}
+
+// Filters: root {version, clientToken, state, metadata}, the fields and
+// metadata.<field>.timestamp of each field, for get/accepted both under a
+// desired object. Keys are const char*, stored by pointer.
+static constexpr size_t fields_filter_size =
+    2 * JSON_OBJECT_SIZE(field_count) + field_count * JSON_OBJECT_SIZE(1);
+static constexpr size_t desired_filter_size =
+    JSON_OBJECT_SIZE(4) + 2 * JSON_OBJECT_SIZE(1) + fields_filter_size;
+static constexpr size_t delta_filter_size =
+    JSON_OBJECT_SIZE(4) + fields_filter_size;
+
+// Parsed documents hold at most what the filters let through, with
+// copies of every key, the clientToken with a 10 digit number, the longest
+// state name and the description. The parser also reads each key before
+// the filter drops it, that takes room for the longest key.
+static constexpr const char* const root_keys[] = {"version", "clientToken",
+                                                  "state", "metadata"};
+static constexpr size_t key_room = JSON_STRING_SIZE(31);
+static constexpr size_t token_size =
+    JSON_STRING_SIZE(sizeof(SHADOW_TOKEN_PREFIX) - 1 + 10);
+static constexpr size_t fields_doc_size =
+    stringsSize(root_keys, 4) + 2 * stringsSize(fields, field_count) +
+    field_count * JSON_STRING_SIZE(sizeof("timestamp") - 1) + token_size +
+    stringsSize(state_names, state_count, true) +
+    JSON_STRING_SIZE(SHADOW_DESCRIPTION_LENGTH) + key_room;
+static constexpr size_t desired_doc_size =
+    desired_filter_size + 2 * JSON_STRING_SIZE(sizeof("desired") - 1) +
+    fields_doc_size;
+static constexpr size_t delta_doc_size = delta_filter_size + fields_doc_size;
+static constexpr const char* const response_keys[] = {"clientToken", "code"};
+static constexpr size_t response_filter_size = JSON_OBJECT_SIZE(2);
+static constexpr size_t response_doc_size =
+    response_filter_size + stringsSize(response_keys, 2) + token_size +
+    key_room;
+
+static void addFields(JsonObject filter) {
+  for (const char* field : fields) {
+    filter[field] = true;
+  }
+}
+
+// metadata.<field>.timestamp of each field
+static void addTimestamps(JsonObject metadata) {
+  for (const char* field : fields) {
+    metadata[field]["timestamp"] = true;
+  }
+}
+
+static const JsonDocument& desiredFilter() {
+  static StaticJsonDocument<desired_filter_size> filter;
+  if (filter.isNull()) {
+    filter["version"] = true;
+    filter["clientToken"] = true;
+    addFields(filter["state"].createNestedObject("desired"));
+    addTimestamps(filter["metadata"].createNestedObject("desired"));
+  }
+  return filter;
+}
+
+static const JsonDocument& deltaFilter() {
+  static StaticJsonDocument<delta_filter_size> filter;
+  if (filter.isNull()) {
+    filter["version"] = true;
+    filter["clientToken"] = true;
+    addFields(filter.createNestedObject("state"));
+    addTimestamps(filter.createNestedObject("metadata"));
+  }
+  return filter;
+}
+
+static const JsonDocument& responseFilter() {
+  static StaticJsonDocument<response_filter_size> filter;
+  if (filter.isNull()) {
+    for (const char* key : response_keys) {
+      filter[key] = true;
+    }
+  }
+  return filter;
+}
+
+static uint32_t parseToken(const char* token) {
+  const size_t prefix = sizeof(SHADOW_TOKEN_PREFIX) - 1;
+  return token != nullptr && strncmp(token, SHADOW_TOKEN_PREFIX, prefix) == 0
+             ? strtoul(token + prefix, nullptr, 10)
+             : 0;
+}
+
+static void decodeFields(const JsonDocument& doc, JsonObjectConst state,
+                         JsonObjectConst metadata, shadowDesired* desired) {
+  const char* timer_state = state["timer_state"];
+  desired->has_timer_state = timer_state != nullptr;
+  desired->timer_state = shadowParseState(timer_state);
+  desired->has_start = state.containsKey("start");
+  desired->start = state["start"] | 0;
+
+  const char* description = state["description"];
+  desired->has_description = description != nullptr;
+  snprintf(desired->description, sizeof(desired->description), "%s",
+           description ? description : "");
+
+  desired->version = doc["version"] | 0;
+  // the latest write of the fields present, the document time says when the
+  // shadow answered, not when the desired state was written
+  desired->updated = 0;
+  for (const char* field : fields) {
+    uint32_t timestamp = metadata[field]["timestamp"] | 0u;
+    if (state.containsKey(field) && timestamp > desired->updated) {
+      desired->updated = timestamp;
+    }
+  }
+
+  desired->client_token = parseToken(doc["clientToken"]);
+}
+
+bool shadowDecodeDesired(const char* payload, size_t length,
+                         shadowDesired* desired) {
+  StaticJsonDocument<desired_doc_size> doc;
+  if (deserializeJson(doc, payload, length,
+                      DeserializationOption::Filter(desiredFilter()))) {
+    return false;
+  }
+  decodeFields(doc, doc["state"]["desired"], doc["metadata"]["desired"],
+               desired);
+  return true;
+}
+
+bool shadowDecodeDelta(const char* payload, size_t length,
+                       shadowDesired* desired) {
+  StaticJsonDocument<delta_doc_size> doc;
+  if (deserializeJson(doc, payload, length,
+                      DeserializationOption::Filter(deltaFilter()))) {
+    return false;
+  }
+  decodeFields(doc, doc["state"], doc["metadata"], desired);
+  return true;
+}
+
+bool shadowDecodeResponse(const char* payload, size_t length,
+                          shadowResponse* response) {
+  StaticJsonDocument<response_doc_size> doc;
+  if (deserializeJson(doc, payload, length,
+                      DeserializationOption::Filter(responseFilter()))) {
+    return false;
+  }
+  response->client_token = parseToken(doc["clientToken"]);
+  response->code = doc["code"] | 0u;
+  return true;
+}
@@ -0,0 +1,88 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./PomodoroTimer.h"
+
+// JSON codec for the AWS IoT device shadow, shared by the firmware and the
+// native build. Nothing here touches the heap: topics are built once,
+// documents live on the stack and state names come from a constant table.
+
+#define SHADOW_TOPIC_LENGTH 96
+#define SHADOW_DESCRIPTION_LENGTH 128
+#define SHADOW_HISTORY_LENGTH 8  // transitions batched into one update
+#define SHADOW_UPDATE_SIZE 1024  // encoded update with a full history
+#define SHADOW_TOKEN_PREFIX "outbox-"  // clientToken of our own updates
+
+struct shadowTopics {
+  char get[SHADOW_TOPIC_LENGTH];
+  char get_accepted[SHADOW_TOPIC_LENGTH];
+  char update[SHADOW_TOPIC_LENGTH];
+  char update_accepted[SHADOW_TOPIC_LENGTH];
+  char update_delta[SHADOW_TOPIC_LENGTH];
+  char update_rejected[SHADOW_TOPIC_LENGTH];
+};
+
+extern shadowTopics topics;
+
+// a delta only carries the fields that differ from the reported state
+struct shadowDesired {
+  PomodoroTimer::PomodoroState timer_state;
+  uint32_t start;
+  bool has_timer_state;
+  bool has_start;
+  bool has_description;
+  char description[SHADOW_DESCRIPTION_LENGTH];
+  uint32_t version;       // of the shadow document, 0 - not present
+  uint32_t updated;       // epoch the fields were written, 0 - unknown
+  uint32_t client_token;  // of our own update, 0 - someone else's or none
+};
+
+// update/accepted or update/rejected of one of our updates
+struct shadowResponse {
+  uint32_t client_token;  // 0 - someone else's update or none
+  uint32_t code;          // error code of update/rejected, 0 - accepted
+};
+
+struct shadowTransition {
+  PomodoroTimer::PomodoroState timer_state;
+  uint32_t start;
+};
+
+// builds $aws/things/<thing_name>/shadow/... topics, call once from setup()
+void shadowInitTopics(const char* thing_name);
+
+const char* shadowStateName(PomodoroTimer::PomodoroState state);
+PomodoroTimer::PomodoroState shadowParseState(const char* name);
+
+// builds a shadow update with the state.reported and / or state.desired
+// sections, returns the length of the document or 0 if it doesn't fit.
+// history (oldest first) goes to state.reported.history, a non-zero
+// client_token is echoed back on update/accepted
+size_t shadowEncodeReport(char* buffer, size_t size,
+                          PomodoroTimer::PomodoroState timer_state,
+                          uint32_t start, const char* description,
+                          bool reported, bool desired,
+                          const shadowTransition* history = nullptr,
+                          size_t history_length = 0,
+                          uint32_t client_token = 0);
+
+// extracts state.desired.{timer_state,start,description}, the version and
+// our clientToken from a full shadow document (get/accepted), everything
+// else is skipped by the parser filter
+bool shadowDecodeDesired(const char* payload, size_t length,
+                         shadowDesired* desired);
+// the same for update/delta, where the fields are directly in state
+bool shadowDecodeDelta(const char* payload, size_t length,
+                       shadowDesired* desired);
+// the clientToken and the error code of update/accepted or update/rejected,
+// the state echoed back by update/accepted is skipped
+bool shadowDecodeResponse(const char* payload, size_t length,
+                          shadowResponse* response);
@@ -0,0 +1,168 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./sound.h"
+
+#include <LittleFS.h>
+#include <M5Unified.h>
+#include <string.h>
+
+#include "./debug.h"
+#include "./hal.h"
+#include "./metrics.h"
+
+SoundEngine soundEngine;
+
+SoundEngine::bankEntry* SoundEngine::find(const char* sound) {
+  for (int i = 0; i < sound_count; i++) {
+    if (strcmp(sounds[i].path, sound) == 0) {
+      return &sounds[i];
+    }
+  }
+  return nullptr;
+}
+
+bool SoundEngine::load(const char* sound) {
+  // only the header is kept in memory, samples are streamed on playback
+  if (find(sound) != nullptr) {
+    return true;
+  }
+  if (sound_count >= SOUND_BANK_SIZE) {
+    DEBUG_PRINTLN("SoundEngine bank full, can't load " + String(sound));
+    return false;
+  }
+
+  int32_t size = hal::fs().size(sound);
+  if (size < 0) {
+    DEBUG_PRINTF("Failed to open %s for reading\n", sound);
+    return false;
+  }
+
+  bankEntry* entry = &sounds[sound_count];
+  auto read = hal::fs().read(sound, 0,
+                             reinterpret_cast<uint8_t*>(&entry->header),
+                             sizeof(imaHeader));
+  if (read != sizeof(imaHeader) ||
+      memcmp(entry->header.magic, IMA_MAGIC, 4) != 0) {
+    DEBUG_PRINTF("%s is not an IMA-ADPCM file\n", sound);
+    return false;
+  }
+  entry->path = sound;
+  sound_count++;
+
+  DEBUG_PRINTF(
+      "Sound %s: %u samples @ %u Hz, flash %u bytes, PCM %u bytes, "
+      "resident %u bytes\n",
+      sound, entry->header.samples, entry->header.sample_rate, size,
+      entry->header.samples * sizeof(int16_t), sizeof(bankEntry));
+  DEBUG_PRINTF("SoundEngine stream buffers: %u bytes\n",
+               sizeof(buffers) + sizeof(chunk));
+  return true;
+}
+
+bool SoundEngine::open(const char* sound) {
+  if (!load(sound)) {
+    return false;
+  }
+  const bankEntry* entry = find(sound);
+
+  if (stream) {
+    stream.close();
+  }
+  stream = LittleFS.open(sound, "r");
+  if (!stream || !stream.seek(sizeof(imaHeader))) {
+    DEBUG_PRINTF("Failed to open %s for streaming\n", sound);
+    stream_left = 0;
+    return false;
+  }
+  stream_state = {entry->header.predictor, entry->header.index};
+  stream_rate = entry->header.sample_rate;
+  stream_left = entry->header.samples;
+  return true;
+}
+
+void SoundEngine::feed() {
+  // keep the speaker queue full, at most one chunk is decoded per call
+  if (stream_left == 0 || M5.Speaker.isPlaying(SOUND_CHANNEL) >= 2) {
+    return;
+  }
+
+  size_t bytes = stream.read(chunk, sizeof(chunk));
+  size_t samples = adpcmDecode(chunk, bytes, buffers[next_buffer],
+                               &stream_state);
+  if (samples > stream_left) {
+    samples = stream_left;  // odd number of samples, last nibble is padding
+  }
+  if (samples == 0) {
+    stream_left = 0;
+  } else {
+    M5.Speaker.playRaw(buffers[next_buffer], samples, stream_rate, false, 1,
+                       SOUND_CHANNEL, false);
+    next_buffer = (next_buffer + 1) % SOUND_BUFFERS;
+    stream_left -= samples;
+  }
+
+  if (stream_left == 0) {
+    stream.close();
+  }
+}
+
+bool SoundEngine::play(const PlayRequest& request) {
+  int next = (tail + 1) % SOUND_QUEUE_SIZE;
+  if (next == head) {
+    DEBUG_PRINTLN("SoundEngine queue full");
+    return false;
+  }
+  queue[tail] = request;
+  tail = next;
+  return true;
+}
+
+bool SoundEngine::play(const char* sound, uint8_t repeats, uint16_t gap_ms,
+                       uint8_t vibration, uint16_t vibration_ms) {
+  return play({sound, repeats, gap_ms, vibration, vibration_ms});
+}
+
+void SoundEngine::update() {
+  METRIC_SCOPE(Sound);
+  uint32_t now = millis();
+
+  if (!active && head != tail) {
+    current = queue[head];
+    head = (head + 1) % SOUND_QUEUE_SIZE;
+    remaining = current.repeats;
+    next_start = now;
+    active = true;
+  }
+
+  if (active && static_cast<int32_t>(now - next_start) >= 0) {
+    if (remaining == 0) {  // gap after the last repeat is over
+      active = false;
+    } else {
+      if (current.sound != nullptr) {
+        M5.Speaker.stop(SOUND_CHANNEL);
+        open(current.sound);
+      }
+      if (current.vibration > 0 && current.vibration_ms > 0) {
+        if (!vibrating) {
+          M5.Power.setVibration(current.vibration);
+          vibrating = true;
+        }
+        vibration_end = now + current.vibration_ms;
+      }
+      remaining--;
+      next_start = now + current.gap_ms;
+    }
+  }
+
+  if (vibrating && static_cast<int32_t>(now - vibration_end) >= 0) {
+    M5.Power.setVibration(0);
+    vibrating = false;
+  }
+
+  feed();
+}
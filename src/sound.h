@@ -0,0 +1,79 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <LittleFS.h>
+#include <stdint.h>
+
+#include "./adpcm.h"
+
+#define SOUND_QUEUE_SIZE 4
+#define SOUND_BANK_SIZE 3
+
+// sounds are streamed from flash: SOUND_BUFFERS chunks of decoded PCM,
+// two of them can sit in the speaker queue while the next one is decoded
+#define SOUND_CHANNEL 0
+#define SOUND_BUFFERS 3
+#define SOUND_CHUNK 1024  // samples
+
+#define VIBRATION_LEVEL 128
+
+// Asynchronous sound and vibration queue. play() only enqueues a request,
+// update() is called from loop() and starts sounds / switches the vibration
+// motor when their time comes, so nothing ever waits with delay()
+class SoundEngine {
+ public:
+  struct PlayRequest {
+    const char* sound;      // IMA file on LittleFS, nullptr for vibration only
+    uint8_t repeats;        // number of times the sound is played
+    uint16_t gap_ms;        // time between the starts of two repeats
+    uint8_t vibration;      // vibration motor level, 0 - off
+    uint16_t vibration_ms;  // vibration pulse length for every repeat
+  };
+
+  bool load(const char* sound);
+  bool play(const PlayRequest& request);
+  bool play(const char* sound, uint8_t repeats = 1, uint16_t gap_ms = 500,
+            uint8_t vibration = VIBRATION_LEVEL, uint16_t vibration_ms = 500);
+  void update();
+  bool isBusy() const { return active || head != tail || stream_left > 0; }
+
+ private:
+  struct bankEntry {
+    const char* path;
+    imaHeader header;
+  };
+
+  bankEntry sounds[SOUND_BANK_SIZE];
+  int sound_count = 0;
+
+  // currently streamed sound
+  File stream;
+  adpcmState stream_state;
+  uint32_t stream_rate = 0;
+  uint32_t stream_left = 0;  // samples
+  int16_t buffers[SOUND_BUFFERS][SOUND_CHUNK];
+  uint8_t chunk[SOUND_CHUNK / 2];
+  int next_buffer = 0;
+
+  PlayRequest queue[SOUND_QUEUE_SIZE];
+  int head = 0;
+  int tail = 0;
+
+  bool active = false;
+  PlayRequest current;
+  uint8_t remaining = 0;
+  uint32_t next_start = 0;
+  bool vibrating = false;
+  uint32_t vibration_end = 0;
+
+  bankEntry* find(const char* sound);
+  bool open(const char* sound);
+  void feed();
+};
+
+extern SoundEngine soundEngine;
@@ -0,0 +1,63 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./target.h"
+
+#include <algorithm>
+
+uint8_t targetColor332(uint16_t rgb565) {
+  return ((rgb565 >> 8) & 0xE0) | ((rgb565 >> 6) & 0x1C) |
+         ((rgb565 >> 3) & 0x03);
+}
+
+uint16_t targetColor565(uint8_t rgb332) {
+  uint16_t r = rgb332 >> 5, g = (rgb332 >> 2) & 0x07, b = rgb332 & 0x03;
+  r = (r << 2) | (r >> 1);
+  g = (g << 3) | g;
+  b = (b << 3) | (b << 1) | (b >> 1);
+  return (r << 11) | (g << 5) | b;
+}
+
+const char* targetName(int target) {
+  switch (target) {
+    case SCREEN_TARGET_RGB565:
+      return "rgb565";
+    case SCREEN_TARGET_RGB332:
+      return "rgb332";
+    case SCREEN_TARGET_BANDS:
+      return "bands";
+    default:
+      return "?";
+  }
+}
+
+size_t targetMemory(int target, int width, int height, int buffers) {
+  switch (target) {
+    case SCREEN_TARGET_RGB332:
+      return static_cast<size_t>(width) * height * buffers;
+    case SCREEN_TARGET_BANDS:
+      return static_cast<size_t>(width) *
+             std::min(height, SCREEN_BAND_HEIGHT) * 2 * buffers;
+    default:
+      return static_cast<size_t>(width) * height * 2 * buffers;
+  }
+}
+
+int targetBands(const targetRows* damage, int count, int height,
+                int16_t* bands, int max_bands) {
+  int found = 0;
+  for (int y = 0; y < height && found < max_bands; y += SCREEN_BAND_HEIGHT) {
+    int end = std::min(y + SCREEN_BAND_HEIGHT, height);
+    for (int i = 0; i < count; i++) {
+      if (damage[i].y < end && damage[i].y + damage[i].h > y) {
+        bands[found++] = y;
+        break;
+      }
+    }
+  }
+  return found;
+}
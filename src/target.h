@@ -0,0 +1,46 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Render targets of the screen, chosen at compile time with SCREEN_TARGET
+// in screen.h:
+//   RGB565 - full screen 16 bit sprites in PSRAM, pushed as they are
+//   RGB332 - full screen 8 bit sprites in PSRAM, half the memory and PSRAM
+//            reads, converted to 16 bit on the push. The UI colors (black,
+//            white, pure red, green and blue) are exact in it.
+//   BANDS  - SCREEN_BAND_HEIGHT rows of 16 bit in internal DMA capable RAM,
+//            the screen is drawn band by band and only the bands with
+//            changed elements are drawn at all. Falls back to RGB565 if
+//            the band buffers can't be allocated.
+// Portable, the sprites are in screen.cpp.
+
+#define SCREEN_TARGET_RGB565 0
+#define SCREEN_TARGET_RGB332 1
+#define SCREEN_TARGET_BANDS 2
+#define SCREEN_BAND_HEIGHT 24  // rows, 15 KB per band at 320 px
+
+// rows of the screen
+struct targetRows {
+  int16_t y;
+  int16_t h;
+};
+
+// the bits are replicated on the way back, so full intensities stay exact
+uint8_t targetColor332(uint16_t rgb565);
+uint16_t targetColor565(uint8_t rgb332);
+
+const char* targetName(int target);
+// bytes of all render targets
+size_t targetMemory(int target, int width, int height, int buffers);
+
+// first rows of the bands that touch any of the damaged rows, in order,
+// returns their number
+int targetBands(const targetRows* damage, int count, int height,
+                int16_t* bands, int max_bands);
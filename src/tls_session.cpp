@@ -0,0 +1,179 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include "./tls_session.h"
+
+#include <WiFi.h>
+#include <fcntl.h>
+#include <lwip/sockets.h>
+#include <mbedtls/net_sockets.h>
+#include <string.h>
+
+#include "./debug.h"
+
+// the verify callback only runs on a certificate the server sent, so in a
+// full handshake
+static int countVerify(void* calls, mbedtls_x509_crt*, int, uint32_t*) {
+  (*static_cast<uint32_t*>(calls))++;
+  return 0;  // the flags are left to the CA chain check
+}
+
+ResumingClient::ResumingClient(tlsSessionCache* cache) : cache(cache) {}
+
+int ResumingClient::connect(const char* host, uint16_t port) {
+  stop();  // whatever is left of the last connection
+  IPAddress ip;
+  if (!WiFi.hostByName(host, ip)) {
+    stats.failures++;
+    return 0;
+  }
+  int ret = handshake(ip, port, host);
+  _lastError = ret;
+  if (ret < 0) {
+    DEBUG_PRINTF("TLS handshake failed: -0x%04x\n", -ret);
+    stats.failures++;
+    stop();
+    return 0;
+  }
+  _connected = true;
+  return 1;
+}
+
+int ResumingClient::handshake(IPAddress ip, uint16_t port, const char* host) {
+  // as start_ssl_client() in the core, with the session offered before
+  // the handshake
+  sslclient_context* ssl = sslclient;
+  ssl_init(ssl);
+  mbedtls_entropy_init(&ssl->entropy_ctx);
+  mbedtls_x509_crt_init(&ssl->ca_cert);
+  mbedtls_x509_crt_init(&ssl->client_cert);
+  mbedtls_pk_init(&ssl->client_key);
+
+  int timeout = _timeout > 0 ? _timeout : 30000;  // ms
+  ssl->socket = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (ssl->socket < 0) {
+    return ssl->socket;
+  }
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = ip;
+  address.sin_port = htons(port);
+  struct timeval tv = {timeout / 1000, (timeout % 1000) * 1000};
+  fcntl(ssl->socket, F_SETFL, fcntl(ssl->socket, F_GETFL, 0) | O_NONBLOCK);
+  int ret = lwip_connect(ssl->socket, (struct sockaddr*)&address,
+                         sizeof(address));
+  if (ret < 0 && errno != EINPROGRESS) {
+    return -1;
+  }
+  fd_set writable;
+  FD_ZERO(&writable);
+  FD_SET(ssl->socket, &writable);
+  int error = 0;
+  socklen_t length = sizeof(error);
+  if (select(ssl->socket + 1, nullptr, &writable, nullptr, &tv) <= 0 ||
+      getsockopt(ssl->socket, SOL_SOCKET, SO_ERROR, &error, &length) < 0 ||
+      error != 0) {
+    return -1;
+  }
+  fcntl(ssl->socket, F_SETFL, fcntl(ssl->socket, F_GETFL, 0) & ~O_NONBLOCK);
+  lwip_setsockopt(ssl->socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  lwip_setsockopt(ssl->socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  int enable = 1;
+  lwip_setsockopt(ssl->socket, IPPROTO_TCP, TCP_NODELAY, &enable,
+                  sizeof(enable));
+
+  verified = 0;
+  if ((ret = mbedtls_ctr_drbg_seed(&ssl->drbg_ctx, mbedtls_entropy_func,
+                                   &ssl->entropy_ctx, nullptr, 0)) != 0 ||
+      (ret = mbedtls_ssl_config_defaults(
+           &ssl->ssl_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+           MBEDTLS_SSL_PRESET_DEFAULT)) != 0 ||
+      (ret = mbedtls_x509_crt_parse(
+           &ssl->ca_cert, reinterpret_cast<const uint8_t*>(_CA_cert),
+           strlen(_CA_cert) + 1)) != 0 ||
+      (ret = mbedtls_x509_crt_parse(
+           &ssl->client_cert, reinterpret_cast<const uint8_t*>(_cert),
+           strlen(_cert) + 1)) != 0 ||
+      (ret = mbedtls_pk_parse_key(
+           &ssl->client_key, reinterpret_cast<const uint8_t*>(_private_key),
+           strlen(_private_key) + 1, nullptr, 0)) != 0) {
+    return ret;
+  }
+  mbedtls_ssl_conf_authmode(&ssl->ssl_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+  mbedtls_ssl_conf_ca_chain(&ssl->ssl_conf, &ssl->ca_cert, nullptr);
+  mbedtls_ssl_conf_verify(&ssl->ssl_conf, countVerify, &verified);
+  mbedtls_ssl_conf_rng(&ssl->ssl_conf, mbedtls_ctr_drbg_random,
+                       &ssl->drbg_ctx);
+  if ((ret = mbedtls_ssl_conf_own_cert(&ssl->ssl_conf, &ssl->client_cert,
+                                       &ssl->client_key)) != 0 ||
+      (ret = mbedtls_ssl_setup(&ssl->ssl_ctx, &ssl->ssl_conf)) != 0 ||
+      (ret = mbedtls_ssl_set_hostname(&ssl->ssl_ctx, host)) != 0) {
+    return ret;
+  }
+  bool offered = offer();
+  mbedtls_ssl_set_bio(&ssl->ssl_ctx, &ssl->socket, mbedtls_net_send,
+                      mbedtls_net_recv, nullptr);
+
+  uint32_t start = millis();
+  while ((ret = mbedtls_ssl_handshake(&ssl->ssl_ctx)) != 0) {
+    if (ret != MBEDTLS_ERR_SSL_WANT_READ &&
+        ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      if (offered) {
+        forget();  // a session the server chokes on isn't offered again
+      }
+      return ret;
+    }
+    if (millis() - start > ssl->handshake_timeout) {
+      return -1;
+    }
+    vTaskDelay(2);
+  }
+
+  if (verified > 0) {
+    stats.full++;
+    if (offered) {
+      stats.fallbacks++;
+    }
+  } else {
+    stats.resumed++;
+  }
+  save();
+  return 0;
+}
+
+bool ResumingClient::offer() {
+  if (cache->magic != TLS_SESSION_MAGIC) {
+    return false;
+  }
+  mbedtls_ssl_session session;
+  mbedtls_ssl_session_init(&session);
+  bool offered =
+      mbedtls_ssl_session_load(&session, cache->data, cache->length) == 0 &&
+      mbedtls_ssl_set_session(&sslclient->ssl_ctx, &session) == 0;
+  mbedtls_ssl_session_free(&session);
+  if (!offered) {
+    forget();
+  }
+  return offered;
+}
+
+void ResumingClient::save() {
+  mbedtls_ssl_session session;
+  mbedtls_ssl_session_init(&session);
+  size_t length = 0;
+  if (mbedtls_ssl_get_session(&sslclient->ssl_ctx, &session) == 0 &&
+      mbedtls_ssl_session_save(&session, cache->data, sizeof(cache->data),
+                               &length) == 0) {
+    cache->length = length;
+    cache->magic = TLS_SESSION_MAGIC;
+  } else {
+    DEBUG_PRINTF("TLS session of %u bytes not saved\n", length);
+    stats.unsaved++;
+    forget();
+  }
+  mbedtls_ssl_session_free(&session);
+}
@@ -0,0 +1,54 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+#include <WiFiClientSecure.h>
+#include <stdint.h>
+
+// serialized mbedTLS session, the peer certificate is part of it
+#define TLS_SESSION_SIZE 2048
+#define TLS_SESSION_MAGIC 0x544C5353  // "TLSS"
+
+// the last negotiated session, kept in RTC memory through deep sleep
+struct tlsSessionCache {
+  uint32_t magic;
+  uint16_t length;
+  uint8_t data[TLS_SESSION_SIZE];
+};
+
+struct tlsSessionStats {
+  uint32_t full = 0;       // handshakes with the certificate exchange
+  uint32_t resumed = 0;    // handshakes that took the cached session
+  uint32_t fallbacks = 0;  // a session was offered, the server declined it
+  uint32_t failures = 0;   // connects that failed
+  uint32_t unsaved = 0;    // sessions that didn't fit into the cache
+};
+
+// WiFiClientSecure that offers the cached session on connect, so a
+// reconnect after a Wi-Fi drop or a deep sleep can skip the certificate
+// exchange. The core sets up and runs the handshake in one call,
+// start_ssl_client(), with no step in between for mbedtls_ssl_set_session(),
+// so connect() does the same setup here on the client's own sslclient
+// context. Reading, writing and stop() are left to WiFiClientSecure.
+// Only the CA and client certificate setup the firmware uses is supported.
+class ResumingClient : public WiFiClientSecure {
+ public:
+  explicit ResumingClient(tlsSessionCache* cache);
+
+  int connect(const char* host, uint16_t port) override;
+  void forget() { cache->magic = 0; }  // the next handshake is a full one
+  const tlsSessionStats& getStats() const { return stats; }
+
+ private:
+  tlsSessionCache* cache;
+  tlsSessionStats stats;
+  uint32_t verified = 0;  // certificates checked in this handshake
+
+  int handshake(IPAddress ip, uint16_t port, const char* host);
+  bool offer();
+  void save();
+};
@@ -0,0 +1,118 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <math.h>
+#include <unity.h>
+
+#include <vector>
+
+#include "../../src/adpcm.h"
+#include "./tests.h"
+
+static const int16_t steps[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+    19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+    337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+    876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+    5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+// the encoder of scripts/soundbank.py, which also yields the samples a
+// matching decoder has to reproduce
+static std::vector<uint8_t> encode(const std::vector<int16_t>& pcm,
+                                   std::vector<int16_t>* expected) {
+  const int adjust[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+  std::vector<uint8_t> out((pcm.size() + 1) / 2);
+  int32_t predictor = 0;
+  int index = 0;
+  for (size_t i = 0; i < pcm.size(); i++) {
+    int32_t step = steps[index];
+    int32_t diff = pcm[i] - predictor;
+    uint8_t code = 0;
+    if (diff < 0) {
+      code = 8;
+      diff = -diff;
+    }
+    int32_t vpdiff = step >> 3;
+    for (uint8_t bit = 4; bit > 0; bit >>= 1, step >>= 1) {
+      if (diff >= step) {
+        code |= bit;
+        diff -= step;
+        vpdiff += step;
+      }
+    }
+    predictor += code & 8 ? -vpdiff : vpdiff;
+    predictor = predictor > 32767 ? 32767 : predictor;
+    predictor = predictor < -32768 ? -32768 : predictor;
+    index += adjust[code & 7];
+    index = index < 0 ? 0 : index > 88 ? 88 : index;
+    out[i / 2] |= i % 2 ? code << 4 : code;
+    expected->push_back(predictor);
+  }
+  return out;
+}
+
+void test_adpcm_known_codes() {
+  // code 7 from rest with step 7 adds 0 + 7 + 3 + 1, then at index 8
+  // (step 16) 2 + 16 + 8 + 4. Code 9 at index 16 (step 34) subtracts
+  // 4 + 8, code 0 at index 15 (step 31) adds 3.
+  const uint8_t in[] = {0x77, 0x09};
+  int16_t out[4];
+  adpcmState state = {0, 0};
+  TEST_ASSERT_EQUAL_UINT32(4, adpcmDecode(in, sizeof(in), out, &state));
+  TEST_ASSERT_EQUAL_INT16(11, out[0]);
+  TEST_ASSERT_EQUAL_INT16(41, out[1]);
+  TEST_ASSERT_EQUAL_INT16(29, out[2]);
+  TEST_ASSERT_EQUAL_INT16(32, out[3]);
+  TEST_ASSERT_EQUAL_INT16(32, state.predictor);
+  TEST_ASSERT_EQUAL_UINT8(14, state.index);
+
+  // the predictor and the index saturate
+  const uint8_t loud[] = {0x77};
+  state = {32760, 88};
+  adpcmDecode(loud, sizeof(loud), out, &state);
+  TEST_ASSERT_EQUAL_INT16(32767, out[0]);
+  TEST_ASSERT_EQUAL_INT16(32767, out[1]);
+  TEST_ASSERT_EQUAL_UINT8(88, state.index);
+}
+
+void test_adpcm_reference() {
+  // half a second of two tones under a swelling envelope at 16 kHz, like
+  // the dings, decoded in two chunks as the sound task streams them
+  const uint32_t rate = 16000, count = rate / 2;
+  std::vector<int16_t> pcm(count);
+  for (uint32_t i = 0; i < count; i++) {
+    double t = static_cast<double>(i) / rate;
+    double envelope = sin(M_PI * i / count);
+    pcm[i] = static_cast<int16_t>(
+        envelope * (12000 * sin(2 * M_PI * 440 * t) +
+                    6000 * sin(2 * M_PI * 1320 * t)));
+  }
+  std::vector<int16_t> expected;
+  std::vector<uint8_t> data = encode(pcm, &expected);
+
+  std::vector<int16_t> out(count);
+  adpcmState state = {0, 0};
+  size_t half = data.size() / 2;
+  size_t decoded = adpcmDecode(data.data(), half, out.data(), &state);
+  decoded += adpcmDecode(data.data() + half, data.size() - half,
+                         out.data() + decoded, &state);
+  TEST_ASSERT_EQUAL_UINT32(count, decoded);
+  TEST_ASSERT_EQUAL_INT16_ARRAY(expected.data(), out.data(), count);
+
+  // and it is still the sound that went in
+  double signal = 0, noise = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    signal += static_cast<double>(pcm[i]) * pcm[i];
+    noise += static_cast<double>(out[i] - pcm[i]) * (out[i] - pcm[i]);
+  }
+  float snr = 10 * log10(signal / noise);
+  TEST_ASSERT_GREATER_THAN(25, static_cast<int>(snr));
+}
@@ -0,0 +1,30 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <unity.h>
+
+#include "../../src/png.h"
+#include "./tests.h"
+
+void test_png_size() {
+  // the asset cache sizes its sprites from the header of the files in data/
+  int32_t width = 0, height = 0;
+  TEST_ASSERT_TRUE(pngSize("/background.png", &width, &height));
+  TEST_ASSERT_EQUAL_INT32(320, width);
+  TEST_ASSERT_EQUAL_INT32(240, height);
+  TEST_ASSERT_TRUE(pngSize("/WIFI.png", &width, &height));
+  TEST_ASSERT_EQUAL_INT32(10, width);
+  TEST_ASSERT_EQUAL_INT32(10, height);
+}
+
+void test_png_size_rejects() {
+  int32_t width = -1, height = -1;
+  TEST_ASSERT_FALSE(pngSize("/missing.png", &width, &height));
+  TEST_ASSERT_FALSE(pngSize("/ding.wav", &width, &height));
+  TEST_ASSERT_EQUAL_INT32(-1, width);
+  TEST_ASSERT_EQUAL_INT32(-1, height);
+}
@@ -0,0 +1,173 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <string.h>
+#include <unity.h>
+
+#include "../../src/discipline.h"
+#include "./tests.h"
+
+// server side of one exchange, t2 - receive, t3 - transmit
+static void ntpReply(const uint8_t* request, int64_t t2, int64_t t3,
+                     uint8_t* reply) {
+  uint8_t stamp[NTP_PACKET_SIZE];
+  memset(reply, 0, NTP_PACKET_SIZE);
+  reply[0] = 0x24;  // version 4, server
+  reply[1] = 2;     // stratum
+  memcpy(reply + 24, request + 40, 8);
+  ntpEncodeRequest(stamp, t2);  // a transmit timestamp is a timestamp
+  memcpy(reply + 32, stamp + 40, 8);
+  ntpEncodeRequest(stamp, t3);
+  memcpy(reply + 40, stamp + 40, 8);
+}
+
+// stands in for RTC memory
+static clockState state;
+
+void test_clock_ntp() {
+  // the local clock is 250 ms behind, 20 ms out and 30 ms back
+  const int64_t t1 = 1700000000ll * 1000000;
+  uint8_t request[NTP_PACKET_SIZE], reply[NTP_PACKET_SIZE];
+  ntpEncodeRequest(request, t1);
+  ntpReply(request, t1 + 250000 + 20000, t1 + 250000 + 20100, reply);
+  clockSample sample;
+  TEST_ASSERT_TRUE(ntpDecodeResponse(reply, sizeof(reply), t1,
+                                     t1 + 20000 + 100 + 30000, &sample));
+  TEST_ASSERT_INT_WITHIN(5000 + 1, 250000, sample.offset);
+  TEST_ASSERT_INT_WITHIN(1, 50000, sample.delay);
+
+  // a reply to another request or from an unsynchronized server
+  TEST_ASSERT_FALSE(
+      ntpDecodeResponse(reply, sizeof(reply), t1 + 1000000, t1, &sample));
+  reply[1] = 0;  // kiss-o'-death
+  TEST_ASSERT_FALSE(ntpDecodeResponse(reply, sizeof(reply), t1, t1, &sample));
+}
+
+void test_clock_step() {
+  memset(&state, 0, sizeof(state));
+  ClockDiscipline discipline(&state);
+  int64_t offset = 0;
+  TEST_ASSERT_TRUE(discipline.update(1000000, &offset) ==
+                   ClockDiscipline::Action::None);
+
+  // the first sync sets the clock, the fastest reply of the burst wins
+  discipline.addSample({300000, 40000});
+  discipline.addSample({290000, 20000});
+  TEST_ASSERT_TRUE(discipline.update(1000000, &offset) ==
+                   ClockDiscipline::Action::Step);
+  TEST_ASSERT_EQUAL_INT32(290000, offset);
+  TEST_ASSERT_TRUE(discipline.synced());
+
+  // once synced a large offset is only stepped when the next sync agrees
+  discipline.addSample({2000000, 20000});
+  TEST_ASSERT_TRUE(discipline.update(65000000, &offset) ==
+                   ClockDiscipline::Action::None);
+  discipline.addSample({2000000, 20000});
+  TEST_ASSERT_TRUE(discipline.update(129000000, &offset) ==
+                   ClockDiscipline::Action::Step);
+  TEST_ASSERT_EQUAL_UINT32(1, discipline.getStats().spikes);
+
+  discipline.addSample({-3000, 20000});
+  TEST_ASSERT_TRUE(discipline.update(193000000, &offset) ==
+                   ClockDiscipline::Action::Slew);
+  TEST_ASSERT_EQUAL_INT32(-3000, offset);
+}
+
+void test_clock_drift() {
+  // a clock gaining 40 ppm, every offset found is corrected
+  memset(&state, 0, sizeof(state));
+  ClockDiscipline discipline(&state);
+  TEST_ASSERT_EQUAL_UINT32(CLOCK_POLL_MIN, discipline.pollInterval());
+  uint64_t mono = 1000000;
+  double error = 100000;
+  for (int i = 0; i < 20; i++) {
+    discipline.addSample({static_cast<int64_t>(-error), 20000});
+    int64_t offset = 0;
+    if (discipline.update(mono, &offset) != ClockDiscipline::Action::None) {
+      error += offset;
+    }
+    uint32_t interval = discipline.pollInterval();
+    mono += interval * 1000000ull;
+    error += interval * 40.0;
+  }
+  TEST_ASSERT_TRUE(state.valid & CLOCK_SYSTEM);
+  TEST_ASSERT_FLOAT_WITHIN(1, 40, state.system_ppm);
+  // the syncs are spaced to stay within the drift budget
+  TEST_ASSERT_UINT32_WITHIN(15, CLOCK_DRIFT_BUDGET / 40,
+                            discipline.pollInterval());
+
+  // deep sleep on a clock gaining 1500 ppm, then a new boot
+  const int64_t wall = 1700000000ll * 1000000;
+  discipline.sleeping(wall);
+  ClockDiscipline woken(&state);
+  TEST_ASSERT_EQUAL_INT32(0, woken.wakeCorrection(wall + 1200000000ll));
+  woken.addSample({-1800000, 20000});  // 1500 ppm over 20 minutes
+  int64_t offset;
+  woken.update(1000000, &offset);
+  TEST_ASSERT_TRUE(state.valid & CLOCK_SLEEP);
+  TEST_ASSERT_FLOAT_WITHIN(1, 1500, state.sleep_ppm);
+  woken.sleeping(wall);
+  TEST_ASSERT_INT32_WITHIN(1000, -1800000,
+                           woken.wakeCorrection(wall + 1200000000ll));
+}
+
+void test_clock_rtc() {
+  // the BM8563 loses 15 ppm against the disciplined clock
+  memset(&state, 0, sizeof(state));
+  ClockDiscipline discipline(&state);
+  const int64_t wall = 1700000000ll * 1000000;
+  TEST_ASSERT_FALSE(discipline.rtcDue(wall));  // not synced yet
+  discipline.addSample({0, 20000});
+  int64_t offset;
+  discipline.update(1000000, &offset);
+  TEST_ASSERT_TRUE(discipline.rtcDue(wall));
+
+  discipline.rtcSample(wall, 200000);
+  TEST_ASSERT_FALSE(discipline.rtcDue(wall + 60 * 1000000ll));
+  const int64_t hour = CLOCK_RTC_BASELINE * 1000000ll;
+  TEST_ASSERT_TRUE(discipline.rtcDue(wall + hour));
+  discipline.rtcSample(wall + hour, 200000 - 15 * CLOCK_RTC_BASELINE);
+  TEST_ASSERT_TRUE(state.valid & CLOCK_RTC);
+  TEST_ASSERT_FLOAT_WITHIN(0.1, -15, state.rtc_ppm);
+
+  // an hour later the BM8563 is 54 ms further behind
+  int64_t rtc = wall + 2 * hour + 200000 - 2 * 15 * CLOCK_RTC_BASELINE;
+  TEST_ASSERT_INT32_WITHIN(1000, -(200000 - 2 * 15 * CLOCK_RTC_BASELINE),
+                           discipline.rtcCorrection(rtc));
+
+  discipline.rtcWritten();
+  TEST_ASSERT_EQUAL_INT32(0, discipline.rtcCorrection(rtc));
+}
+
+void test_clock_edge() {
+  // read once per 10 ms loop(), the BM8563 is 300 ms ahead
+  const int64_t ahead = 300000;
+  int64_t wall = 1700000000ll * 1000000 + 123456;
+  RtcEdge edge;
+  int64_t wall_edge = 0, offset = 0;
+  TEST_ASSERT_FALSE(edge.read(wall, 0, &wall_edge, &offset));
+  edge.start();
+  TEST_ASSERT_TRUE(edge.active());
+  bool found = false;
+  for (int i = 0; i < 200 && !found; i++) {
+    found = edge.read(wall, (wall + ahead) / 1000000, &wall_edge, &offset);
+    wall += 10000;
+  }
+  TEST_ASSERT_TRUE(found);
+  TEST_ASSERT_FALSE(edge.active());
+  TEST_ASSERT_INT32_WITHIN(5000, ahead, offset);
+  int64_t phase = (wall_edge + ahead) % 1000000;  // to the nearest second
+  TEST_ASSERT_INT32_WITHIN(5000, 0, phase > 500000 ? phase - 1000000 : phase);
+
+  // a stopped BM8563 doesn't keep the loop awake
+  edge.start();
+  for (int i = 0; i < 200 && edge.active(); i++) {
+    TEST_ASSERT_FALSE(edge.read(wall, 1700000000, &wall_edge, &offset));
+    wall += 10000;
+  }
+  TEST_ASSERT_FALSE(edge.active());
+}
@@ -0,0 +1,110 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <string.h>
+#include <unity.h>
+
+#include <algorithm>
+
+#include "../../src/frametime.h"
+#include "./tests.h"
+
+void test_frame_timing() {
+  // 10 ms drawing, 1 ms to start a 30 ms transfer, 5 ms waiting for the
+  // previous one
+  FrameTiming timing;
+  timing.drawn(10000);
+  timing.waited(5000);
+  timing.started(16000, 1000, 153600);
+  timing.frameEnd();
+  TEST_ASSERT_EQUAL_UINT32(30000, timing.done(15000 + 30000));
+  TEST_ASSERT_EQUAL_UINT32(0, timing.done(50000));  // nothing in flight
+
+  const frameStats& stats = timing.getStats();
+  TEST_ASSERT_EQUAL_UINT32(1, stats.frames);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.transfers);
+  TEST_ASSERT_EQUAL_UINT32(16000, stats.max_frame_us);
+  TEST_ASSERT_TRUE(stats.bytes == 153600);
+  // the CPU spent 6 of the 30 ms on the transfer
+  TEST_ASSERT_FLOAT_WITHIN(0.1, 80, timing.overlap());
+
+  // a frame without changes starts nothing
+  timing.drawn(2000);
+  timing.started(60000, 0, 0);
+  timing.frameEnd();
+  TEST_ASSERT_EQUAL_UINT32(0, timing.done(70000));
+  TEST_ASSERT_EQUAL_UINT32(2, stats.frames);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.transfers);
+
+  char buffer[160];
+  size_t length = timing.describe(buffer, sizeof(buffer));
+  TEST_ASSERT_EQUAL_UINT32(strlen(buffer), length);
+  TEST_ASSERT_TRUE(strstr(buffer, "overlap 80.0%") != nullptr);
+  timing.reset();
+  TEST_ASSERT_EQUAL_UINT32(0, timing.getStats().frames);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0, timing.overlap());
+}
+
+// back to back frames drawn in draw us, each sent in transfer us, returns
+// the frame period. With one buffer drawing waits for the transfer, with
+// two the next frame is drawn while the last one is sent.
+static uint32_t pipeline(FrameTiming* timing, int buffers, uint32_t draw,
+                         uint32_t transfer, uint32_t frames) {
+  uint32_t now = 0, transfer_end = 0;
+  bool in_flight = false;
+  auto finish = [&]() {
+    if (!in_flight) {
+      return;
+    }
+    uint32_t waited = transfer_end > now ? transfer_end - now : 0;
+    now += waited;
+    timing->waited(waited);
+    timing->done(transfer_end);
+    in_flight = false;
+  };
+  for (uint32_t i = 0; i < frames; i++) {
+    if (buffers == 1) {
+      finish();  // the only buffer is still being sent
+    }
+    now += draw;
+    timing->drawn(draw);
+    finish();  // the LCD takes one transfer at a time
+    timing->started(now, 0, 153600);
+    transfer_end = now + transfer;
+    in_flight = true;
+    timing->frameEnd();
+  }
+  if (buffers == 1) {
+    finish();
+  } else {
+    timing->done(transfer_end);  // polled, nothing waits for it
+  }
+  return std::max(now, transfer_end) / frames;
+}
+
+void test_frame_pipeline() {
+  // a full frame at 40 MHz takes 30720 us
+  const uint32_t transfer = 320 * 240 * 2 * 8ull * 1000000 / 40000000;
+  const uint32_t frames = 100;
+  for (uint32_t draw : {5000u, 15000u, 30000u, 45000u}) {
+    FrameTiming single, dual;
+    TEST_ASSERT_EQUAL_UINT32(draw + transfer,
+                             pipeline(&single, 1, draw, transfer, frames));
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 0, single.overlap());
+
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(std::max(draw, transfer) +
+                                         transfer / frames,
+                                     pipeline(&dual, 2, draw, transfer,
+                                              frames));
+    // the CPU only waits for what drawing didn't cover, the first frame
+    // has nothing to wait for
+    uint32_t wait = transfer - std::min(draw, transfer);
+    float expect = 100 - (frames - 1) * wait * 100.0f / (frames * transfer);
+    TEST_ASSERT_FLOAT_WITHIN(1, expect, dual.overlap());
+    TEST_ASSERT_EQUAL_UINT32(frames, dual.getStats().transfers);
+  }
+}
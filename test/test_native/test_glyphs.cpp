@@ -0,0 +1,66 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <unity.h>
+
+#include "../../src/PomodoroTimer.h"
+#include "../../src/glyphs.h"
+#include "../../src/native/hal_native.h"
+#include "./tests.h"
+
+// Font7 x2 like sizes, narrow ':'
+static int32_t arrange(glyphMetrics* metrics) {
+  metrics->height = 96;
+  for (int i = 0; i < GLYPH_COUNT; i++) {
+    metrics->width[i] = GLYPH_CHARSET[i] == ':' ? 24 : 64;
+  }
+  return glyphArrange(metrics);
+}
+
+void test_glyph_layout() {
+  glyphMetrics metrics;
+  TEST_ASSERT_EQUAL_INT32(10 * 64 + 24, arrange(&metrics));
+  TEST_ASSERT_EQUAL_INT16(5 * 64, metrics.x[glyphIndex('5')]);
+  TEST_ASSERT_EQUAL_INT16(10 * 64, metrics.x[glyphIndex(':')]);
+  TEST_ASSERT_EQUAL_INT32(-1, glyphIndex(' '));
+
+  // centred like drawString() with middle_center
+  glyphCell cells[GLYPH_TEXT_LENGTH];
+  TEST_ASSERT_EQUAL_INT32(5, glyphLayout(metrics, "24:59", 160, cells,
+                                         GLYPH_TEXT_LENGTH));
+  const int32_t left = 160 - (4 * 64 + 24) / 2;
+  TEST_ASSERT_EQUAL_INT16(left, cells[0].x);
+  TEST_ASSERT_EQUAL_INT16(2 * 64, cells[0].sheet_x);
+  TEST_ASSERT_EQUAL_INT16(left + 2 * 64, cells[2].x);
+  TEST_ASSERT_EQUAL_INT16(24, cells[2].width);
+  TEST_ASSERT_EQUAL_INT16(left + 2 * 64 + 24, cells[3].x);
+  TEST_ASSERT_EQUAL_INT16(9 * 64, cells[4].sheet_x);
+
+  // nothing is drawn rather than part of the text
+  TEST_ASSERT_EQUAL_INT32(0, glyphLayout(metrics, "24 59", 160, cells,
+                                         GLYPH_TEXT_LENGTH));
+  TEST_ASSERT_EQUAL_INT32(0, glyphLayout(metrics, "24:59", 160, cells, 4));
+}
+
+void test_glyph_allocations() {
+  // formatting and laying out the countdown on every frame
+  glyphMetrics metrics;
+  arrange(&metrics);
+  PomodoroTimer pomodoro;
+  pomodoro.startTimer(true, false, false);
+  char text[TIMER_TEXT_SIZE];
+  glyphCell cells[GLYPH_TEXT_LENGTH];
+  int count = 0;
+  uint32_t before = heapAllocations();
+  for (int i = 0; i < 100; i++) {
+    virtualClock.advance(1000000);
+    pomodoro.formatTime(text);
+    count = glyphLayout(metrics, text, 160, cells, GLYPH_TEXT_LENGTH);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, heapAllocations() - before);
+  TEST_ASSERT_EQUAL_INT32(5, count);
+}
@@ -0,0 +1,162 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <unity.h>
+
+#include "../../src/input.h"
+#include "./tests.h"
+
+static uint8_t bit(InputButton button) {
+  return 1 << static_cast<int>(button);
+}
+
+// polls whenever due() says so from now to end in 1 ms steps, sample(t)
+// gives the raw state at t
+template <typename Sample>
+static void run(InputPipeline* input, uint32_t now, uint32_t end,
+                Sample sample) {
+  for (; now < end; now++) {
+    inputSample raw = sample(now);
+    if (input->due(now, raw.touch)) {
+      input->sample(now, now * 1000, raw);
+    }
+  }
+}
+
+void test_input_debounce() {
+  // 15 ms of contact chatter before HMI button 1 settles, held for 200 ms
+  InputPipeline input;
+  input.reset(0);
+  run(&input, 0, 1000, [](uint32_t now) {
+    inputSample sample;
+    if (now >= 100 && now < 315 && (now >= 115 || (now - 100) % 6 < 3)) {
+      sample.buttons = bit(InputButton::Hmi1);
+    }
+    return sample;
+  });
+  inputEvent event;
+  TEST_ASSERT_TRUE(input.pop(&event));
+  TEST_ASSERT_TRUE(event.type == inputEvent::Type::Press);
+  TEST_ASSERT_TRUE(event.button == InputButton::Hmi1);
+  // stamped with the poll that first saw it
+  TEST_ASSERT_UINT32_WITHIN(INPUT_POLL_IDLE * 1000, 100000, event.at_us);
+  TEST_ASSERT_TRUE(input.pop(&event));
+  TEST_ASSERT_TRUE(event.type == inputEvent::Type::Release);
+  TEST_ASSERT_FALSE(input.pop(&event));
+  TEST_ASSERT_EQUAL_UINT32(0, input.getDropped());
+}
+
+void test_input_encoder() {
+  // one count per poll, the remainder carries over to the next detent
+  InputPipeline input;
+  input.reset(0);
+  inputSample sample;
+  sample.increment = 1;
+  int32_t steps = 0;
+  for (uint32_t now = 0; now < 10 * INPUT_POLL_FAST; now += INPUT_POLL_FAST) {
+    input.sample(now, now * 1000, sample);
+    inputEvent event;
+    while (input.pop(&event)) {
+      TEST_ASSERT_TRUE(event.type == inputEvent::Type::Detent);
+      steps += event.x;
+    }
+  }
+  TEST_ASSERT_EQUAL_INT32(2, steps);
+
+  // two counts are left over, three detents back end one short
+  sample.increment = -3 * INPUT_DETENT;
+  input.sample(100, 100000, sample);
+  inputEvent event;
+  TEST_ASSERT_TRUE(input.pop(&event));
+  TEST_ASSERT_EQUAL_INT16(-2, event.x);
+  TEST_ASSERT_FALSE(input.pop(&event));
+}
+
+void test_input_gestures() {
+  InputPipeline input;
+  input.reset(0);
+  run(&input, 0, 6000, [](uint32_t now) {
+    inputSample sample;
+    sample.touch_y = 120;
+    if (now >= 1000 && now < 1080) {  // tap
+      sample.touch = true;
+      sample.touch_x = 100;
+    } else if (now >= 2000 && now < 2150) {  // flick to the right
+      sample.touch = true;
+      sample.touch_x = 100 + (now - 2000);
+    } else if (now >= 4000 && now < 5000) {  // hold
+      sample.touch = true;
+      sample.touch_x = 100;
+    }
+    return sample;
+  });
+  inputEvent event;
+  TEST_ASSERT_TRUE(input.pop(&event));
+  TEST_ASSERT_TRUE(event.type == inputEvent::Type::Tap);
+  TEST_ASSERT_EQUAL_INT16(100, event.x);
+  TEST_ASSERT_TRUE(input.pop(&event));
+  TEST_ASSERT_TRUE(event.type == inputEvent::Type::Flick);
+  TEST_ASSERT_GREATER_THAN(INPUT_FLICK, event.x);
+  TEST_ASSERT_TRUE(input.pop(&event));
+  TEST_ASSERT_TRUE(event.type == inputEvent::Type::Hold);
+  TEST_ASSERT_FALSE(input.pop(&event));
+}
+
+void test_input_polling() {
+  // idle polls are slow, activity and the touch line make them fast
+  InputPipeline input;
+  input.reset(0);
+  inputSample idle;
+  TEST_ASSERT_TRUE(input.due(0, false));
+  input.sample(0, 0, idle);
+  uint32_t now = INPUT_ACTIVE_HOLD;
+  input.sample(now, now * 1000, idle);
+  TEST_ASSERT_FALSE(input.due(now + INPUT_POLL_FAST, false));
+  TEST_ASSERT_TRUE(input.due(now + INPUT_POLL_FAST, true));
+  TEST_ASSERT_TRUE(input.due(now + INPUT_POLL_IDLE, false));
+
+  inputSample turned;
+  turned.increment = 1;
+  input.sample(now, now * 1000, turned);
+  TEST_ASSERT_TRUE(input.due(now + INPUT_POLL_FAST, false));
+  now += INPUT_ACTIVE_HOLD;
+  input.sample(now, now * 1000, idle);
+  TEST_ASSERT_FALSE(input.due(now + INPUT_POLL_FAST, false));
+
+  // the bus share: three reads of 1350 us in each 10 ms
+  input.reset(0);
+  input.sample(0, 0, idle);
+  input.busy(1350, 15, 3);
+  TEST_ASSERT_EQUAL_UINT32(3, input.getStats().transactions);
+  TEST_ASSERT_EQUAL_UINT32(15, input.getStats().bus_bytes);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 13.5, input.busUtilization(10));
+}
+
+void test_input_trace() {
+  inputSample sample;
+  sample.buttons = bit(InputButton::Hmi1) | bit(InputButton::A);
+  sample.increment = -5;
+  sample.touch = true;
+  sample.touch_x = 310;
+  sample.touch_y = 12;
+  char line[INPUT_TRACE_LINE];
+  TEST_ASSERT_GREATER_THAN(0, inputTraceFormat(line, sizeof(line), 12345,
+                                                sample));
+  uint32_t now = 0;
+  inputSample parsed;
+  TEST_ASSERT_TRUE(inputTraceParse(line, &now, &parsed));
+  TEST_ASSERT_EQUAL_UINT32(12345, now);
+  TEST_ASSERT_EQUAL_UINT8(sample.buttons, parsed.buttons);
+  TEST_ASSERT_EQUAL_INT32(-5, parsed.increment);
+  TEST_ASSERT_TRUE(parsed.touch);
+  TEST_ASSERT_EQUAL_INT16(310, parsed.touch_x);
+  TEST_ASSERT_EQUAL_INT16(12, parsed.touch_y);
+
+  TEST_ASSERT_FALSE(inputTraceParse("# recorded on a Core2", &now, &parsed));
+  TEST_ASSERT_FALSE(inputTraceParse("", &now, &parsed));
+  TEST_ASSERT_FALSE(inputTraceParse("12 zz", &now, &parsed));
+}
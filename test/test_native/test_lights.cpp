@@ -0,0 +1,119 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <math.h>
+#include <unity.h>
+
+#include "../../src/lights.h"
+#include "../../src/native/hal_native.h"
+#include "./tests.h"
+
+// runs the engine like lightsTask until nothing moves, returns the time
+static uint32_t settle(LedEngine* lights, uint32_t now) {
+  for (; lights->nextFrame(now) != UINT32_MAX; now++) {
+    if (lights->nextFrame(now) == 0) {
+      lights->update(now);
+    }
+  }
+  return now;
+}
+
+void test_lights_progress() {
+  // a half finished session lights the two LEDs on each side of the middle
+  // fully and the third at half level, gamma corrected to a quarter
+  LedEngine lights;
+  lights.reset(0);
+  nullLedStrip.shows = 0;
+  lights.apply(0, {lightsCommand::Type::Progress, false, 500, 0xFFFFFF});
+  uint32_t now = settle(&lights, 0);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(LIGHTS_EASE, now);
+  const uint32_t full = 0x141414, quarter = 0x050505;
+  const uint32_t expect[LIGHTS_COUNT] = {0,    0,    quarter, full, full,
+                                         full, full, quarter, 0,    0};
+  TEST_ASSERT_EQUAL_UINT32(LIGHTS_COUNT, nullLedStrip.frame.size());
+  TEST_ASSERT_EQUAL_HEX32_ARRAY(expect, nullLedStrip.frame.data(),
+                                LIGHTS_COUNT);
+  TEST_ASSERT_EQUAL_HEX32_ARRAY(expect, lights.frame(), LIGHTS_COUNT);
+
+  // the same command again doesn't move anything
+  lights.apply(now, {lightsCommand::Type::Progress, false, 500, 0xFFFFFF});
+  uint32_t pushes = lights.getStats().pushes;
+  settle(&lights, now);
+  TEST_ASSERT_EQUAL_UINT32(pushes, lights.getStats().pushes);
+  // the strip is only shown when a frame changed
+  TEST_ASSERT_EQUAL_UINT32(pushes, nullLedStrip.shows);
+
+  const keyframe ramp[] = {{0, 0}, {100, 60000}};
+  TEST_ASSERT_EQUAL_UINT16(0, keyframeLevel(ramp, 2, 0));
+  TEST_ASSERT_EQUAL_UINT16(30000, keyframeLevel(ramp, 2, 50));
+  TEST_ASSERT_EQUAL_UINT16(60000, keyframeLevel(ramp, 2, 500));
+}
+
+void test_lights_dither() {
+  // a breath on a dim blue strip, at most 2.5 steps of 8 bit: dithering
+  // keeps the sum of the frames within a step or so of the exact levels,
+  // rounding drifts away
+  LedEngine breathing;
+  breathing.apply(0, {lightsCommand::Type::Progress, true, 1000, 0x000020});
+  const keyframe breath[] = {
+      {0, 0xFFFF}, {LIGHTS_BREATH / 2, 0x3000}, {LIGHTS_BREATH, 0xFFFF}};
+  double exact = 0, dithered = 0, rounded = 0;
+  // the second breath, the first one starts with the strip coming up
+  for (uint32_t t = 0; t < LIGHTS_BREATH; t += LIGHTS_FRAME) {
+    breathing.update(LIGHTS_BREATH + t);
+    TEST_ASSERT_EQUAL_UINT32(0, breathing.nextFrame(LIGHTS_BREATH + t +
+                                                    LIGHTS_FRAME));
+    double level = keyframeLevel(breath, 3, t) / 65535.0;
+    double value = level * level * 0x20 * LIGHTS_BRIGHTNESS / 255;
+    exact += value;
+    rounded += floor(value + 0.5);
+    dithered += breathing.frame()[LIGHTS_COUNT / 2] & 0xFF;
+  }
+  TEST_ASSERT_TRUE(fabs(dithered - exact) < 1.5);
+  TEST_ASSERT_TRUE(fabs(dithered - exact) < fabs(rounded - exact));
+}
+
+void test_lights_flash() {
+  // the flash ends and the strip goes back to the progress, then rests
+  LedEngine lights;
+  lights.apply(0, {lightsCommand::Type::Progress, false, 1000, 0xFF0000});
+  uint32_t now = settle(&lights, 0);
+  lights.apply(now, {lightsCommand::Type::Flash, false, 0, 0x00FF00});
+  lights.update(now + LIGHTS_FLASH / 4);
+  TEST_ASSERT_TRUE(lights.frame()[0] & 0x00FF00);
+  uint32_t end = settle(&lights, now);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(now + LIGHTS_FLASH, end);
+  for (int i = 0; i < LIGHTS_COUNT; i++) {
+    TEST_ASSERT_EQUAL_HEX32(0x140000, lights.frame()[i]);
+  }
+
+  lights.apply(end, {lightsCommand::Type::Off, false, 0, 0});
+  settle(&lights, end);
+  for (int i = 0; i < LIGHTS_COUNT; i++) {
+    TEST_ASSERT_EQUAL_HEX32(0, lights.frame()[i]);
+  }
+}
+
+void test_lights_reset() {
+  // the statistics restart through the command queue like everything else
+  LedEngine lights;
+  lights.apply(0, {lightsCommand::Type::Progress, false, 700, 0xFF0000});
+  uint32_t now = settle(&lights, 0);
+  TEST_ASSERT_EQUAL_UINT32(1, lights.getStats().commands);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, lights.getStats().pushes);
+  uint32_t frame[LIGHTS_COUNT];
+  for (int i = 0; i < LIGHTS_COUNT; i++) {
+    frame[i] = lights.frame()[i];
+  }
+
+  lights.apply(now, {lightsCommand::Type::Reset, false, 0, 0});
+  TEST_ASSERT_EQUAL_UINT32(0, lights.getStats().commands);
+  TEST_ASSERT_EQUAL_UINT32(0, lights.getStats().pushes);
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, lights.nextFrame(now));
+  TEST_ASSERT_EQUAL_HEX32_ARRAY(frame, lights.frame(), LIGHTS_COUNT);
+  TEST_ASSERT_EQUAL_UINT32(0, lights.pushesPerMinute(now + 60000));
+}
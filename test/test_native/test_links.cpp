@@ -0,0 +1,146 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <unity.h>
+
+#include "../../src/connection.h"
+#include "./tests.h"
+
+// brings Wi-Fi up, the TLS layer is next
+static uint32_t wifiUp(ConnectionManager* links) {
+  links->seed(12345);
+  TEST_ASSERT_TRUE(links->shouldConnect(ConnectionManager::Wifi, 0));
+  links->connecting(ConnectionManager::Wifi, 0);
+  TEST_ASSERT_EQUAL_UINT32(0, links->update(100, true, false, false));
+  TEST_ASSERT_TRUE(links->link(ConnectionManager::Wifi).getState() ==
+                   Link::State::Up);
+  return 100;
+}
+
+// fails TLS attempts as soon as they are allowed, checking each delay
+static uint32_t failTls(ConnectionManager* links, uint32_t now, int count,
+                        int first) {
+  const Link& tls = links->link(ConnectionManager::Tls);
+  for (int i = first; i < first + count; i++) {
+    TEST_ASSERT_TRUE(links->shouldConnect(ConnectionManager::Tls, now));
+    links->connecting(ConnectionManager::Tls, now);
+    links->failed(ConnectionManager::Tls, now);
+
+    // doubling from LINK_BACKOFF_MIN up to LINK_BACKOFF_MAX, the delay
+    // is at least half of that
+    uint32_t base = LINK_BACKOFF_MAX;
+    if (i < 16 && (LINK_BACKOFF_MIN << i) < LINK_BACKOFF_MAX) {
+      base = LINK_BACKOFF_MIN << i;
+    }
+    uint32_t backoff = tls.getBackoff();
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(base / 2, backoff);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(base, backoff);
+    TEST_ASSERT_EQUAL_UINT32(now + backoff, tls.getNext());
+    TEST_ASSERT_EQUAL_UINT32(backoff, links->nextWake(now));
+
+    TEST_ASSERT_FALSE(
+        links->shouldConnect(ConnectionManager::Tls, now + backoff - 1));
+    now += backoff;
+  }
+  return now;
+}
+
+void test_links_backoff() {
+  ConnectionManager links;
+  uint32_t now = wifiUp(&links);
+  now = failTls(&links, now, 14, 0);  // well into the cap
+  TEST_ASSERT_EQUAL_UINT32(14,
+                           links.link(ConnectionManager::Tls).getFailures());
+  // nothing above TLS was tried
+  TEST_ASSERT_EQUAL_UINT32(0,
+                           links.link(ConnectionManager::Mqtt).getAttempts());
+}
+
+void test_links_jitter() {
+  // the random half spreads the retries of devices failing together
+  uint32_t low = UINT32_MAX, high = 0;
+  for (uint32_t seed = 1; seed <= 200; seed++) {
+    ConnectionManager links;
+    wifiUp(&links);
+    links.seed(seed * 7919);
+    links.connecting(ConnectionManager::Tls, 100);
+    for (int i = 0; i < 5; i++) {
+      links.failed(ConnectionManager::Tls, 100);
+    }
+    uint32_t backoff = links.link(ConnectionManager::Tls).getBackoff();
+    low = backoff < low ? backoff : low;
+    high = backoff > high ? backoff : high;
+  }
+  const uint32_t base = LINK_BACKOFF_MIN << 4;
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(base / 2, low);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(base, high);
+  TEST_ASSERT_LESS_THAN_UINT32(base * 6 / 10, low);  // the whole range is used
+  TEST_ASSERT_GREATER_THAN_UINT32(base * 9 / 10, high);
+}
+
+void test_links_reset() {
+  // a session that holds for LINK_STABLE resets the backoff, one that
+  // drops sooner keeps backing off
+  ConnectionManager links;
+  uint32_t now = wifiUp(&links);
+  now = failTls(&links, now, 4, 0);
+
+  TEST_ASSERT_TRUE(links.shouldConnect(ConnectionManager::Tls, now));
+  links.connecting(ConnectionManager::Tls, now);
+  links.connected(ConnectionManager::Tls, now);
+  now += LINK_STABLE - 1;
+  links.update(now, true, false, false);  // flapping
+  uint32_t backoff = links.link(ConnectionManager::Tls).getBackoff();
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(LINK_BACKOFF_MIN << 3, backoff);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(LINK_BACKOFF_MIN << 4, backoff);
+  now = failTls(&links, now + backoff, 1, 5);
+
+  links.connecting(ConnectionManager::Tls, now);
+  links.connected(ConnectionManager::Tls, now);
+  now += LINK_STABLE;
+  links.update(now, true, false, false);  // stable
+  TEST_ASSERT_EQUAL_UINT32(0, links.link(ConnectionManager::Tls).getBackoff());
+  failTls(&links, now, 2, 0);  // from the start again
+}
+
+void test_links_timeout() {
+  // Wi-Fi has LINK_WIFI_TIMEOUT to get an address, then the attempt is
+  // given up and reported so the driver can be stopped
+  ConnectionManager links;
+  links.connecting(ConnectionManager::Wifi, 1000);
+  TEST_ASSERT_EQUAL_UINT32(
+      0, links.update(1000 + LINK_WIFI_TIMEOUT - 1, false, false, false));
+  TEST_ASSERT_EQUAL_UINT32(
+      1u << ConnectionManager::Wifi,
+      links.update(1000 + LINK_WIFI_TIMEOUT, false, false, false));
+  const Link& wifi = links.link(ConnectionManager::Wifi);
+  TEST_ASSERT_TRUE(wifi.getState() == Link::State::Down);
+  TEST_ASSERT_EQUAL_UINT32(1, wifi.getFailures());
+  TEST_ASSERT_EQUAL_UINT32(
+      0, links.update(1000 + LINK_WIFI_TIMEOUT + 1, false, false, false));
+}
+
+void test_links_layers() {
+  // losing Wi-Fi takes TLS and MQTT down without blaming them
+  ConnectionManager links;
+  uint32_t now = wifiUp(&links);
+  TEST_ASSERT_FALSE(links.shouldConnect(ConnectionManager::Mqtt, now));
+  links.connecting(ConnectionManager::Tls, now);
+  links.connected(ConnectionManager::Tls, now);
+  links.connecting(ConnectionManager::Mqtt, now);
+  links.connected(ConnectionManager::Mqtt, now);
+  TEST_ASSERT_TRUE(links.isUp());
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, links.nextWake(now));
+
+  now += 60000;
+  links.update(now, false, false, false);
+  TEST_ASSERT_FALSE(links.isUp());
+  TEST_ASSERT_EQUAL_UINT32(1, links.link(ConnectionManager::Wifi).getDrops());
+  TEST_ASSERT_EQUAL_UINT32(0, links.link(ConnectionManager::Tls).getDrops());
+  TEST_ASSERT_EQUAL_UINT32(0, links.link(ConnectionManager::Mqtt).getDrops());
+  TEST_ASSERT_TRUE(links.shouldConnect(ConnectionManager::Wifi, now));
+}
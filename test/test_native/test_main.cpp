@@ -0,0 +1,82 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <unity.h>
+
+#include "../../src/native/hal_native.h"
+#include "../../src/shadow.h"
+#include "./tests.h"
+
+void setUp() {
+  reports = 0;
+  sounds_played = 0;
+  loopbackMqtt.online = true;
+}
+
+void tearDown() {}
+
+int main(int argc, char** argv) {
+  shadowInitTopics("native");
+  UNITY_BEGIN();
+  RUN_TEST(test_adpcm_known_codes);
+  RUN_TEST(test_adpcm_reference);
+  RUN_TEST(test_png_size);
+  RUN_TEST(test_png_size_rejects);
+  RUN_TEST(test_clock_ntp);
+  RUN_TEST(test_clock_step);
+  RUN_TEST(test_clock_drift);
+  RUN_TEST(test_clock_rtc);
+  RUN_TEST(test_clock_edge);
+  RUN_TEST(test_frame_timing);
+  RUN_TEST(test_frame_pipeline);
+  RUN_TEST(test_glyph_layout);
+  RUN_TEST(test_glyph_allocations);
+  RUN_TEST(test_input_debounce);
+  RUN_TEST(test_input_encoder);
+  RUN_TEST(test_input_gestures);
+  RUN_TEST(test_input_polling);
+  RUN_TEST(test_input_trace);
+  RUN_TEST(test_lights_progress);
+  RUN_TEST(test_lights_dither);
+  RUN_TEST(test_lights_flash);
+  RUN_TEST(test_lights_reset);
+  RUN_TEST(test_links_backoff);
+  RUN_TEST(test_links_jitter);
+  RUN_TEST(test_links_reset);
+  RUN_TEST(test_links_timeout);
+  RUN_TEST(test_links_layers);
+  RUN_TEST(test_outbox_order);
+  RUN_TEST(test_outbox_retry);
+  RUN_TEST(test_outbox_sections);
+  RUN_TEST(test_outbox_rejected);
+  RUN_TEST(test_outbox_reboot);
+  RUN_TEST(test_outbox_allocations);
+  RUN_TEST(test_queue_order);
+  RUN_TEST(test_queue_threads);
+  RUN_TEST(test_replay_budget);
+  RUN_TEST(test_replay_tracker);
+  RUN_TEST(test_resume_roundtrip);
+  RUN_TEST(test_resume_rejects);
+  RUN_TEST(test_resume_wake_delay);
+  RUN_TEST(test_resume_after_end);
+  RUN_TEST(test_scheduler_countdown);
+  RUN_TEST(test_scheduler_idle);
+  RUN_TEST(test_scheduler_requests);
+  RUN_TEST(test_shadow_encode);
+  RUN_TEST(test_shadow_batch);
+  RUN_TEST(test_shadow_decode);
+  RUN_TEST(test_shadow_response);
+  RUN_TEST(test_shadow_allocations);
+  RUN_TEST(test_target_colors);
+  RUN_TEST(test_target_memory);
+  RUN_TEST(test_target_bands);
+  RUN_TEST(test_timer_session);
+  RUN_TEST(test_timer_format);
+  RUN_TEST(test_timer_deadline);
+  RUN_TEST(test_loopback_mqtt);
+  return UNITY_END();
+}
@@ -0,0 +1,193 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "../../src/native/hal_native.h"
+#include "../../src/outbox.h"
+#include "./tests.h"
+
+static outboxEntry entry(PomodoroTimer::PomodoroState state, uint32_t start,
+                         const char* description) {
+  outboxEntry e = {static_cast<uint8_t>(state), true, false, start, 1, ""};
+  snprintf(e.description, sizeof(e.description), "%s", description);
+  return e;
+}
+
+// stands in for RTC memory
+static outboxStore store;
+
+void test_outbox_order() {
+  // transitions stay in order, a change to the newest one is merged
+  memset(&store, 0, sizeof(store));
+  Outbox outbox(&store);
+  outbox.push(entry(PomodoroTimer::PomodoroState::POMODORO, 1000, "a"));
+  outbox.push(entry(PomodoroTimer::PomodoroState::REST, 2500, "a"));
+  outbox.push(entry(PomodoroTimer::PomodoroState::STOPPED, 2800, "a"));
+  outbox.push(entry(PomodoroTimer::PomodoroState::STOPPED, 2800, "b"));
+  TEST_ASSERT_EQUAL_UINT32(3, outbox.size());
+  TEST_ASSERT_EQUAL_UINT32(1000, outbox.at(0).start);
+  TEST_ASSERT_EQUAL_UINT32(2500, outbox.at(1).start);
+  TEST_ASSERT_EQUAL_UINT32(2800, outbox.at(2).start);
+  TEST_ASSERT_EQUAL_STRING("b", outbox.newest().description);
+  TEST_ASSERT_EQUAL_UINT32(1, outbox.getStats().coalesced);
+
+  // a long offline stretch keeps the newest transitions
+  for (uint32_t i = 0; i < 20; i++) {
+    outbox.push(entry(i % 2 ? PomodoroTimer::PomodoroState::REST
+                            : PomodoroTimer::PomodoroState::POMODORO,
+                      i, ""));
+  }
+  TEST_ASSERT_EQUAL_UINT32(OUTBOX_SIZE, outbox.size());
+  TEST_ASSERT_EQUAL_UINT32(20 - OUTBOX_SIZE, outbox.at(0).start);
+  TEST_ASSERT_EQUAL_UINT32(19, outbox.newest().start);
+  TEST_ASSERT_EQUAL_UINT32(23 - OUTBOX_SIZE, outbox.getStats().dropped);
+}
+
+void test_outbox_retry() {
+  // a batch without an acknowledgement goes out again with a new token,
+  // only the token of the latest publish acknowledges it
+  memset(&store, 0, sizeof(store));
+  Outbox outbox(&store);
+  char buffer[SHADOW_UPDATE_SIZE];
+  TEST_ASSERT_FALSE(outbox.due(0));
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, outbox.waitLeft(0));
+
+  outbox.push(entry(PomodoroTimer::PomodoroState::POMODORO, 1000, "a"));
+  TEST_ASSERT_TRUE(outbox.due(0));
+  outbox.encode(buffer, sizeof(buffer));
+  uint32_t first = outbox.token();
+  outbox.published(0);
+  TEST_ASSERT_FALSE(outbox.due(OUTBOX_ACK_TIMEOUT - 1));
+  TEST_ASSERT_EQUAL_UINT32(1, outbox.waitLeft(OUTBOX_ACK_TIMEOUT - 1));
+  TEST_ASSERT_TRUE(outbox.due(OUTBOX_ACK_TIMEOUT));
+
+  outbox.encode(buffer, sizeof(buffer));
+  uint32_t second = outbox.token();
+  TEST_ASSERT_TRUE(second != first);
+  outbox.published(OUTBOX_ACK_TIMEOUT);
+  TEST_ASSERT_EQUAL_UINT32(1, outbox.getStats().retries);
+
+  // pushed while the batch is in flight: not merged into it, not acked
+  // with it
+  outbox.push(entry(PomodoroTimer::PomodoroState::POMODORO, 1000, "b"));
+  TEST_ASSERT_EQUAL_UINT32(2, outbox.size());
+  TEST_ASSERT_FALSE(outbox.ack(first));
+  TEST_ASSERT_TRUE(outbox.ack(second));
+  TEST_ASSERT_EQUAL_UINT32(1, outbox.size());
+  TEST_ASSERT_EQUAL_STRING("b", outbox.at(0).description);
+  TEST_ASSERT_FALSE(outbox.ack(second));
+  TEST_ASSERT_TRUE(outbox.due(OUTBOX_ACK_TIMEOUT));
+
+  // the connection dropped before the acknowledgement
+  outbox.encode(buffer, sizeof(buffer));
+  outbox.published(OUTBOX_ACK_TIMEOUT);
+  outbox.resend();
+  TEST_ASSERT_TRUE(outbox.due(OUTBOX_ACK_TIMEOUT + 1));
+}
+
+void test_outbox_sections() {
+  // a desired change neither merges with nor goes out with the reports
+  // around it
+  memset(&store, 0, sizeof(store));
+  Outbox outbox(&store);
+  char buffer[SHADOW_UPDATE_SIZE];
+  outboxEntry desired = entry(PomodoroTimer::PomodoroState::REST, 2500, "a");
+  desired.desired = true;
+  outbox.push(entry(PomodoroTimer::PomodoroState::POMODORO, 1000, "a"));
+  outbox.push(entry(PomodoroTimer::PomodoroState::REST, 2500, "a"));
+  outbox.push(desired);
+  outbox.push(entry(PomodoroTimer::PomodoroState::STOPPED, 2800, "a"));
+  TEST_ASSERT_EQUAL_UINT32(4, outbox.size());
+  TEST_ASSERT_EQUAL_UINT32(0, outbox.getStats().coalesced);
+
+  // the two reports, the desired change, the last report
+  const struct {
+    size_t entries;
+    bool desired;
+  } batches[] = {{2, false}, {1, true}, {1, false}};
+  for (const auto& batch : batches) {
+    size_t before = outbox.size();
+    outbox.encode(buffer, sizeof(buffer));
+    TEST_ASSERT_TRUE(outbox.batchNewest().desired == batch.desired);
+    uint32_t token = outbox.token();
+    outbox.published(0);
+    TEST_ASSERT_TRUE(outbox.ack(token));
+    TEST_ASSERT_EQUAL_UINT32(before - batch.entries, outbox.size());
+  }
+  TEST_ASSERT_TRUE(outbox.empty());
+}
+
+void test_outbox_rejected() {
+  memset(&store, 0, sizeof(store));
+  Outbox outbox(&store);
+  char buffer[SHADOW_UPDATE_SIZE];
+  outbox.push(entry(PomodoroTimer::PomodoroState::POMODORO, 1000, "a"));
+  outbox.encode(buffer, sizeof(buffer));
+  uint32_t token = outbox.token();
+  outbox.published(0);
+
+  // throttled: kept for the retry after the ack timeout
+  TEST_ASSERT_FALSE(outbox.rejected(token + 1, 429));
+  TEST_ASSERT_TRUE(outbox.rejected(token, 429));
+  TEST_ASSERT_EQUAL_UINT32(1, outbox.size());
+  TEST_ASSERT_FALSE(outbox.due(OUTBOX_ACK_TIMEOUT - 1));
+  TEST_ASSERT_TRUE(outbox.due(OUTBOX_ACK_TIMEOUT));
+
+  // a version conflict fails the same way every time
+  outbox.push(entry(PomodoroTimer::PomodoroState::REST, 2500, "a"));
+  outbox.encode(buffer, sizeof(buffer));
+  token = outbox.token();
+  outbox.published(OUTBOX_ACK_TIMEOUT);
+  TEST_ASSERT_TRUE(outbox.rejected(token, 409));
+  TEST_ASSERT_TRUE(outbox.empty());
+  TEST_ASSERT_EQUAL_UINT32(2, outbox.getStats().rejected);
+  TEST_ASSERT_EQUAL_UINT32(0, outbox.getStats().acked);
+  TEST_ASSERT_FALSE(outbox.ack(token));
+}
+
+void test_outbox_reboot() {
+  // pending entries survive a reboot, garbage doesn't
+  memset(&store, 0, sizeof(store));
+  {
+    Outbox outbox(&store);
+    outbox.push(entry(PomodoroTimer::PomodoroState::POMODORO, 3000, "c"));
+  }
+  Outbox rebooted(&store);
+  TEST_ASSERT_EQUAL_UINT32(1, rebooted.size());
+  TEST_ASSERT_EQUAL_UINT32(3000, rebooted.at(0).start);
+  TEST_ASSERT_EQUAL_UINT32(0, rebooted.at(0).created_us);
+  TEST_ASSERT_TRUE(rebooted.due(0));
+
+  store.count = OUTBOX_SIZE + 1;
+  Outbox corrupt(&store);
+  TEST_ASSERT_TRUE(corrupt.empty());
+  TEST_ASSERT_EQUAL_UINT32(OUTBOX_MAGIC, store.magic);
+}
+
+void test_outbox_allocations() {
+  memset(&store, 0, sizeof(store));
+  Outbox outbox(&store);
+  char buffer[SHADOW_UPDATE_SIZE];
+  auto round = [&](uint32_t i) {
+    outbox.push(entry(PomodoroTimer::PomodoroState::POMODORO, i, "task"));
+    outbox.push(entry(PomodoroTimer::PomodoroState::REST, i + 1, "task"));
+    outbox.encode(buffer, sizeof(buffer));
+    uint32_t token = outbox.token();
+    outbox.published(i);
+    outbox.ack(token);
+  };
+  round(0);
+  uint32_t before = heapAllocations();
+  for (uint32_t i = 1; i <= 100; i++) {
+    round(i * 1000);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, heapAllocations() - before);
+  TEST_ASSERT_TRUE(outbox.empty());
+}
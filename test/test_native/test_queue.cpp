@@ -0,0 +1,89 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <unity.h>
+
+#include <thread>
+
+#include "../../src/command_queue.h"
+#include "./tests.h"
+
+struct command {
+  uint32_t sequence;
+  uint32_t check;
+  uint32_t payload[6];  // big enough to show torn copies
+};
+
+static command make(uint32_t sequence) {
+  command item = {sequence, ~sequence, {}};
+  for (uint32_t i = 0; i < 6; i++) {
+    item.payload[i] = sequence * 2654435761u + i;
+  }
+  return item;
+}
+
+static bool intact(const command& item) {
+  bool same = item.check == ~item.sequence;
+  for (uint32_t i = 0; i < 6; i++) {
+    same = same && item.payload[i] == item.sequence * 2654435761u + i;
+  }
+  return same;
+}
+
+void test_queue_order() {
+  // Size - 1 items fit, a push to a full queue is refused and counted
+  CommandQueue<command, 4> queue;
+  command item;
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_FALSE(queue.pop(&item));
+  for (uint32_t round = 0; round < 3; round++) {  // around the ring
+    for (uint32_t i = 0; i < 3; i++) {
+      TEST_ASSERT_TRUE(queue.push(make(round * 3 + i)));
+    }
+    TEST_ASSERT_FALSE(queue.push(make(99)));
+    for (uint32_t i = 0; i < 3; i++) {
+      TEST_ASSERT_TRUE(queue.pop(&item));
+      TEST_ASSERT_EQUAL_UINT32(round * 3 + i, item.sequence);
+      TEST_ASSERT_TRUE(intact(item));
+    }
+    TEST_ASSERT_TRUE(queue.empty());
+  }
+  TEST_ASSERT_EQUAL_UINT32(3, queue.getDropped());
+}
+
+void test_queue_threads() {
+  // a producer and a consumer thread like networkTask and the UI loop, the
+  // producer retries when the queue is full. Everything has to arrive once,
+  // in order and whole. pio test -e native_tsan checks the memory ordering.
+  const uint32_t count = 200000;
+  static CommandQueue<command, 8> queue;
+  std::thread producer([&] {
+    for (uint32_t i = 0; i < count; i++) {
+      while (!queue.push(make(i))) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  uint32_t received = 0, out_of_order = 0, torn = 0;
+  command item;
+  while (received < count) {
+    if (!queue.pop(&item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    out_of_order += item.sequence != received;
+    torn += !intact(item);
+    received++;
+  }
+  producer.join();
+
+  TEST_ASSERT_EQUAL_UINT32(count, received);
+  TEST_ASSERT_EQUAL_UINT32(0, out_of_order);
+  TEST_ASSERT_EQUAL_UINT32(0, torn);
+  TEST_ASSERT_TRUE(queue.empty());
+}
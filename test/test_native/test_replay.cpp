@@ -0,0 +1,46 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <unity.h>
+
+#include "../../src/latency.h"
+#include "../../src/native/replay.h"
+#include "./tests.h"
+
+void test_replay_budget() {
+  // every event of the trace reaches the LCD within the budget
+  LatencyTracker latency;
+  uint32_t frames = 0;
+  replay(replay_trace, &latency, &frames);
+  const latencyStats& stats = latency.getStats();
+  // 3 detents, 2 presses and 2 releases despite the chatter, tap, flick
+  TEST_ASSERT_EQUAL_UINT32(9, stats.events);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.overflow);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(stats.frames, frames);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(REPLAY_BUDGET, latency.percentile(95));
+  TEST_ASSERT_GREATER_THAN_UINT32(0, latency.percentile(95));
+}
+
+void test_replay_tracker() {
+  // two events handled before a frame, the frame takes 8 ms to the LCD
+  LatencyTracker latency;
+  latency.handled(1000, 3000);
+  latency.handled(2000, 3000);
+  latency.frameStart(5000);
+  TEST_ASSERT_EQUAL_INT32(2, latency.frameDone(13000));
+  TEST_ASSERT_EQUAL_UINT32(11000, latency.latest(0));
+  TEST_ASSERT_EQUAL_UINT32(12000, latency.latest(1));
+  const latencyStats& stats = latency.getStats();
+  TEST_ASSERT_TRUE(stats.handle_us == 2000 + 1000);
+  TEST_ASSERT_TRUE(stats.wait_us == 2 * 2000);
+  TEST_ASSERT_TRUE(stats.draw_us == 2 * 8000);
+  TEST_ASSERT_EQUAL_UINT32(12000, stats.max_us);
+
+  // a frame without events carries none
+  latency.frameStart(20000);
+  TEST_ASSERT_EQUAL_INT32(0, latency.frameDone(30000));
+}
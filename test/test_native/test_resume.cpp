@@ -0,0 +1,108 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <string.h>
+#include <unity.h>
+
+#include <string>
+
+#include "../../src/PomodoroTimer.h"
+#include "../../src/native/hal_native.h"
+#include "../../src/resume.h"
+#include "./tests.h"
+
+void test_resume_roundtrip() {
+  PomodoroTimer pomodoro;
+  pomodoro.startTimer(true, false, false);
+  PomodoroTimer::Snapshot snapshot = pomodoro.snapshot();
+  resumeState state;
+  resumeEncode(&state, snapshot, "write the report");
+
+  PomodoroTimer::Snapshot restored;
+  char description[SHADOW_DESCRIPTION_LENGTH];
+  TEST_ASSERT_TRUE(
+      resumeDecode(state, &restored, description, sizeof(description)));
+  TEST_ASSERT_TRUE(restored.state == snapshot.state);
+  TEST_ASSERT_EQUAL_UINT32(snapshot.start, restored.start);
+  TEST_ASSERT_EQUAL_UINT32(snapshot.end, restored.end);
+  TEST_ASSERT_EQUAL_UINT32(snapshot.pause_time, restored.pause_time);
+  TEST_ASSERT_EQUAL_UINT16(snapshot.pomodoro_minutes,
+                           restored.pomodoro_minutes);
+  TEST_ASSERT_EQUAL_UINT16(snapshot.rest_minutes, restored.rest_minutes);
+  TEST_ASSERT_EQUAL_STRING("write the report", description);
+
+  // a description longer than the field is cut, not overrun
+  std::string long_text(SHADOW_DESCRIPTION_LENGTH * 2, 'x');
+  resumeEncode(&state, snapshot, long_text.c_str());
+  TEST_ASSERT_TRUE(
+      resumeDecode(state, &restored, description, sizeof(description)));
+  TEST_ASSERT_EQUAL_UINT32(SHADOW_DESCRIPTION_LENGTH - 1,
+                           strlen(description));
+}
+
+void test_resume_rejects() {
+  PomodoroTimer pomodoro;
+  pomodoro.startTimer(true, true, false);
+  PomodoroTimer::Snapshot snapshot = pomodoro.snapshot();
+  PomodoroTimer::Snapshot restored;
+  char description[SHADOW_DESCRIPTION_LENGTH];
+  resumeState state;
+
+  // any bit flip in RTC memory
+  for (size_t bit = 0; bit < offsetof(resumeState, checksum) * 8; bit += 7) {
+    resumeEncode(&state, snapshot, "task");
+    reinterpret_cast<uint8_t*>(&state)[bit / 8] ^= 1 << bit % 8;
+    TEST_ASSERT_FALSE(
+        resumeDecode(state, &restored, description, sizeof(description)));
+    TEST_ASSERT_EQUAL_STRING("", description);
+  }
+
+  resumeEncode(&state, snapshot, "task");
+  resumeClear(&state);
+  TEST_ASSERT_FALSE(
+      resumeDecode(state, &restored, description, sizeof(description)));
+
+  // only a running session is resumed
+  pomodoro.stopTimer();
+  resumeEncode(&state, pomodoro.snapshot(), "task");
+  TEST_ASSERT_FALSE(
+      resumeDecode(state, &restored, description, sizeof(description)));
+}
+
+void test_resume_wake_delay() {
+  // from a quarter into the second to just after the end second starts, or
+  // to the next glance
+  const uint64_t second = 1000000;
+  TEST_ASSERT_TRUE(resumeWakeDelay(1000, 250000, 1600, 0) ==
+                   600 * second - 250000 + RESUME_WAKE_LATE);
+  TEST_ASSERT_TRUE(resumeWakeDelay(1000, 250000, 1600, 60) ==
+                   60 * second - 250000 + RESUME_WAKE_LATE);
+  TEST_ASSERT_TRUE(resumeWakeDelay(1000, 250000, 1600, 900) ==
+                   600 * second - 250000 + RESUME_WAKE_LATE);
+  TEST_ASSERT_TRUE(resumeWakeDelay(1600, 0, 1600, 0) == 0);
+  TEST_ASSERT_TRUE(resumeWakeDelay(1601, 0, 1600, 0) == 0);
+}
+
+void test_resume_after_end() {
+  // a session that ended while asleep is finished on the first update,
+  // even when the boot took a while
+  PomodoroTimer pomodoro;
+  pomodoro.startTimer(true, false, false);
+  PomodoroTimer::Snapshot snapshot = pomodoro.snapshot();
+
+  PomodoroTimer resumed;
+  resumed.restore(snapshot);
+  TEST_ASSERT_TRUE(resumed.getState() ==
+                   PomodoroTimer::PomodoroState::POMODORO);
+  virtualClock.advance(resumeWakeDelay(hal::clock().epoch(),
+                                       hal::clock().subsecondMicros(),
+                                       snapshot.end) +
+                       30 * 1000000ull);
+  TEST_ASSERT_EQUAL_UINT32(0, resumed.getRemainingTime());
+  resumed.update();
+  TEST_ASSERT_TRUE(resumed.getState() == PomodoroTimer::PomodoroState::REST);
+}
@@ -0,0 +1,63 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <unity.h>
+
+#include "../../src/native/hal_native.h"
+#include "../../src/scheduler.h"
+#include "./tests.h"
+
+// loop() polling the scheduler every 10 ms for the given time, 3 ms off
+// the second edge
+static uint32_t poll(RenderScheduler* scheduler, uint32_t seconds) {
+  uint32_t frames = 0;
+  virtualClock.advance(1000000 - virtualClock.subsecondMicros());
+  virtualClock.advance(993000);
+  for (uint32_t i = 0; i < seconds * 100; i++) {
+    virtualClock.advance(10000);
+    frames += scheduler->beginFrame();
+  }
+  return frames;
+}
+
+void test_scheduler_countdown() {
+  // a 25 minute session draws one frame per second, on the second edge
+  RenderScheduler scheduler;
+  scheduler.setCountdown(true);
+  uint32_t frames = poll(&scheduler, 25 * 60);
+  TEST_ASSERT_UINT32_WITHIN(1, 25 * 60, frames);
+  TEST_ASSERT_EQUAL_UINT32(frames, scheduler.getFrames());
+  TEST_ASSERT_EQUAL_UINT32(
+      frames, scheduler.getRequests(RenderScheduler::Reason::Second));
+  TEST_ASSERT_EQUAL_UINT32(3000, scheduler.getEdgeLatencyMax());
+}
+
+void test_scheduler_idle() {
+  // without a countdown only the status bar is refreshed
+  RenderScheduler scheduler;
+  uint32_t frames = poll(&scheduler, 60);
+  TEST_ASSERT_UINT32_WITHIN(1, 60 / RENDER_STATUS_INTERVAL, frames);
+}
+
+void test_scheduler_requests() {
+  // requests between two frames are drawn once, each reason is counted
+  RenderScheduler scheduler;
+  scheduler.beginFrame();  // the first second edge
+  TEST_ASSERT_FALSE(scheduler.beginFrame());
+  scheduler.request(RenderScheduler::Reason::State);
+  scheduler.request(RenderScheduler::Reason::Input);
+  scheduler.request(RenderScheduler::Reason::Input);
+  TEST_ASSERT_TRUE(scheduler.isPending());
+  TEST_ASSERT_TRUE(scheduler.beginFrame());
+  TEST_ASSERT_FALSE(scheduler.isPending());
+  TEST_ASSERT_FALSE(scheduler.beginFrame());
+  TEST_ASSERT_EQUAL_UINT32(2, scheduler.getFrames());
+  TEST_ASSERT_EQUAL_UINT32(
+      1, scheduler.getRequests(RenderScheduler::Reason::State));
+  TEST_ASSERT_EQUAL_UINT32(
+      1, scheduler.getRequests(RenderScheduler::Reason::Input));
+}
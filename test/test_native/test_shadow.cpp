@@ -0,0 +1,195 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <string.h>
+#include <unity.h>
+
+#include <string>
+
+#include "../../src/native/hal_native.h"
+#include "../../src/shadow.h"
+#include "./tests.h"
+
+// full get/accepted document, only state.desired passes the filter
+static const char* accepted =
+    "{\"state\":{\"desired\":{\"timer_state\":\"POMODORO\","
+    "\"start\":1700000000,\"description\":\"write the report\"},"
+    "\"reported\":{\"timer_state\":\"REST\",\"start\":1699999000,"
+    "\"description\":\"previous task\"}},\"metadata\":{\"desired\":"
+    "{\"timer_state\":{\"timestamp\":1700000000}}},"
+    "\"version\":42,\"timestamp\":1700000001}";
+
+// update/delta after the Lambda moved the start, the rest is unchanged
+static const char* delta =
+    "{\"version\":43,\"timestamp\":1700000100,\"state\":"
+    "{\"start\":1700000060},\"metadata\":{\"start\":"
+    "{\"timestamp\":1700000100}}}";
+
+// update/accepted echoes the state back, only the token is of interest
+static const char* update_accepted =
+    "{\"state\":{\"reported\":{\"timer_state\":\"REST\"}},\"metadata\":"
+    "{\"reported\":{\"timer_state\":{\"timestamp\":1700000200}}},"
+    "\"version\":44,\"timestamp\":1700000200,"
+    "\"clientToken\":\"" SHADOW_TOKEN_PREFIX "12\"}";
+
+static const char* update_rejected =
+    "{\"code\":409,\"message\":\"Version conflict\","
+    "\"clientToken\":\"" SHADOW_TOKEN_PREFIX "13\"}";
+
+void test_shadow_encode() {
+  char buffer[SHADOW_UPDATE_SIZE];
+  const shadowTransition history[] = {
+      {PomodoroTimer::PomodoroState::REST, 1699999000}};
+  size_t length = shadowEncodeReport(
+      buffer, sizeof(buffer), PomodoroTimer::PomodoroState::POMODORO,
+      1700000000, "write the report", true, true, history, 1, 7);
+  TEST_ASSERT_EQUAL_UINT32(strlen(buffer), length);
+  TEST_ASSERT_EQUAL_STRING(
+      "{\"state\":{\"reported\":{\"timer_state\":\"POMODORO\","
+      "\"start\":1700000000,\"description\":\"write the report\","
+      "\"history\":[{\"timer_state\":\"REST\",\"start\":1699999000}]},"
+      "\"desired\":{\"timer_state\":\"POMODORO\",\"start\":1700000000}},"
+      "\"clientToken\":\"" SHADOW_TOKEN_PREFIX "7\"}",
+      buffer);
+
+  // a document that doesn't fit isn't cut off
+  TEST_ASSERT_EQUAL_UINT32(
+      0, shadowEncodeReport(buffer, 32, PomodoroTimer::PomodoroState::REST,
+                            1700000000, "", true, false));
+}
+
+void test_shadow_batch() {
+  // a full history with the longest description fits the pool: the encoder
+  // returns 0 if doc.overflowed()
+  shadowTransition history[SHADOW_HISTORY_LENGTH];
+  for (int i = 0; i < SHADOW_HISTORY_LENGTH; i++) {
+    history[i] = {i % 2 ? PomodoroTimer::PomodoroState::REST
+                        : PomodoroTimer::PomodoroState::POMODORO,
+                  1699990000u + i * 60};
+  }
+  char description[SHADOW_DESCRIPTION_LENGTH];
+  memset(description, 'd', sizeof(description) - 1);
+  description[sizeof(description) - 1] = '\0';
+  char buffer[SHADOW_UPDATE_SIZE];
+  size_t length = shadowEncodeReport(
+      buffer, sizeof(buffer), PomodoroTimer::PomodoroState::POMODORO,
+      1700000000, description, true, true, history, SHADOW_HISTORY_LENGTH,
+      UINT32_MAX);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, length);
+  TEST_ASSERT_EQUAL_UINT32(strlen(buffer), length);
+  TEST_ASSERT_NOT_NULL(strstr(buffer, description));
+  // every entry is there, the last one too
+  TEST_ASSERT_NOT_NULL(strstr(buffer, "{\"timer_state\":\"POMODORO\","
+                                      "\"start\":1699990000}"));
+  TEST_ASSERT_NOT_NULL(strstr(buffer, "{\"timer_state\":\"REST\","
+                                      "\"start\":1699990420}]"));
+  TEST_ASSERT_NOT_NULL(strstr(buffer, "\"clientToken\":\"" SHADOW_TOKEN_PREFIX
+                                      "4294967295\""));
+}
+
+void test_shadow_decode() {
+  shadowDesired desired;
+  TEST_ASSERT_TRUE(shadowDecodeDesired(accepted, strlen(accepted), &desired));
+  TEST_ASSERT_TRUE(desired.has_timer_state);
+  TEST_ASSERT_TRUE(desired.timer_state ==
+                   PomodoroTimer::PomodoroState::POMODORO);
+  TEST_ASSERT_EQUAL_UINT32(1700000000, desired.start);
+  TEST_ASSERT_EQUAL_STRING("write the report", desired.description);
+  TEST_ASSERT_EQUAL_UINT32(42, desired.version);
+  TEST_ASSERT_EQUAL_UINT32(1700000000, desired.updated);
+  TEST_ASSERT_EQUAL_UINT32(0, desired.client_token);
+
+  TEST_ASSERT_TRUE(shadowDecodeDelta(delta, strlen(delta), &desired));
+  TEST_ASSERT_FALSE(desired.has_timer_state);
+  TEST_ASSERT_TRUE(desired.has_start);
+  TEST_ASSERT_FALSE(desired.has_description);
+  TEST_ASSERT_EQUAL_UINT32(1700000060, desired.start);
+  TEST_ASSERT_EQUAL_UINT32(43, desired.version);
+  TEST_ASSERT_EQUAL_UINT32(1700000100, desired.updated);
+
+  // the document timestamp doesn't say when the field was written
+  const char* untimed =
+      "{\"version\":45,\"timestamp\":1700000300,\"state\":"
+      "{\"timer_state\":\"STOPPED\"}}";
+  TEST_ASSERT_TRUE(shadowDecodeDelta(untimed, strlen(untimed), &desired));
+  TEST_ASSERT_TRUE(desired.has_timer_state);
+  TEST_ASSERT_EQUAL_UINT32(0, desired.updated);
+
+  TEST_ASSERT_FALSE(shadowDecodeDelta("{\"state\":", 9, &desired));
+
+  // every field with its timestamp, the longest description and token fit
+  // the pools
+  std::string fields =
+      "{\"timer_state\":\"UNDEFINED\",\"start\":1700000060,"
+      "\"description\":\"" +
+      std::string(SHADOW_DESCRIPTION_LENGTH - 1, 'd') + "\"}";
+  std::string timestamps =
+      "{\"timer_state\":{\"timestamp\":1700000101},"
+      "\"start\":{\"timestamp\":1700000102},"
+      "\"description\":{\"timestamp\":1700000103}}";
+  std::string rest =
+      ",\"version\":46,\"timestamp\":1700000104,"
+      "\"clientToken\":\"" SHADOW_TOKEN_PREFIX "4294967295\"}";
+  std::string full_delta = "{\"state\":" + fields +
+                           ",\"metadata\":" + timestamps + rest;
+  std::string full_accepted = "{\"state\":{\"desired\":" + fields +
+                              "},\"metadata\":{\"desired\":" +
+                              timestamps + "}" + rest;
+  TEST_ASSERT_TRUE(
+      shadowDecodeDelta(full_delta.c_str(), full_delta.size(), &desired));
+  TEST_ASSERT_EQUAL_UINT32(SHADOW_DESCRIPTION_LENGTH - 1,
+                           strlen(desired.description));
+  TEST_ASSERT_EQUAL_UINT32(1700000103, desired.updated);
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, desired.client_token);
+  TEST_ASSERT_TRUE(shadowDecodeDesired(full_accepted.c_str(),
+                                       full_accepted.size(), &desired));
+  TEST_ASSERT_EQUAL_UINT32(SHADOW_DESCRIPTION_LENGTH - 1,
+                           strlen(desired.description));
+  TEST_ASSERT_EQUAL_UINT32(1700000103, desired.updated);
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, desired.client_token);
+}
+
+void test_shadow_response() {
+  shadowResponse response;
+  TEST_ASSERT_TRUE(shadowDecodeResponse(
+      update_accepted, strlen(update_accepted), &response));
+  TEST_ASSERT_EQUAL_UINT32(12, response.client_token);
+  TEST_ASSERT_EQUAL_UINT32(0, response.code);
+
+  TEST_ASSERT_TRUE(shadowDecodeResponse(
+      update_rejected, strlen(update_rejected), &response));
+  TEST_ASSERT_EQUAL_UINT32(13, response.client_token);
+  TEST_ASSERT_EQUAL_UINT32(409, response.code);
+}
+
+void test_shadow_allocations() {
+  // the counter works, so a zero below means something
+  uint32_t before = heapAllocations();
+  std::string heap(64, 'x');
+  TEST_ASSERT_GREATER_THAN_UINT32(before, heapAllocations());
+
+  char buffer[SHADOW_UPDATE_SIZE];
+  const shadowTransition history[] = {
+      {PomodoroTimer::PomodoroState::POMODORO, 1699998000},
+      {PomodoroTimer::PomodoroState::REST, 1699999500}};
+  shadowDesired desired;
+  shadowResponse response;
+  auto messages = [&](uint32_t i) {
+    shadowEncodeReport(buffer, sizeof(buffer),
+                       PomodoroTimer::PomodoroState::POMODORO, 1700000000 + i,
+                       "write the report", true, true, history, 2, i + 1);
+    shadowDecodeDesired(accepted, strlen(accepted), &desired);
+    shadowDecodeDelta(delta, strlen(delta), &desired);
+    shadowDecodeResponse(update_accepted, strlen(update_accepted), &response);
+  };
+  messages(0);  // the parser filters are built on the first decode
+  before = heapAllocations();
+  for (uint32_t i = 1; i <= 100; i++) {
+    messages(i);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, heapAllocations() - before);
+}
@@ -0,0 +1,65 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <unity.h>
+
+#include "../../src/target.h"
+#include "./tests.h"
+
+void test_target_colors() {
+  // the UI colors survive RGB332 exactly
+  const uint16_t exact[] = {0x0000, 0xFFFF, 0xF800, 0x07E0, 0x001F};
+  for (uint16_t color : exact) {
+    TEST_ASSERT_EQUAL_HEX16(color, targetColor565(targetColor332(color)));
+  }
+  // and every RGB332 color comes back as itself
+  for (int color = 0; color < 256; color++) {
+    TEST_ASSERT_EQUAL_UINT8(color, targetColor332(targetColor565(color)));
+  }
+}
+
+void test_target_memory() {
+  TEST_ASSERT_EQUAL_UINT32(320 * 240 * 2 * 2,
+                           targetMemory(SCREEN_TARGET_RGB565, 320, 240, 2));
+  TEST_ASSERT_EQUAL_UINT32(320 * 240 * 2,
+                           targetMemory(SCREEN_TARGET_RGB332, 320, 240, 2));
+  TEST_ASSERT_EQUAL_UINT32(320 * SCREEN_BAND_HEIGHT * 2 * 2,
+                           targetMemory(SCREEN_TARGET_BANDS, 320, 240, 2));
+  // a screen lower than a band
+  TEST_ASSERT_EQUAL_UINT32(320 * 10 * 2,
+                           targetMemory(SCREEN_TARGET_BANDS, 320, 10, 1));
+  TEST_ASSERT_EQUAL_STRING("bands", targetName(SCREEN_TARGET_BANDS));
+  TEST_ASSERT_EQUAL_STRING("?", targetName(-1));
+}
+
+void test_target_bands() {
+  // status bar, countdown digits and progress bar of the pomodoro screen
+  const targetRows damage[] = {{0, 16}, {72, 96}, {200, 40}};
+  int16_t bands[16];
+  int count = targetBands(damage, 3, 240, bands, 16);
+  const int16_t expect[] = {0, 72, 96, 120, 144, 192, 216};
+  TEST_ASSERT_EQUAL_INT(7, count);
+  for (int i = 0; i < count; i++) {
+    TEST_ASSERT_EQUAL_INT16(expect[i], bands[i]);
+  }
+
+  // rows ending on a band edge don't touch the next band
+  const targetRows edge[] = {{SCREEN_BAND_HEIGHT, SCREEN_BAND_HEIGHT}};
+  TEST_ASSERT_EQUAL_INT(1, targetBands(edge, 1, 240, bands, 16));
+  TEST_ASSERT_EQUAL_INT16(SCREEN_BAND_HEIGHT, bands[0]);
+
+  // nothing changed, nothing drawn
+  TEST_ASSERT_EQUAL_INT(0, targetBands(damage, 0, 240, bands, 16));
+
+  // the whole screen, the last band is cut short by its bottom
+  const targetRows all[] = {{0, 250}};
+  TEST_ASSERT_EQUAL_INT(11, targetBands(all, 1, 250, bands, 16));
+  TEST_ASSERT_EQUAL_INT16(240, bands[10]);
+  // no more than fit
+  TEST_ASSERT_EQUAL_INT(4, targetBands(all, 1, 250, bands, 4));
+  TEST_ASSERT_EQUAL_INT16(72, bands[3]);
+}
@@ -0,0 +1,144 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#include <string.h>
+#include <unity.h>
+
+#include <string>
+
+#include "../../src/PomodoroTimer.h"
+#include "../../src/native/hal_native.h"
+#include "./tests.h"
+
+void test_timer_session() {
+  // a 25 minute pomodoro runs into the 5 minute rest and stops after it,
+  // reporting and dinging at each end
+  PomodoroTimer pomodoro;
+  virtualClock.advance(1000000 - virtualClock.subsecondMicros());
+  pomodoro.startTimer(true, false, false);
+  TEST_ASSERT_TRUE(pomodoro.getState() ==
+                   PomodoroTimer::PomodoroState::POMODORO);
+  TEST_ASSERT_EQUAL_UINT32(25 * 60, pomodoro.getRemainingTime());
+
+  virtualClock.advance(25 * 60 * 1000000ull - 1);
+  pomodoro.update();
+  TEST_ASSERT_TRUE(pomodoro.getState() ==
+                   PomodoroTimer::PomodoroState::POMODORO);
+  virtualClock.advance(1);
+  pomodoro.update();
+  TEST_ASSERT_TRUE(pomodoro.getState() == PomodoroTimer::PomodoroState::REST);
+  TEST_ASSERT_EQUAL_UINT32(5 * 60, pomodoro.getRemainingTime());
+
+  virtualClock.advance(5 * 60 * 1000000ull);
+  pomodoro.update();
+  TEST_ASSERT_TRUE(pomodoro.getState() ==
+                   PomodoroTimer::PomodoroState::STOPPED);
+  TEST_ASSERT_EQUAL_UINT32(3, reports);
+  TEST_ASSERT_EQUAL_UINT32(1 + 1 + 2, sounds_played);
+  TEST_ASSERT_EQUAL_UINT32(0, pomodoro.getDeadline());
+}
+
+void test_timer_format() {
+  PomodoroTimer pomodoro;
+  char text[TIMER_TEXT_SIZE];
+  pomodoro.startTimer(true, false, false);
+  TEST_ASSERT_EQUAL_UINT32(5, pomodoro.formatTime(text));
+  TEST_ASSERT_EQUAL_STRING("25:00", text);
+
+  // the remaining time is rounded up to the second
+  virtualClock.advance(61500000);
+  pomodoro.formatTime(text);
+  TEST_ASSERT_EQUAL_STRING("23:59", text);
+  TEST_ASSERT_EQUAL_STRING(text, pomodoro.formattedTime().c_str());
+
+  pomodoro.stopTimer();
+  pomodoro.formatTime(text);
+  TEST_ASSERT_EQUAL_STRING("00:00", text);
+}
+
+// runs a short pomodoro to its end with a 3 s NTP step of the wall clock
+// halfway through, returns how late the end fired in us
+static uint32_t runDeadline(bool sleeping, uint32_t* largest_step) {
+  const uint32_t length =
+      PomodoroTimer::toInt(PomodoroTimer::PomodoroLength::SMALL) * 60;
+  uint32_t random = 2463534242u;
+  PomodoroTimer pomodoro;
+  virtualClock.advance(123457);  // off the second edge
+  uint64_t expected = virtualClock.monotonicMicros() + length * 1000000ull -
+                      virtualClock.subsecondMicros();
+  pomodoro.startTimer(true, false, false);
+  uint32_t remaining = pomodoro.getRemainingTime();
+  bool stepped = false;
+  *largest_step = 0;
+
+  while (pomodoro.getState() == PomodoroTimer::PomodoroState::POMODORO) {
+    uint64_t now = virtualClock.monotonicMicros();
+    uint64_t us;
+    if (sleeping) {
+      // like PowerManager, to the next second edge or the deadline
+      us = 1000000 - virtualClock.subsecondMicros() + 2000;
+      uint64_t deadline = pomodoro.getDeadline();
+      if (deadline < now + us) {
+        us = deadline > now ? deadline - now : 1;
+      }
+    } else {
+      // like the awake loop(), every 1 - 9 ms
+      random ^= random << 13;
+      random ^= random >> 17;
+      random ^= random << 5;
+      us = 1000 + random % 8000;
+    }
+    virtualClock.advance(us);
+    if (!stepped && pomodoro.getRemainingTime() < length / 2) {
+      virtualClock.step(3000000);  // NTP found the RTC 3 s behind
+      pomodoro.shift(3);
+      stepped = true;
+    }
+    pomodoro.update();
+    if (pomodoro.getState() == PomodoroTimer::PomodoroState::POMODORO) {
+      uint32_t left = pomodoro.getRemainingTime();
+      if (remaining - left > *largest_step) {
+        *largest_step = remaining - left;
+      }
+      remaining = left;
+    }
+  }
+  TEST_ASSERT_TRUE(stepped);
+  TEST_ASSERT_TRUE(virtualClock.monotonicMicros() >= expected);
+  return virtualClock.monotonicMicros() - expected;
+}
+
+void test_timer_deadline() {
+  // the end fires on the monotonic deadline, not on a 1 s tick, and the
+  // wall clock step moves neither the end nor the countdown
+  uint32_t largest_step;
+  TEST_ASSERT_LESS_THAN_UINT32(10000, runDeadline(false, &largest_step));
+  TEST_ASSERT_EQUAL_UINT32(1, largest_step);
+  TEST_ASSERT_EQUAL_UINT32(0, runDeadline(true, &largest_step));
+  TEST_ASSERT_EQUAL_UINT32(1, largest_step);
+}
+
+static std::string delivered;
+
+static void deliver(const char* topic, const char* payload, size_t length) {
+  delivered.assign(payload, length);
+}
+
+void test_loopback_mqtt() {
+  // published messages come back on loop() to the subscribers only
+  delivered.clear();
+  loopbackMqtt.onMessage(deliver);
+  TEST_ASSERT_TRUE(loopbackMqtt.subscribe("test/loopback"));
+  TEST_ASSERT_TRUE(loopbackMqtt.publish("test/other", "ignored"));
+  TEST_ASSERT_TRUE(loopbackMqtt.publish("test/loopback", "hello"));
+  TEST_ASSERT_TRUE(delivered.empty());
+  loopbackMqtt.loop();
+  TEST_ASSERT_EQUAL_STRING("hello", delivered.c_str());
+
+  loopbackMqtt.online = false;
+  TEST_ASSERT_FALSE(loopbackMqtt.publish("test/loopback", "offline"));
+}
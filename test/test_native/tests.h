@@ -0,0 +1,99 @@
+/**
+
+M5Stack pomodoro timer
+Copyright 2023 Sergei Chistokhin
+
+**/
+
+#pragma once
+
+// host tests of the portable logic, run by test_main.cpp:
+//   pio test -e native
+
+// test_adpcm.cpp
+void test_adpcm_known_codes();
+void test_adpcm_reference();
+
+// test_assets.cpp
+void test_png_size();
+void test_png_size_rejects();
+
+// test_clock.cpp
+void test_clock_ntp();
+void test_clock_step();
+void test_clock_drift();
+void test_clock_rtc();
+void test_clock_edge();
+
+// test_frametime.cpp
+void test_frame_timing();
+void test_frame_pipeline();
+
+// test_glyphs.cpp
+void test_glyph_layout();
+void test_glyph_allocations();
+
+// test_input.cpp
+void test_input_debounce();
+void test_input_encoder();
+void test_input_gestures();
+void test_input_polling();
+void test_input_trace();
+
+// test_lights.cpp
+void test_lights_progress();
+void test_lights_dither();
+void test_lights_flash();
+void test_lights_reset();
+
+// test_links.cpp
+void test_links_backoff();
+void test_links_jitter();
+void test_links_reset();
+void test_links_timeout();
+void test_links_layers();
+
+// test_outbox.cpp
+void test_outbox_order();
+void test_outbox_retry();
+void test_outbox_sections();
+void test_outbox_rejected();
+void test_outbox_reboot();
+void test_outbox_allocations();
+
+// test_queue.cpp
+void test_queue_order();
+void test_queue_threads();
+
+// test_replay.cpp
+void test_replay_budget();
+void test_replay_tracker();
+
+// test_resume.cpp
+void test_resume_roundtrip();
+void test_resume_rejects();
+void test_resume_wake_delay();
+void test_resume_after_end();
+
+// test_scheduler.cpp
+void test_scheduler_countdown();
+void test_scheduler_idle();
+void test_scheduler_requests();
+
+// test_shadow.cpp
+void test_shadow_encode();
+void test_shadow_batch();
+void test_shadow_decode();
+void test_shadow_response();
+void test_shadow_allocations();
+
+// test_target.cpp
+void test_target_colors();
+void test_target_memory();
+void test_target_bands();
+
+// test_timer.cpp
+void test_timer_session();
+void test_timer_format();
+void test_timer_deadline();
+void test_loopback_mqtt();